@@ -6,6 +6,8 @@
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 
 /*
@@ -774,9 +776,9 @@ uint8_t *aes_encrypt(uint8_t *plaintext, uint8_t *key, uint8_t type)
     //ADDROUND KEY
     AddRoundKey(state, dw[Nr]);
     
+    ciphertext = state_to_array(state);
     free(dw);
     free(state);
-    ciphertext = state_to_array(state);
     
     return ciphertext;
 }
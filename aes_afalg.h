@@ -0,0 +1,502 @@
+#ifndef aes_afalg_h
+#define aes_afalg_h
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/if_alg.h>
+#include "aes_block.h"
+#include "aes_cbc.h"
+#include "aes_ctr.h"
+#include "aes_drbg.h"
+
+#ifndef SOL_ALG
+#define SOL_ALG 279
+#endif
+#ifndef SPLICE_F_MORE
+#define SPLICE_F_MORE 4
+#endif
+
+/*
+    Optional backend on the Linux kernel crypto API (AF_ALG sockets) for
+    bulk ECB, CBC, CTR and GCM.
+
+    A transform socket is bound to "ecb(aes)", "cbc(aes)", "ctr(aes)" or
+    "gcm(aes)" and keyed once. Each operation sends the op, IV and
+    associated data length as control messages on an accepted op socket.
+    Then the data follows. Large buffers are moved with vmsplice into a
+    pipe and spliced into the socket, so the kernel takes the user pages
+    without a copy. The result is read back. Block modes go in pieces of
+    ALG_PIECE bytes, the pipe's capacity. CBC and CTR carry the IV from
+    piece to piece the same way the userspace calls leave it (last
+    ciphertext block, next counter). So both backends can be swapped for
+    each other mid-stream.
+
+    aes_alg_calibrate times both backends on the same buffer, and
+    aes_alg_dispatch then sends large buffers to whichever was faster. The
+    kernel may use a driver this library does not have (AES-NI, a crypto
+    engine). aes_alg_crosscheck runs random keys, IVs and lengths through
+    both and counts mismatches, as an independent check of the userspace
+    kernels. An AES_ALG is used by one thread at a time. When AF_ALG is
+    missing (kernel option, container policy), aes_alg_open fails and
+    everything stays in userspace. An operation that fails part way leaves
+    data queued on the op socket, so the op socket is closed and accepted
+    again before the next one.
+*/
+
+#define ALG_PIECE (64*1024)     //bytes per block-mode operation
+#define ALG_SPLICE_MIN 4096     //smaller buffers go with sendmsg
+#define ALG_MIN_OFFLOAD 65536   //dispatch: smaller buffers stay in userspace
+#define ALG_GCM_MAX (64*1024)   //associated data + text per GCM call
+#define ALG_CALIBRATE_RUNS 5    //timed runs per backend, the best counts
+
+typedef enum aes_alg_mode
+{
+    AES_ALG_ECB,
+    AES_ALG_CBC,
+    AES_ALG_CTR,
+    AES_ALG_GCM
+}AES_ALG_MODE;
+
+typedef struct aes_alg
+{
+    int tfm, op;                //transform and operation sockets
+    int pipe[2];                //vmsplice -> splice, -1 if unavailable
+    AES_ALG_MODE mode;
+    size_t taglen;              //GCM
+    bool offload;               //set by aes_alg_calibrate
+}AES_ALG;
+
+/*-------------------------------------------------------------------------
+                            OPEN / CLOSE
+ pre: type (0) 128, (1) 192, (2) 256; taglen 4 to 16 for GCM.
+ post: returns 0, or -1 if AF_ALG or the algorithm is not available.
+-------------------------------------------------------------------------*/
+int aes_alg_open(AES_ALG *a, AES_ALG_MODE mode, const uint8_t *key, uint8_t type, size_t taglen)
+{
+    static const char *names[4] = {"ecb(aes)", "cbc(aes)", "ctr(aes)", "gcm(aes)"};
+    struct sockaddr_alg sa;
+
+    memset(a, 0, sizeof(AES_ALG));
+    a->tfm = a->op = a->pipe[0] = a->pipe[1] = -1;
+    a->mode = mode;
+    a->taglen = taglen;
+    if(mode > AES_ALG_GCM || type > 2 || (mode == AES_ALG_GCM && (taglen < 4 || taglen > 16)))
+        return -1;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.salg_family = AF_ALG;
+    strcpy((char*)sa.salg_type, mode == AES_ALG_GCM? "aead" : "skcipher");
+    strcpy((char*)sa.salg_name, names[mode]);
+    a->tfm = socket(AF_ALG, SOCK_SEQPACKET, 0);
+    if(a->tfm < 0 || bind(a->tfm, (struct sockaddr*)&sa, sizeof(sa)) != 0)
+        goto fail;
+    if(setsockopt(a->tfm, SOL_ALG, ALG_SET_KEY, key, 16 + 8*type) != 0)
+        goto fail;
+    if(mode == AES_ALG_GCM && setsockopt(a->tfm, SOL_ALG, ALG_SET_AEAD_AUTHSIZE, NULL, (socklen_t)taglen) != 0)
+        goto fail;
+    a->op = accept(a->tfm, NULL, NULL);
+    if(a->op < 0)
+        goto fail;
+    if(pipe(a->pipe) != 0)
+        a->pipe[0] = a->pipe[1] = -1;
+    return 0;
+
+fail:
+    if(a->tfm >= 0) close(a->tfm);
+    a->tfm = -1;
+    return -1;
+}
+
+//a fresh op socket and pipe: nothing of a failed operation is left queued
+static void alg_reset(AES_ALG *a)
+{
+    if(a->op >= 0) close(a->op);
+    a->op = a->tfm >= 0? accept(a->tfm, NULL, NULL) : -1;
+    if(a->pipe[0] >= 0)
+    {
+        close(a->pipe[0]);
+        close(a->pipe[1]);
+        if(pipe(a->pipe) != 0)
+            a->pipe[0] = a->pipe[1] = -1;
+    }
+}
+
+void aes_alg_close(AES_ALG *a)
+{
+    if(a->op >= 0) close(a->op);
+    if(a->tfm >= 0) close(a->tfm);
+    if(a->pipe[0] >= 0) close(a->pipe[0]);
+    if(a->pipe[1] >= 0) close(a->pipe[1]);
+    a->op = a->tfm = a->pipe[0] = a->pipe[1] = -1;
+}
+
+/*-------------------------------------------------------------------------
+        Send one operation: control messages, then the data by sendmsg
+        or, for large buffers, vmsplice + splice
+-------------------------------------------------------------------------*/
+static int alg_send(AES_ALG *a, bool decrypt, const uint8_t *iv, size_t ivlen, size_t assoclen,
+                    const struct iovec *iov, int niov, size_t total)
+{
+    uint8_t cbuf[CMSG_SPACE(sizeof(uint32_t))*2 + CMSG_SPACE(sizeof(struct af_alg_iv) + 16)];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct af_alg_iv *aiv;
+    bool splice_data = a->pipe[0] >= 0 && total >= ALG_SPLICE_MIN;
+    uint32_t op = decrypt? ALG_OP_DECRYPT : ALG_OP_ENCRYPT;
+    ssize_t n, m;
+
+    memset(cbuf, 0, sizeof(cbuf));
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = cbuf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(uint32_t));
+    if(ivlen)
+        msg.msg_controllen += CMSG_SPACE(sizeof(struct af_alg_iv) + ivlen);
+    if(a->mode == AES_ALG_GCM)
+        msg.msg_controllen += CMSG_SPACE(sizeof(uint32_t));
+
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_ALG;
+    cm->cmsg_type = ALG_SET_OP;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+    memcpy(CMSG_DATA(cm), &op, sizeof(op));
+    if(ivlen)
+    {
+        cm = CMSG_NXTHDR(&msg, cm);
+        cm->cmsg_level = SOL_ALG;
+        cm->cmsg_type = ALG_SET_IV;
+        cm->cmsg_len = CMSG_LEN(sizeof(struct af_alg_iv) + ivlen);
+        aiv = (struct af_alg_iv*)CMSG_DATA(cm);
+        aiv->ivlen = (uint32_t)ivlen;
+        memcpy(aiv->iv, iv, ivlen);
+    }
+    if(a->mode == AES_ALG_GCM)
+    {
+        uint32_t al = (uint32_t)assoclen;
+        cm = CMSG_NXTHDR(&msg, cm);
+        cm->cmsg_level = SOL_ALG;
+        cm->cmsg_type = ALG_SET_AEAD_ASSOCLEN;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+        memcpy(CMSG_DATA(cm), &al, sizeof(al));
+    }
+
+    if(!splice_data)
+    {
+        msg.msg_iov = (struct iovec*)iov;
+        msg.msg_iovlen = (size_t)niov;
+        while((n = sendmsg(a->op, &msg, 0)) < 0 && errno == EINTR);
+        return n == (ssize_t)total? 0 : -1;
+    }
+    while((n = sendmsg(a->op, &msg, MSG_MORE)) < 0 && errno == EINTR);
+    if(n < 0)
+        return -1;
+    for(int i = 0; i < niov; i++)
+    {
+        struct iovec v = iov[i];
+        while(v.iov_len > 0)
+        {
+            //raw syscalls: the wrappers need _GNU_SOURCE before every include
+            n = syscall(__NR_vmsplice, a->pipe[1], &v, 1, 0);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                return -1;
+            total -= (size_t)n;
+            v.iov_base = (uint8_t*)v.iov_base + n;
+            v.iov_len -= (size_t)n;
+            while(n > 0)
+            {
+                m = syscall(__NR_splice, a->pipe[0], NULL, a->op, NULL, (size_t)n, total > 0? SPLICE_F_MORE : 0);
+                if(m < 0 && errno == EINTR)
+                    continue;
+                if(m <= 0)
+                    return -1;
+                n -= m;
+            }
+        }
+    }
+    return 0;
+}
+
+static int alg_recv(AES_ALG *a, struct iovec *iov, int niov, size_t total)
+{
+    ssize_t n;
+
+    while(total > 0)
+    {
+        n = readv(a->op, iov, niov);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        total -= (size_t)n;
+        while(n > 0)
+        {
+            size_t t = (size_t)n < iov->iov_len? (size_t)n : iov->iov_len;
+            iov->iov_base = (uint8_t*)iov->iov_base + t;
+            iov->iov_len -= t;
+            n -= (ssize_t)t;
+            if(iov->iov_len == 0)
+            {
+                iov++;
+                niov--;
+            }
+        }
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                    ECB / CBC / CTR IN THE KERNEL
+ pre: len a multiple of 16 for ECB and CBC; iv of 16 bytes for CBC and
+      CTR; out may equal in.
+ post: returns 0, or -1 on a bad length or a socket error (the op socket
+       is then replaced). iv is left as aes_cbc_encrypt/decrypt and
+       aes_ctr_xor leave it.
+-------------------------------------------------------------------------*/
+int aes_alg_crypt(AES_ALG *a, bool decrypt, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len)
+{
+    uint8_t next[AES_BLOCK];
+    struct iovec vi, vo;
+    size_t n;
+
+    if(a->op < 0 || a->mode == AES_ALG_GCM || (a->mode != AES_ALG_CTR && len % AES_BLOCK))
+        return -1;
+    while(len > 0)
+    {
+        n = len < ALG_PIECE? len : ALG_PIECE;
+        //the chaining value for the next piece, before out overwrites in
+        if(a->mode == AES_ALG_CBC && decrypt)
+            memcpy(next, in + n - AES_BLOCK, AES_BLOCK);
+        vi = (struct iovec){(void*)in, n};
+        vo = (struct iovec){out, n};
+        if(alg_send(a, decrypt, iv, a->mode == AES_ALG_ECB? 0 : AES_BLOCK, 0, &vi, 1, n) != 0 ||
+           alg_recv(a, &vo, 1, n) != 0)
+        {
+            alg_reset(a);
+            return -1;
+        }
+        if(a->mode == AES_ALG_CBC)
+            memcpy(iv, decrypt? next : out + n - AES_BLOCK, AES_BLOCK);
+        else if(a->mode == AES_ALG_CTR)
+            ctr128_add(iv, (n + AES_BLOCK - 1) / AES_BLOCK);
+        in += n;
+        out += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                            GCM IN THE KERNEL
+ pre: 12-byte iv, alen + len at most ALG_GCM_MAX, out may equal in.
+ post: returns 0, or -1 on a socket error or (decryption) a tag that does
+       not match, in which case out is wiped.
+-------------------------------------------------------------------------*/
+static int alg_gcm(AES_ALG *a, bool decrypt, const uint8_t *iv, const uint8_t *aad, size_t alen,
+                   const uint8_t *in, uint8_t *out, size_t len, uint8_t *tag)
+{
+    struct iovec vi[3], vo[3];
+    uint8_t *scratch;
+    int rc = -1;
+
+    if(a->op < 0 || a->mode != AES_ALG_GCM || alen + len > ALG_GCM_MAX)
+        return -1;
+    //the kernel echoes the associated data ahead of the output
+    scratch = malloc(alen + 1);
+    if(scratch == NULL)
+        return -1;
+    vi[0] = (struct iovec){(void*)aad, alen};
+    vi[1] = (struct iovec){(void*)in, len};
+    vi[2] = (struct iovec){tag, a->taglen};
+    vo[0] = (struct iovec){scratch, alen};
+    vo[1] = (struct iovec){out, len};
+    vo[2] = (struct iovec){tag, a->taglen};
+    if(alg_send(a, decrypt, iv, 12, alen, vi, decrypt? 3 : 2, alen + len + (decrypt? a->taglen : 0)) == 0 &&
+       alg_recv(a, vo, decrypt? 2 : 3, alen + len + (decrypt? 0 : a->taglen)) == 0)
+        rc = 0;
+    free(scratch);
+    if(rc != 0)
+        alg_reset(a);
+    if(rc != 0 && decrypt)
+        memset(out, 0, len);
+    return rc;
+}
+
+int aes_alg_gcm_encrypt(AES_ALG *a, const uint8_t *iv, const uint8_t *aad, size_t alen,
+                        const uint8_t *in, uint8_t *out, size_t len, uint8_t *tag)
+{
+    return alg_gcm(a, false, iv, aad, alen, in, out, len, tag);
+}
+
+int aes_alg_gcm_decrypt(AES_ALG *a, const uint8_t *iv, const uint8_t *aad, size_t alen,
+                        const uint8_t *in, uint8_t *out, size_t len, const uint8_t *tag)
+{
+    uint8_t t[16];
+
+    memcpy(t, tag, a->taglen);
+    return alg_gcm(a, true, iv, aad, alen, in, out, len, t);
+}
+
+/*-------------------------------------------------------------------------
+                        Userspace path of a block mode
+-------------------------------------------------------------------------*/
+static void alg_user(AES_ALG_MODE mode, const AES_CTX *ctx, bool decrypt, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t len)
+{
+    if(mode == AES_ALG_CTR)
+        aes_ctr_xor(ctx, iv, in, out, len);
+    else if(mode == AES_ALG_CBC)
+    {
+        if(decrypt)
+            aes_cbc_decrypt(ctx, iv, in, out, len / AES_BLOCK);
+        else
+            aes_cbc_encrypt(ctx, iv, in, out, len / AES_BLOCK);
+    }
+    else if(decrypt)
+        aes_decrypt_blocks(ctx, in, out, len / AES_BLOCK);
+    else
+        aes_encrypt_blocks(ctx, in, out, len / AES_BLOCK);
+}
+
+static double alg_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*-------------------------------------------------------------------------
+                    CALIBRATE: which backend is faster
+ pre: ctx keyed with the same key as a (aes_setkey for ECB/CBC decryption).
+ post: a->offload set if the kernel encrypted 1 MiB faster, best of
+       ALG_CALIBRATE_RUNS each, after a warm-up run of both on the
+       already faulted-in buffer.
+-------------------------------------------------------------------------*/
+void aes_alg_calibrate(AES_ALG *a, const AES_CTX *ctx)
+{
+    size_t len = 1 << 20;
+    uint8_t iv[AES_BLOCK] = {0}, *buf = malloc(len);
+    double t0, t, user = 1e30, kern = 1e30;
+
+    a->offload = false;
+    if(buf == NULL || a->mode == AES_ALG_GCM)
+    {
+        free(buf);
+        return;
+    }
+    memset(buf, 0x5a, len);
+    alg_user(a->mode, ctx, false, iv, buf, buf, len);
+    if(aes_alg_crypt(a, false, iv, buf, buf, len) != 0)
+    {
+        free(buf);
+        return;
+    }
+    //interleaved, so a change in clock or load hits both sides
+    for(int r = 0; r < ALG_CALIBRATE_RUNS; r++)
+    {
+        t0 = alg_now();
+        alg_user(a->mode, ctx, false, iv, buf, buf, len);
+        t = alg_now() - t0;
+        user = t < user? t : user;
+        t0 = alg_now();
+        if(aes_alg_crypt(a, false, iv, buf, buf, len) != 0)
+        {
+            free(buf);
+            return;
+        }
+        t = alg_now() - t0;
+        kern = t < kern? t : kern;
+    }
+    a->offload = kern < user;
+    free(buf);
+}
+
+/*-------------------------------------------------------------------------
+                    DISPATCH: kernel or userspace
+ pre: as aes_alg_crypt; a may be NULL (not opened); ctx keyed as a.
+ post: large buffers go to the kernel when calibration found it faster,
+       everything else to the userspace kernels, as does a buffer the
+       kernel failed on. A kernel failure turns offload off until the next
+       calibration. Returns 0, or -1 if the kernel failed part way through
+       an in-place buffer, which is then left undefined.
+-------------------------------------------------------------------------*/
+int aes_alg_dispatch(AES_ALG *a, const AES_CTX *ctx, AES_ALG_MODE mode, bool decrypt, uint8_t *iv,
+                     const uint8_t *in, uint8_t *out, size_t len)
+{
+    uint8_t save[AES_BLOCK];
+
+    if(a && a->offload && a->mode == mode && len >= ALG_MIN_OFFLOAD)
+    {
+        if(iv) memcpy(save, iv, AES_BLOCK);
+        if(aes_alg_crypt(a, decrypt, iv, in, out, len) == 0)
+            return 0;
+        a->offload = false;
+        if(in == out)
+            return -1;
+        if(iv) memcpy(iv, save, AES_BLOCK);
+    }
+    alg_user(mode, ctx, decrypt, iv, in, out, len);
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+            CROSS-CHECK: random inputs through both backends
+ post: returns the number of mismatching runs (both directions, including
+       the IV left behind), or -1 if the kernel mode is not available.
+-------------------------------------------------------------------------*/
+long aes_alg_crosscheck(AES_ALG_MODE mode, size_t runs, size_t max_len)
+{
+    uint8_t key[32], iv[2][AES_BLOCK], next[AES_BLOCK], pick[4], *in, *ko, *uo;
+    AES_CTX ctx;
+    AES_ALG a;
+    long bad = 0;
+    size_t len;
+    uint8_t type;
+
+    if(mode == AES_ALG_GCM || max_len < AES_BLOCK)
+        return -1;
+    in = malloc(max_len);
+    ko = malloc(max_len);
+    uo = malloc(max_len);
+    if(in == NULL || ko == NULL || uo == NULL)
+        bad = -1;
+    for(size_t r = 0; r < runs && bad >= 0; r++)
+    {
+        aes_random(pick, sizeof(pick));
+        type = pick[0] % 3;
+        len = ((size_t)pick[1] << 16 | (size_t)pick[2] << 8 | pick[3]) % max_len + 1;
+        if(mode != AES_ALG_CTR)
+            len = len < AES_BLOCK? AES_BLOCK : len - len % AES_BLOCK;
+        aes_random(key, 32);
+        aes_random(iv[0], AES_BLOCK);
+        aes_random(in, len);
+        if(aes_alg_open(&a, mode, key, type, 0) != 0)
+        {
+            bad = -1;
+            break;
+        }
+        aes_setkey(&ctx, key, type);
+        //encrypt in -> ko / uo, then decrypt uo -> ko and in place
+        for(int d = 0; d < 2; d++)
+        {
+            memcpy(iv[1], iv[0], AES_BLOCK);
+            memcpy(next, iv[0], AES_BLOCK);
+            if(aes_alg_crypt(&a, d, next, d? uo : in, ko, len) != 0)
+                bad++;
+            alg_user(mode, &ctx, d, iv[1], d? uo : in, uo, len);
+            if(memcmp(ko, uo, len) != 0 || memcmp(next, iv[1], AES_BLOCK) != 0 || (d && memcmp(uo, in, len) != 0))
+                bad++;
+        }
+        aes_alg_close(&a);
+    }
+    aes_ctx_wipe(&ctx);
+    free(in);
+    free(ko);
+    free(uo);
+    return bad;
+}
+
+#endif /* aes_afalg_h */
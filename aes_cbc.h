@@ -0,0 +1,123 @@
+#ifndef aes_cbc_h
+#define aes_cbc_h
+#include "aes_block.h"
+
+/*
+    Cipher Block Chaining (CBC) mode, SP 800-38A 6.2.
+
+    Encryption of one message is a serial chain, so the multi-stream call
+    interleaves up to AES_LANES independent messages through the batched
+    kernel: every message stays serial, but each pass of the kernel carries
+    one block from each of them. Decryption has no such dependency and runs
+    AES_LANES blocks of the same message per pass through the equivalent
+    inverse cipher.
+*/
+
+typedef struct aes_cbc_stream
+{
+    const uint8_t *in; //plaintext, nblocks*16 bytes
+    uint8_t *out;      //ciphertext, may equal in
+    size_t nblocks;
+    uint8_t iv[16];    //initialization vector, left holding the last ciphertext block
+}AES_CBC_STREAM;
+
+/*-------------------------------------------------------------------------
+                            CBC ENCRYPTION
+ pre: iv holds the initialization vector (or the previous chaining block).
+ post: nblocks encrypted, iv holds the last ciphertext block so a message
+       can be continued by another call.
+-------------------------------------------------------------------------*/
+void aes_cbc_encrypt(const AES_CTX *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    for(size_t i = 0; i < nblocks; i++)
+    {
+        xor_block(iv, iv, in + AES_BLOCK*i);
+        aes_encrypt_block(ctx, iv, iv);
+        memcpy(out + AES_BLOCK*i, iv, AES_BLOCK);
+    }
+}
+
+/*-------------------------------------------------------------------------
+                            CBC DECRYPTION
+ P_i = InvCipher(C_i) ^ C_i-1, every InvCipher is independent so AES_LANES
+ blocks go through the kernel at once. The ciphertext of a pass is kept
+ aside so in and out may be the same buffer.
+-------------------------------------------------------------------------*/
+void aes_cbc_decrypt(const AES_CTX *ctx, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    uint8_t ct[AES_LANES*AES_BLOCK];
+    size_t lanes;
+
+    while(nblocks > 0)
+    {
+        lanes = nblocks < AES_LANES? nblocks : AES_LANES;
+        memcpy(ct, in, lanes*AES_BLOCK);
+        aes_decrypt_lanes(ctx, ct, out, lanes);
+
+        xor_block(out, out, iv);
+        for(size_t l = 1; l < lanes; l++)
+            xor_block(out + AES_BLOCK*l, out + AES_BLOCK*l, ct + AES_BLOCK*(l-1));
+        memcpy(iv, ct + AES_BLOCK*(lanes-1), AES_BLOCK);
+
+        in += lanes*AES_BLOCK;
+        out += lanes*AES_BLOCK;
+        nblocks -= lanes;
+    }
+}
+
+/*-------------------------------------------------------------------------
+                    MULTI-STREAM CBC ENCRYPTION
+ pre: n independent messages under the same key.
+ post: each stream encrypted as by aes_cbc_encrypt. A lane is refilled with
+       the next pending stream as soon as its current one runs out, so short
+       messages do not leave the kernel half empty.
+-------------------------------------------------------------------------*/
+void aes_cbc_encrypt_multi(const AES_CTX *ctx, AES_CBC_STREAM *streams, size_t n)
+{
+    uint8_t buf[AES_LANES*AES_BLOCK];
+    AES_CBC_STREAM *lane[AES_LANES];
+    size_t pos[AES_LANES], next, active;
+
+    next = 0;
+    active = 0;
+    for(;;)
+    {
+        //fill empty lanes with streams that still have blocks
+        while(active < AES_LANES && next < n)
+        {
+            if(streams[next].nblocks > 0)
+            {
+                lane[active] = &streams[next];
+                pos[active] = 0;
+                active++;
+            }
+            next++;
+        }
+        if(active == 0)
+            break;
+
+        for(size_t l = 0; l < active; l++)
+            xor_block(buf + AES_BLOCK*l, lane[l]->iv, lane[l]->in + AES_BLOCK*pos[l]);
+        aes_encrypt_lanes(ctx, buf, buf, active);
+
+        for(size_t l = 0; l < active; l++)
+        {
+            memcpy(lane[l]->iv, buf + AES_BLOCK*l, AES_BLOCK);
+            memcpy(lane[l]->out + AES_BLOCK*pos[l], buf + AES_BLOCK*l, AES_BLOCK);
+            pos[l]++;
+        }
+
+        //retire finished streams, the last lane moves into the hole
+        for(size_t l = active; l-- > 0;)
+        {
+            if(pos[l] == lane[l]->nblocks)
+            {
+                active--;
+                lane[l] = lane[active];
+                pos[l] = pos[active];
+            }
+        }
+    }
+}
+
+#endif /* aes_cbc_h */
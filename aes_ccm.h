@@ -0,0 +1,295 @@
+#ifndef aes_ccm_h
+#define aes_ccm_h
+#include "aes_block.h"
+
+/*
+    Counter with CBC-MAC (CCM), SP 800-38C / RFC 3610.
+
+    M is the tag length (4, 6, ..., 16 bytes), L the size of the length
+    field (2 to 8 bytes), so the nonce is 15-L bytes.
+
+    A frame is processed in a single pass: every step of the kernel carries
+    the next CBC-MAC block and the next counter block of the frame as two
+    lanes, so the two cipher calls per block overlap. The batch calls run
+    AES_LANES/2 frames side by side and refill a frame's lanes as soon as it
+    is done, so a stream of small frames keeps the kernel full.
+
+    On decryption the counter lane may run ahead of the MAC lane (the MAC
+    needs the recovered plaintext). On encryption it never runs ahead, so
+    in and out may be the same buffer either way.
+*/
+
+typedef struct aes_ccm_frame
+{
+    const uint8_t *nonce; //15-L bytes
+    const uint8_t *aad;
+    size_t aad_len;
+    const uint8_t *in;
+    uint8_t *out;         //may equal in
+    size_t len;
+    uint8_t *tag;         //M bytes, written on encryption and checked on decryption
+    int status;           //set by the batch calls: 0 ok, -1 bad parameters or tag
+}AES_CCM_FRAME;
+
+typedef struct ccm_state
+{
+    AES_CCM_FRAME *f;
+    uint8_t mac[16], ctr[16], s0[16];
+    uint8_t pre[10];              //encoded AAD length
+    size_t pre_len, hdr_blocks, hdr_next;
+    size_t blocks, next_ctr, next_mac;
+    bool started;
+    int8_t mac_lane, ctr_lane;    //lanes taken in the current step, -1 if none
+}CCM_STATE;
+
+/*-------------------------------------------------------------------------
+                        Parameter check and B0 / A0
+ post: returns -1 if M, L or the lengths are out of range.
+-------------------------------------------------------------------------*/
+static int ccm_start(CCM_STATE *st, AES_CCM_FRAME *f, uint8_t M, uint8_t L)
+{
+    uint64_t a = f->aad_len;
+
+    if(M < 4 || M > 16 || (M & 1) || L < 2 || L > 8) return -1;
+    if(L < 8 && (uint64_t)f->len >> (8*L)) return -1;
+
+    memset(st, 0, sizeof(CCM_STATE));
+    st->f = f;
+
+    //B0 = flags | nonce | message length, kept in mac until the first step
+    st->mac[0] = (f->aad_len > 0? 0x40 : 0) | (((M - 2) / 2) << 3) | (L - 1);
+    memcpy(st->mac + 1, f->nonce, 15 - L);
+    for(uint8_t i = 0; i < L; i++)
+        st->mac[15 - i] = (uint8_t)((uint64_t)f->len >> (8*i));
+
+    //A_i = flags | nonce | i
+    st->ctr[0] = L - 1;
+    memcpy(st->ctr + 1, f->nonce, 15 - L);
+
+    if(a == 0)
+        st->pre_len = 0;
+    else if(a < 0xff00)
+    {
+        st->pre[0] = (uint8_t)(a >> 8);
+        st->pre[1] = (uint8_t)a;
+        st->pre_len = 2;
+    }
+    else if(a >> 32 == 0)
+    {
+        st->pre[0] = 0xff; st->pre[1] = 0xfe;
+        for(uint8_t i = 0; i < 4; i++) st->pre[2 + i] = (uint8_t)(a >> (24 - 8*i));
+        st->pre_len = 6;
+    }
+    else
+    {
+        st->pre[0] = 0xff; st->pre[1] = 0xff;
+        for(uint8_t i = 0; i < 8; i++) st->pre[2 + i] = (uint8_t)(a >> (56 - 8*i));
+        st->pre_len = 10;
+    }
+    st->hdr_blocks = (st->pre_len + f->aad_len + AES_BLOCK - 1) / AES_BLOCK;
+    st->blocks = (f->len + AES_BLOCK - 1) / AES_BLOCK;
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+            k-th block of the encoded AAD length || AAD, zero padded
+-------------------------------------------------------------------------*/
+static void ccm_header_block(const CCM_STATE *st, size_t k, uint8_t *blk)
+{
+    size_t off = k*AES_BLOCK, total = st->pre_len + st->f->aad_len;
+
+    memset(blk, 0, AES_BLOCK);
+    for(uint8_t i = 0; i < AES_BLOCK && off + i < total; i++)
+        blk[i] = (off + i < st->pre_len)? st->pre[off + i] : st->f->aad[off + i - st->pre_len];
+}
+
+static inline void ccm_counter(const CCM_STATE *st, uint64_t i, uint8_t *blk, uint8_t L)
+{
+    memcpy(blk, st->ctr, AES_BLOCK);
+    for(uint8_t b = 0; b < L; b++)
+        blk[15 - b] = (uint8_t)(i >> (8*b));
+}
+
+/*-------------------------------------------------------------------------
+                        Gather a step of one frame
+ post: the frame's MAC and counter blocks appended to buf, returns the
+       number of lanes taken (0 when the frame is finished).
+-------------------------------------------------------------------------*/
+static size_t ccm_gather(CCM_STATE *st, uint8_t *buf, size_t lane, uint8_t L, bool decrypt)
+{
+    uint8_t blk[AES_BLOCK];
+    size_t n = 0, j, r;
+
+    st->mac_lane = st->ctr_lane = -1;
+    if(!st->started)
+    {
+        memcpy(buf + AES_BLOCK*lane, st->mac, AES_BLOCK);
+        ccm_counter(st, 0, buf + AES_BLOCK*(lane + 1), L);
+        st->mac_lane = (int8_t)lane;
+        st->ctr_lane = (int8_t)(lane + 1);
+        return 2;
+    }
+
+    //MAC lane: header blocks first, then payload blocks whose plaintext is known
+    if(st->hdr_next < st->hdr_blocks)
+    {
+        ccm_header_block(st, st->hdr_next, blk);
+        xor_block(buf + AES_BLOCK*lane, st->mac, blk);
+        st->mac_lane = (int8_t)(lane + n++);
+    }
+    else if(st->next_mac < st->blocks && (!decrypt || st->next_mac < st->next_ctr))
+    {
+        j = st->next_mac;
+        r = st->f->len - j*AES_BLOCK;
+        r = r < AES_BLOCK? r : AES_BLOCK;
+        memset(blk, 0, AES_BLOCK);
+        memcpy(blk, decrypt? st->f->out + j*AES_BLOCK : st->f->in + j*AES_BLOCK, r);
+        xor_block(buf + AES_BLOCK*lane, st->mac, blk);
+        st->mac_lane = (int8_t)(lane + n++);
+    }
+
+    //counter lane: on encryption never ahead of the MAC, so in place is safe
+    if(st->next_ctr < st->blocks && (decrypt || (st->mac_lane >= 0 && st->next_ctr == st->next_mac && st->hdr_next == st->hdr_blocks)))
+    {
+        ccm_counter(st, st->next_ctr + 1, buf + AES_BLOCK*(lane + n), L);
+        st->ctr_lane = (int8_t)(lane + n++);
+    }
+    return n;
+}
+
+/*-------------------------------------------------------------------------
+                    Scatter the kernel output of a step
+-------------------------------------------------------------------------*/
+static void ccm_scatter(CCM_STATE *st, const uint8_t *buf)
+{
+    size_t j, r;
+
+    if(!st->started)
+    {
+        memcpy(st->mac, buf + AES_BLOCK*st->mac_lane, AES_BLOCK);
+        memcpy(st->s0, buf + AES_BLOCK*st->ctr_lane, AES_BLOCK);
+        st->started = true;
+        return;
+    }
+    if(st->mac_lane >= 0)
+    {
+        memcpy(st->mac, buf + AES_BLOCK*st->mac_lane, AES_BLOCK);
+        if(st->hdr_next < st->hdr_blocks)
+            st->hdr_next++;
+        else
+            st->next_mac++;
+    }
+    if(st->ctr_lane >= 0)
+    {
+        j = st->next_ctr;
+        r = st->f->len - j*AES_BLOCK;
+        r = r < AES_BLOCK? r : AES_BLOCK;
+        for(size_t i = 0; i < r; i++)
+            st->f->out[j*AES_BLOCK + i] = st->f->in[j*AES_BLOCK + i] ^ buf[AES_BLOCK*st->ctr_lane + i];
+        st->next_ctr++;
+    }
+}
+
+/*-------------------------------------------------------------------------
+                    Tag: T = MSB_M(CBC-MAC) ^ MSB_M(E(A0))
+ post: returns 0, or -1 on decryption when the tag does not match, in which
+       case the recovered plaintext is wiped.
+-------------------------------------------------------------------------*/
+static int ccm_finish(CCM_STATE *st, uint8_t M, bool decrypt)
+{
+    uint8_t diff = 0;
+
+    if(!decrypt)
+    {
+        for(uint8_t i = 0; i < M; i++)
+            st->f->tag[i] = st->mac[i] ^ st->s0[i];
+        return 0;
+    }
+    for(uint8_t i = 0; i < M; i++)
+        diff |= st->f->tag[i] ^ st->mac[i] ^ st->s0[i];
+    if(diff != 0)
+    {
+        memset(st->f->out, 0, st->f->len);
+        return -1;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                            CCM BATCH
+ pre: n frames under one key with the same M and L.
+ post: frames[i].status set. AES_LANES/2 frames are in flight at a time.
+-------------------------------------------------------------------------*/
+static void ccm_batch(const AES_CTX *ctx, uint8_t M, uint8_t L, AES_CCM_FRAME *frames, size_t n, bool decrypt)
+{
+    uint8_t buf[AES_LANES*AES_BLOCK];
+    CCM_STATE st[AES_LANES/2];
+    size_t next = 0, active = 0, lanes, k;
+
+    for(;;)
+    {
+        while(active < AES_LANES/2 && next < n)
+        {
+            frames[next].status = ccm_start(&st[active], &frames[next], M, L);
+            if(frames[next].status == 0)
+                active++;
+            next++;
+        }
+        if(active == 0)
+            break;
+
+        lanes = 0;
+        for(size_t a = 0; a < active; a++)
+            lanes += ccm_gather(&st[a], buf, lanes, L, decrypt);
+        aes_encrypt_lanes(ctx, buf, buf, lanes);
+
+        for(size_t a = 0; a < active; a++)
+            ccm_scatter(&st[a], buf);
+
+        //retire finished frames, the last slot moves into the hole
+        for(k = active; k-- > 0;)
+        {
+            if(st[k].started && st[k].hdr_next == st[k].hdr_blocks &&
+               st[k].next_mac == st[k].blocks && st[k].next_ctr == st[k].blocks)
+            {
+                st[k].f->status = ccm_finish(&st[k], M, decrypt);
+                active--;
+                st[k] = st[active];
+            }
+        }
+    }
+}
+
+void aes_ccm_encrypt_batch(const AES_CTX *ctx, uint8_t M, uint8_t L, AES_CCM_FRAME *frames, size_t n)
+{
+    ccm_batch(ctx, M, L, frames, n, false);
+}
+
+void aes_ccm_decrypt_batch(const AES_CTX *ctx, uint8_t M, uint8_t L, AES_CCM_FRAME *frames, size_t n)
+{
+    ccm_batch(ctx, M, L, frames, n, true);
+}
+
+/*-------------------------------------------------------------------------
+                        CCM SINGLE FRAME
+ post: returns 0, or -1 on bad parameters or (decryption) a tag mismatch.
+-------------------------------------------------------------------------*/
+int aes_ccm_encrypt(const AES_CTX *ctx, uint8_t M, uint8_t L, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+                    const uint8_t *in, uint8_t *out, size_t len, uint8_t *tag)
+{
+    AES_CCM_FRAME f = {nonce, aad, aad_len, in, out, len, tag, 0};
+
+    ccm_batch(ctx, M, L, &f, 1, false);
+    return f.status;
+}
+
+int aes_ccm_decrypt(const AES_CTX *ctx, uint8_t M, uint8_t L, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+                    const uint8_t *in, uint8_t *out, size_t len, const uint8_t *tag)
+{
+    AES_CCM_FRAME f = {nonce, aad, aad_len, in, out, len, (uint8_t*)tag, 0};
+
+    ccm_batch(ctx, M, L, &f, 1, true);
+    return f.status;
+}
+
+#endif /* aes_ccm_h */
@@ -0,0 +1,188 @@
+#ifndef aes_cfb_h
+#define aes_cfb_h
+#include "aes_block.h"
+
+/*
+    Cipher Feedback (CFB-128 and CFB-8) streaming encoders, SP 800-38A 6.3.
+
+    The input to every cipher call is previous ciphertext, so encryption is
+    serial but decryption is not: once the ciphertext is in hand, the cipher
+    inputs of the next AES_LANES segments are all known and go through the
+    batched kernel together. That holds for CFB-8 as well, where a pass
+    decrypts AES_LANES bytes.
+
+    CFB-8 keeps its 128-bit shift register as a window into a longer
+    buffer: a byte is shifted in by appending it and moving the window
+    start, and the window is copied back to the front only once every 16
+    bytes.
+*/
+
+typedef struct aes_cfb
+{
+    const AES_CTX *key; //shared expanded key
+    uint8_t reg[16];    //keystream block being consumed, overwritten with its ciphertext
+    uint8_t num;        //bytes of reg consumed, 16 when the next block is due
+}AES_CFB;
+
+typedef struct aes_cfb8
+{
+    const AES_CTX *key;
+    uint8_t sr[16 + 16 + AES_LANES]; //shift register is sr[pos..pos+15]
+    uint8_t pos;
+}AES_CFB8;
+
+/*-------------------------------------------------------------------------
+                            CFB-128 INIT
+-------------------------------------------------------------------------*/
+void aes_cfb_init(AES_CFB *s, const AES_CTX *key, const uint8_t *iv)
+{
+    s->key = key;
+    memcpy(s->reg, iv, AES_BLOCK);
+    s->num = AES_BLOCK;
+}
+
+/*-------------------------------------------------------------------------
+                        CFB-128 ENCRYPTION
+ pre: any len, calls may split a message at any byte.
+-------------------------------------------------------------------------*/
+void aes_cfb_encrypt(AES_CFB *s, const uint8_t *in, uint8_t *out, size_t len)
+{
+    //finish a partly used keystream block
+    while(len > 0 && s->num < AES_BLOCK)
+    {
+        s->reg[s->num] ^= *in++;
+        *out++ = s->reg[s->num++];
+        len--;
+    }
+    //whole segments, reg ends as the last ciphertext block
+    while(len >= AES_BLOCK)
+    {
+        aes_encrypt_block(s->key, s->reg, s->reg);
+        xor_block(s->reg, s->reg, in);
+        memcpy(out, s->reg, AES_BLOCK);
+        in += AES_BLOCK;
+        out += AES_BLOCK;
+        len -= AES_BLOCK;
+    }
+    if(len > 0)
+    {
+        aes_encrypt_block(s->key, s->reg, s->reg);
+        for(s->num = 0; s->num < len; s->num++)
+        {
+            s->reg[s->num] ^= in[s->num];
+            out[s->num] = s->reg[s->num];
+        }
+    }
+}
+
+/*-------------------------------------------------------------------------
+                        CFB-128 DECRYPTION
+ Whole segments go AES_LANES at a time: the cipher inputs are reg followed
+ by the ciphertext blocks of the pass except the last.
+-------------------------------------------------------------------------*/
+void aes_cfb_decrypt(AES_CFB *s, const uint8_t *in, uint8_t *out, size_t len)
+{
+    uint8_t buf[AES_LANES*AES_BLOCK], ct[AES_LANES*AES_BLOCK], c;
+    size_t lanes;
+
+    while(len > 0 && s->num < AES_BLOCK)
+    {
+        c = *in++;
+        *out++ = s->reg[s->num] ^ c;
+        s->reg[s->num++] = c;
+        len--;
+    }
+    while(len >= AES_BLOCK)
+    {
+        lanes = len / AES_BLOCK;
+        lanes = lanes < AES_LANES? lanes : AES_LANES;
+        memcpy(ct, in, lanes*AES_BLOCK);
+        memcpy(buf, s->reg, AES_BLOCK);
+        memcpy(buf + AES_BLOCK, ct, (lanes-1)*AES_BLOCK);
+        aes_encrypt_lanes(s->key, buf, buf, lanes);
+        for(size_t i = 0; i < lanes*AES_BLOCK; i++)
+            out[i] = buf[i] ^ ct[i];
+        memcpy(s->reg, ct + (lanes-1)*AES_BLOCK, AES_BLOCK);
+        in += lanes*AES_BLOCK;
+        out += lanes*AES_BLOCK;
+        len -= lanes*AES_BLOCK;
+    }
+    if(len > 0)
+    {
+        aes_encrypt_block(s->key, s->reg, s->reg);
+        for(s->num = 0; s->num < len; s->num++)
+        {
+            c = in[s->num];
+            out[s->num] = s->reg[s->num] ^ c;
+            s->reg[s->num] = c;
+        }
+    }
+}
+
+/*-------------------------------------------------------------------------
+                            CFB-8 INIT
+-------------------------------------------------------------------------*/
+void aes_cfb8_init(AES_CFB8 *s, const AES_CTX *key, const uint8_t *iv)
+{
+    s->key = key;
+    memcpy(s->sr, iv, AES_BLOCK);
+    s->pos = 0;
+}
+
+/*-------------------------------------------------------------------------
+            Shift k ciphertext bytes already appended into the register
+-------------------------------------------------------------------------*/
+static inline void cfb8_shift(AES_CFB8 *s, uint8_t k)
+{
+    s->pos += k;
+    if(s->pos >= AES_BLOCK)
+    {
+        memmove(s->sr, s->sr + s->pos, AES_BLOCK);
+        s->pos = 0;
+    }
+}
+
+/*-------------------------------------------------------------------------
+                        CFB-8 ENCRYPTION
+ one cipher call per byte on the register window, no per-byte shifting.
+-------------------------------------------------------------------------*/
+void aes_cfb8_encrypt(AES_CFB8 *s, const uint8_t *in, uint8_t *out, size_t len)
+{
+    uint8_t blk[AES_BLOCK];
+
+    for(size_t i = 0; i < len; i++)
+    {
+        aes_encrypt_block(s->key, s->sr + s->pos, blk);
+        out[i] = in[i] ^ blk[0];
+        s->sr[s->pos + AES_BLOCK] = out[i];
+        cfb8_shift(s, 1);
+    }
+}
+
+/*-------------------------------------------------------------------------
+                        CFB-8 DECRYPTION
+ The next AES_LANES ciphertext bytes are appended first, then the register
+ of each of them is one window further along, all in one pass.
+-------------------------------------------------------------------------*/
+void aes_cfb8_decrypt(AES_CFB8 *s, const uint8_t *in, uint8_t *out, size_t len)
+{
+    uint8_t buf[AES_LANES*AES_BLOCK];
+    uint8_t lanes;
+
+    while(len > 0)
+    {
+        lanes = len < AES_LANES? (uint8_t)len : AES_LANES;
+        memcpy(s->sr + s->pos + AES_BLOCK, in, lanes);
+        for(uint8_t l = 0; l < lanes; l++)
+            memcpy(buf + AES_BLOCK*l, s->sr + s->pos + l, AES_BLOCK);
+        aes_encrypt_lanes(s->key, buf, buf, lanes);
+        for(uint8_t l = 0; l < lanes; l++)
+            out[l] = in[l] ^ buf[AES_BLOCK*l];
+        cfb8_shift(s, lanes);
+        in += lanes;
+        out += lanes;
+        len -= lanes;
+    }
+}
+
+#endif /* aes_cfb_h */
@@ -0,0 +1,330 @@
+#ifndef aes_chunked_h
+#define aes_chunked_h
+#include <errno.h>
+#include <sys/stat.h>
+#include "aes_block.h"
+#include "aes_ocb.h"
+#include "aes_drbg.h"
+#include "aes_thread.h"
+
+/*
+    Seekable encrypted container: the data is cut into fixed-size chunks
+    sealed one by one with OCB, and a trailing index holds the nonce and
+    tag of every chunk. Any byte range can be read by touching only its
+    chunks and their index entries.
+
+        header  32 bytes   "AESCHNK1", chunk size (LE32)
+        data    len bytes  chunk i at 32 + i*chunk, same length as its plaintext
+        index   32 bytes per chunk: 12-byte nonce, 4 zero, 16-byte tag
+        footer  32 bytes   "AESCIDX1", len (LE64), chunk count (LE64)
+
+    Each chunk has its own random nonce and authenticates the header, its
+    chunk number and a final-chunk flag. So chunks cannot be moved or
+    swapped, and a container cut short fails on its new last chunk. There
+    is always at least one chunk, possibly empty.
+
+    Writing is streamed: appended data fills a batch of CHUNKED_BATCH
+    chunks, which are sealed in parallel and written with one pwrite. The
+    index stays in memory until finish. A read goes through the same
+    batches: one pread for their index entries, one for their data, then
+    the chunks are opened in parallel.
+*/
+
+#define CHUNKED_HDR 32
+#define CHUNKED_ENTRY 32
+#define CHUNKED_BATCH 64      //chunks per parallel step
+#define CHUNKED_MAGIC "AESCHNK1"
+#define CHUNKED_FOOT "AESCIDX1"
+
+typedef struct aes_chunked
+{
+    const AES_OCB_CTX *key;   //16-byte tags
+    int fd;
+    unsigned threads;         //0 uses every online core
+    uint8_t hdr[CHUNKED_HDR];
+    size_t chunk;
+    uint64_t len, nchunks;
+    uint8_t *buf;             //one batch of chunks
+    size_t fill;              //writer: bytes in buf
+    uint64_t done;            //writer: chunks written
+    uint8_t *index;           //writer: entries of every chunk so far
+    size_t index_cap;
+}AES_CHUNKED;
+
+typedef struct chunked_job
+{
+    const AES_CHUNKED *c;
+    uint8_t *buf, *index;     //batch data and index entries
+    uint64_t first;           //chunk number of buf[0]
+    size_t count, last_len;   //chunks in the batch, bytes in the last one
+    uint64_t final;           //chunk number of the final chunk
+    bool decrypt;
+    int failed;
+}CHUNKED_JOB;
+
+static void chunked_seal(void *arg, size_t lo, size_t hi)
+{
+    CHUNKED_JOB *j = (CHUNKED_JOB*)arg;
+    const AES_CHUNKED *c = j->c;
+    uint8_t ad[CHUNKED_HDR + 9], *e, *d;
+    uint64_t n;
+    size_t len;
+    int rc;
+
+    memcpy(ad, c->hdr, CHUNKED_HDR);
+    for(size_t i = lo; i < hi; i++)
+    {
+        n = j->first + i;
+        store64_le(ad + CHUNKED_HDR, n);
+        ad[CHUNKED_HDR + 8] = n == j->final;
+        len = i + 1 == j->count? j->last_len : c->chunk;
+        e = j->index + CHUNKED_ENTRY*i;
+        d = j->buf + c->chunk*i;
+        if(j->decrypt)
+            rc = aes_ocb_decrypt(c->key, e, 12, ad, sizeof(ad), d, d, len, e + 16);
+        else
+            rc = aes_ocb_encrypt(c->key, e, 12, ad, sizeof(ad), d, d, len, e + 16);
+        if(rc != 0)
+            __atomic_store_n(&j->failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static int chunked_pio(int fd, uint8_t *buf, size_t len, uint64_t off, bool write)
+{
+    ssize_t n;
+
+    while(len > 0)
+    {
+        n = write? pwrite(fd, buf, len, (off_t)off) : pread(fd, buf, len, (off_t)off);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        buf += n;
+        len -= (size_t)n;
+        off += (uint64_t)n;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                    Seal and write the chunks in buf
+-------------------------------------------------------------------------*/
+static int chunked_flush(AES_CHUNKED *c, bool final)
+{
+    size_t count = c->fill == 0? (final && c->done == 0) : (c->fill + c->chunk - 1) / c->chunk;
+    CHUNKED_JOB j = {c, c->buf, NULL, c->done, count, 0, UINT64_MAX, false, 0};
+    uint8_t *grow;
+    size_t need = (size_t)(c->done + count) * CHUNKED_ENTRY;
+
+    if(count == 0)
+        return 0;
+    if(need > c->index_cap)
+    {
+        grow = realloc(c->index, need * 2);
+        if(grow == NULL)
+            return -1;
+        c->index = grow;
+        c->index_cap = need * 2;
+    }
+    j.index = c->index + c->done * CHUNKED_ENTRY;
+    j.last_len = c->fill - (count - 1) * c->chunk;
+    if(final)
+        j.final = c->done + count - 1;
+    for(size_t i = 0; i < count; i++)
+    {
+        memset(j.index + CHUNKED_ENTRY*i, 0, CHUNKED_ENTRY);
+        if(aes_random(j.index + CHUNKED_ENTRY*i, 12) != 0)
+            return -1;
+    }
+    aes_parallel_for(count, c->threads, chunked_seal, &j);
+    if(chunked_pio(c->fd, c->buf, c->fill, CHUNKED_HDR + c->done * c->chunk, true) != 0)
+        return -1;
+    c->done += count;
+    c->len += c->fill;
+    c->fill = 0;
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                            CREATE A CONTAINER
+ pre: fd open for writing, key with 16-byte tags, chunk a multiple of 16.
+ post: returns 0, or -1 on bad parameters, memory or I/O error.
+-------------------------------------------------------------------------*/
+int aes_chunked_create(AES_CHUNKED *c, const AES_OCB_CTX *key, int fd, size_t chunk, unsigned threads)
+{
+    memset(c, 0, sizeof(AES_CHUNKED));
+    if(key->taglen != 16 || chunk == 0 || chunk % AES_BLOCK || chunk > 0xffffffffu)
+        return -1;
+    c->key = key;
+    c->fd = fd;
+    c->threads = threads;
+    c->chunk = chunk;
+    memcpy(c->hdr, CHUNKED_MAGIC, 8);
+    for(int b = 0; b < 4; b++)
+        c->hdr[8 + b] = (uint8_t)(chunk >> 8*b);
+    c->buf = malloc(chunk * CHUNKED_BATCH);
+    if(c->buf == NULL)
+        return -1;
+    if(ftruncate(fd, 0) != 0 || chunked_pio(fd, c->hdr, CHUNKED_HDR, 0, true) != 0)
+    {
+        free(c->buf);
+        c->buf = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                            APPEND DATA
+ post: returns 0, or -1 on memory or I/O error. A full batch is held back
+       until more data comes, as its last chunk may be the final one.
+-------------------------------------------------------------------------*/
+int aes_chunked_append(AES_CHUNKED *c, const uint8_t *in, size_t len)
+{
+    size_t cap = c->chunk * CHUNKED_BATCH, take;
+
+    while(len > 0)
+    {
+        if(c->fill == cap && chunked_flush(c, false) != 0)
+            return -1;
+        take = cap - c->fill < len? cap - c->fill : len;
+        memcpy(c->buf + c->fill, in, take);
+        c->fill += take;
+        in += take;
+        len -= take;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                        FINISH: last chunks, index, footer
+ post: returns 0, or -1 on memory or I/O error. The writer's buffers are
+       freed either way.
+-------------------------------------------------------------------------*/
+int aes_chunked_finish(AES_CHUNKED *c)
+{
+    uint8_t foot[CHUNKED_HDR];
+    int rc = -1;
+
+    if(chunked_flush(c, true) != 0)
+        goto done;
+    c->nchunks = c->done;
+    memset(foot, 0, CHUNKED_HDR);
+    memcpy(foot, CHUNKED_FOOT, 8);
+    store64_le(foot + 8, c->len);
+    store64_le(foot + 16, c->nchunks);
+    if(chunked_pio(c->fd, c->index, (size_t)c->nchunks * CHUNKED_ENTRY, CHUNKED_HDR + c->len, true) != 0)
+        goto done;
+    if(chunked_pio(c->fd, foot, CHUNKED_HDR, CHUNKED_HDR + c->len + c->nchunks * CHUNKED_ENTRY, true) != 0)
+        goto done;
+    rc = 0;
+
+done:
+    memset(c->buf, 0, c->chunk * CHUNKED_BATCH);
+    free(c->buf);
+    free(c->index);
+    c->buf = c->index = NULL;
+    return rc;
+}
+
+/*-------------------------------------------------------------------------
+                            OPEN A CONTAINER
+ post: returns 0, or -1 if the header or footer is not valid or does not
+       match the file size.
+-------------------------------------------------------------------------*/
+int aes_chunked_open(AES_CHUNKED *c, const AES_OCB_CTX *key, int fd, unsigned threads)
+{
+    uint8_t foot[CHUNKED_HDR];
+    struct stat st;
+    uint64_t full;
+
+    memset(c, 0, sizeof(AES_CHUNKED));
+    if(key->taglen != 16 || fstat(fd, &st) != 0 || st.st_size < 2*CHUNKED_HDR + CHUNKED_ENTRY)
+        return -1;
+    if(chunked_pio(fd, c->hdr, CHUNKED_HDR, 0, false) != 0 ||
+       chunked_pio(fd, foot, CHUNKED_HDR, (uint64_t)st.st_size - CHUNKED_HDR, false) != 0)
+        return -1;
+    if(memcmp(c->hdr, CHUNKED_MAGIC, 8) != 0 || memcmp(foot, CHUNKED_FOOT, 8) != 0)
+        return -1;
+    c->chunk = (size_t)c->hdr[8] | (size_t)c->hdr[9] << 8 | (size_t)c->hdr[10] << 16 | (size_t)c->hdr[11] << 24;
+    c->len = load64_le(foot + 8);
+    c->nchunks = load64_le(foot + 16);
+    if(c->chunk == 0 || c->chunk % AES_BLOCK)
+        return -1;
+    full = c->len / c->chunk + (c->len % c->chunk != 0);
+    if(c->nchunks != (full? full : 1) || c->len > (uint64_t)st.st_size ||
+       (uint64_t)st.st_size != 2*CHUNKED_HDR + c->len + c->nchunks * CHUNKED_ENTRY)
+        return -1;
+    c->buf = malloc(c->chunk * CHUNKED_BATCH);
+    c->index = malloc(CHUNKED_ENTRY * CHUNKED_BATCH);
+    if(c->buf == NULL || c->index == NULL)
+    {
+        free(c->buf);
+        free(c->index);
+        return -1;
+    }
+    c->key = key;
+    c->fd = fd;
+    c->threads = threads;
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                            READ A BYTE RANGE
+ pre: off + len within the plaintext length.
+ post: returns 0, or -1 on a bad range, an I/O error or a chunk that fails
+       authentication, in which case out is wiped.
+-------------------------------------------------------------------------*/
+int aes_chunked_read(AES_CHUNKED *c, uint64_t off, uint8_t *out, size_t len)
+{
+    CHUNKED_JOB j = {c, c->buf, c->index, 0, 0, 0, c->nchunks - 1, true, 0};
+    uint64_t first, last, start, end;
+    size_t pos = 0, skip, take;
+
+    if(off > c->len || len > c->len - off)
+        return -1;
+    if(len == 0)
+        return 0;
+    first = off / c->chunk;
+    last = (off + len - 1) / c->chunk;
+    while(first <= last)
+    {
+        j.first = first;
+        j.count = last - first + 1 < CHUNKED_BATCH? (size_t)(last - first + 1) : CHUNKED_BATCH;
+        start = first * c->chunk;
+        end = (first + j.count) * c->chunk < c->len? (first + j.count) * c->chunk : c->len;
+        j.last_len = (size_t)(end - start) - (j.count - 1) * c->chunk;
+        if(chunked_pio(c->fd, c->index, j.count * CHUNKED_ENTRY, CHUNKED_HDR + c->len + first * CHUNKED_ENTRY, false) != 0 ||
+           chunked_pio(c->fd, c->buf, (size_t)(end - start), CHUNKED_HDR + start, false) != 0)
+            j.failed = 1;
+        else
+            aes_parallel_for(j.count, c->threads, chunked_seal, &j);
+        if(j.failed)
+        {
+            memset(out, 0, len);
+            memset(c->buf, 0, c->chunk * CHUNKED_BATCH);
+            return -1;
+        }
+        skip = off > start? (size_t)(off - start) : 0;
+        take = (size_t)(end - start) - skip < len - pos? (size_t)(end - start) - skip : len - pos;
+        memcpy(out + pos, c->buf + skip, take);
+        pos += take;
+        first += j.count;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                            CLOSE A READER
+-------------------------------------------------------------------------*/
+void aes_chunked_close(AES_CHUNKED *c)
+{
+    if(c->buf)
+        memset(c->buf, 0, c->chunk * CHUNKED_BATCH);
+    free(c->buf);
+    free(c->index);
+    c->buf = c->index = NULL;
+}
+
+#endif /* aes_chunked_h */
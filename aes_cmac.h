@@ -0,0 +1,205 @@
+#ifndef aes_cmac_h
+#define aes_cmac_h
+#include "aes_block.h"
+
+/*
+    CMAC (SP 800-38B / RFC 4493) over an expanded key.
+
+    The subkeys K1 and K2 are derived once per key in aes_cmac_setkey, so
+    a MAC costs one cipher call per block and nothing else. The incremental
+    context holds back the last block of input until final, which needs to
+    know whether that block is complete.
+
+    A single CBC-MAC chain is serial, so the batch call runs the chains of up
+    to AES_LANES independent messages side by side, one block of each per
+    kernel pass, and refills a lane as soon as its message is done. This is
+    what keeps many short control messages off the single-block path.
+*/
+
+typedef struct aes_cmac_key
+{
+    AES_CTX aes;
+    uint8_t k1[16], k2[16]; //subkeys for a complete and a padded last block
+}AES_CMAC_KEY;
+
+typedef struct aes_cmac
+{
+    const AES_CMAC_KEY *key;
+    uint8_t x[16];   //CBC-MAC chaining value
+    uint8_t buf[16]; //pending input, up to one whole block
+    uint8_t n;       //bytes in buf
+}AES_CMAC;
+
+typedef struct aes_cmac_msg
+{
+    const uint8_t *data;
+    size_t len;
+    uint8_t *mac; //16 bytes
+}AES_CMAC_MSG;
+
+typedef struct cmac_lane
+{
+    const AES_CMAC_MSG *msg;
+    uint8_t x[16];
+    size_t i, nblk; //next block, blocks including the padded last one
+}CMAC_LANE;
+
+/*-------------------------------------------------------------------------
+        Doubling in GF(2^128), big-endian (x * b mod x^128+x^7+x^2+x+1)
+-------------------------------------------------------------------------*/
+static inline void cmac_dbl(uint8_t *d, const uint8_t *b)
+{
+    uint8_t carry = b[0] >> 7;
+
+    for(uint8_t i = 0; i < 15; i++)
+        d[i] = (uint8_t)((b[i] << 1) | (b[i+1] >> 7));
+    d[15] = (uint8_t)((b[15] << 1) ^ (0x87 & (0 - carry)));
+}
+
+/*-------------------------------------------------------------------------
+                        CMAC Key Setup
+ post: L = E(0), K1 = dbl(L), K2 = dbl(K1).
+-------------------------------------------------------------------------*/
+void aes_cmac_setkey(AES_CMAC_KEY *key, const uint8_t *k, uint8_t type)
+{
+    uint8_t L[AES_BLOCK];
+
+    aes_setkey_enc(&key->aes, k, type);
+    memset(L, 0, AES_BLOCK);
+    aes_encrypt_block(&key->aes, L, L);
+    cmac_dbl(key->k1, L);
+    cmac_dbl(key->k2, key->k1);
+    memset(L, 0, AES_BLOCK);
+}
+
+/*-------------------------------------------------------------------------
+                        CMAC Init / Update / Final
+-------------------------------------------------------------------------*/
+void aes_cmac_init(AES_CMAC *c, const AES_CMAC_KEY *key)
+{
+    c->key = key;
+    memset(c->x, 0, AES_BLOCK);
+    c->n = 0;
+}
+
+void aes_cmac_update(AES_CMAC *c, const uint8_t *data, size_t len)
+{
+    size_t take;
+
+    if(len == 0)
+        return;
+    //top up the pending block, it is only processed once more input follows
+    if(c->n < AES_BLOCK)
+    {
+        take = (size_t)AES_BLOCK - c->n < len? (size_t)AES_BLOCK - c->n : len;
+        memcpy(c->buf + c->n, data, take);
+        c->n += take;
+        data += take;
+        len -= take;
+        if(len == 0)
+            return;
+    }
+    xor_block(c->x, c->x, c->buf);
+    aes_encrypt_block(&c->key->aes, c->x, c->x);
+
+    //whole blocks straight from the input, the last one is held back
+    while(len > AES_BLOCK)
+    {
+        xor_block(c->x, c->x, data);
+        aes_encrypt_block(&c->key->aes, c->x, c->x);
+        data += AES_BLOCK;
+        len -= AES_BLOCK;
+    }
+    memcpy(c->buf, data, len);
+    c->n = (uint8_t)len;
+}
+
+void aes_cmac_final(AES_CMAC *c, uint8_t *mac)
+{
+    if(c->n == AES_BLOCK)
+        xor_block(c->buf, c->buf, c->key->k1);
+    else
+    {
+        c->buf[c->n] = 0x80;
+        memset(c->buf + c->n + 1, 0, AES_BLOCK - c->n - 1);
+        xor_block(c->buf, c->buf, c->key->k2);
+    }
+    xor_block(c->x, c->x, c->buf);
+    aes_encrypt_block(&c->key->aes, c->x, mac);
+    memset(c, 0, sizeof(AES_CMAC));
+}
+
+/*-------------------------------------------------------------------------
+                            CMAC ONE SHOT
+-------------------------------------------------------------------------*/
+void aes_cmac(const AES_CMAC_KEY *key, const uint8_t *data, size_t len, uint8_t *mac)
+{
+    AES_CMAC c;
+
+    aes_cmac_init(&c, key);
+    aes_cmac_update(&c, data, len);
+    aes_cmac_final(&c, mac);
+}
+
+/*-------------------------------------------------------------------------
+                            CMAC BATCH
+ post: msgs[i].mac holds the CMAC of msgs[i].data.
+-------------------------------------------------------------------------*/
+void aes_cmac_batch(const AES_CMAC_KEY *key, const AES_CMAC_MSG *msgs, size_t n)
+{
+    uint8_t buf[AES_LANES*AES_BLOCK], last[AES_BLOCK];
+    CMAC_LANE lane[AES_LANES];
+    size_t next = 0, active = 0, r;
+    uint8_t *blk;
+
+    for(;;)
+    {
+        while(active < AES_LANES && next < n)
+        {
+            lane[active].msg = &msgs[next++];
+            memset(lane[active].x, 0, AES_BLOCK);
+            lane[active].i = 0;
+            lane[active].nblk = lane[active].msg->len == 0? 1 : (lane[active].msg->len + AES_BLOCK - 1) / AES_BLOCK;
+            active++;
+        }
+        if(active == 0)
+            break;
+
+        for(size_t l = 0; l < active; l++)
+        {
+            blk = buf + AES_BLOCK*l;
+            if(lane[l].i + 1 < lane[l].nblk)
+                xor_block(blk, lane[l].x, lane[l].msg->data + AES_BLOCK*lane[l].i);
+            else
+            {
+                r = lane[l].msg->len - AES_BLOCK*lane[l].i;
+                if(r == AES_BLOCK)
+                    xor_block(last, lane[l].msg->data + AES_BLOCK*lane[l].i, key->k1);
+                else
+                {
+                    memset(last, 0, AES_BLOCK);
+                    memcpy(last, lane[l].msg->data + AES_BLOCK*lane[l].i, r);
+                    last[r] = 0x80;
+                    xor_block(last, last, key->k2);
+                }
+                xor_block(blk, lane[l].x, last);
+            }
+        }
+        aes_encrypt_lanes(&key->aes, buf, buf, active);
+
+        //retire finished messages, the last lane moves into the hole
+        for(size_t l = active; l-- > 0;)
+        {
+            if(++lane[l].i < lane[l].nblk)
+            {
+                memcpy(lane[l].x, buf + AES_BLOCK*l, AES_BLOCK);
+                continue;
+            }
+            memcpy(lane[l].msg->mac, buf + AES_BLOCK*l, AES_BLOCK);
+            active--;
+            lane[l] = lane[active];
+        }
+    }
+}
+
+#endif /* aes_cmac_h */
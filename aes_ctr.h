@@ -0,0 +1,96 @@
+#ifndef aes_ctr_h
+#define aes_ctr_h
+#include "aes_block.h"
+
+/*
+    Counter (CTR) mode, SP 800-38A 6.5, with the whole 128-bit counter block
+    incremented as a big-endian integer.
+
+    The counter blocks of a pass are laid out AES_LANES at a time and go
+    through the batched kernel together, the keystream is XORed in a word at
+    a time.
+*/
+
+/*-------------------------------------------------------------------------
+                Increment a 128-bit big-endian counter block
+-------------------------------------------------------------------------*/
+static inline void ctr128_inc(uint8_t *ctr)
+{
+    for(int8_t i = 15; i >= 0; i--)
+        if(++ctr[i] != 0)
+            break;
+}
+
+/*-------------------------------------------------------------------------
+                Add n to a 128-bit big-endian counter block
+-------------------------------------------------------------------------*/
+static inline void ctr128_add(uint8_t *ctr, uint64_t n)
+{
+    uint32_t carry = 0;
+
+    for(int8_t i = 15; i >= 0; i--)
+    {
+        carry += ctr[i] + (uint8_t)n;
+        ctr[i] = (uint8_t)carry;
+        carry >>= 8;
+        n >>= 8;
+        if(n == 0 && carry == 0)
+            break;
+    }
+}
+
+/*-------------------------------------------------------------------------
+                        CTR KEYSTREAM
+ post: nblocks of keystream E(ctr), E(ctr+1), ... written to out, ctr left
+       at the next unused counter.
+-------------------------------------------------------------------------*/
+void aes_ctr_keystream(const AES_CTX *ctx, uint8_t *ctr, uint8_t *out, size_t nblocks)
+{
+    size_t lanes;
+
+    while(nblocks > 0)
+    {
+        lanes = nblocks < AES_LANES? nblocks : AES_LANES;
+        for(size_t l = 0; l < lanes; l++)
+        {
+            memcpy(out + AES_BLOCK*l, ctr, AES_BLOCK);
+            ctr128_inc(ctr);
+        }
+        aes_encrypt_lanes(ctx, out, out, lanes);
+        out += lanes*AES_BLOCK;
+        nblocks -= lanes;
+    }
+}
+
+/*-------------------------------------------------------------------------
+                    CTR ENCRYPTION / DECRYPTION
+ pre: any len, out may equal in.
+ post: ctr advanced by the number of blocks started, the keystream left over
+       from a partial last block is discarded.
+-------------------------------------------------------------------------*/
+void aes_ctr_xor(const AES_CTX *ctx, uint8_t *ctr, const uint8_t *in, uint8_t *out, size_t len)
+{
+    uint8_t ks[AES_LANES*AES_BLOCK];
+    uint64_t a, k;
+    size_t n;
+
+    while(len > 0)
+    {
+        n = len < sizeof(ks)? len : sizeof(ks);
+        aes_ctr_keystream(ctx, ctr, ks, (n + AES_BLOCK - 1) / AES_BLOCK);
+        for(size_t i = 0; i + 8 <= n; i += 8)
+        {
+            memcpy(&a, in + i, 8);
+            memcpy(&k, ks + i, 8);
+            a ^= k;
+            memcpy(out + i, &a, 8);
+        }
+        for(size_t i = n & ~(size_t)7; i < n; i++)
+            out[i] = in[i] ^ ks[i];
+        in += n;
+        out += n;
+        len -= n;
+    }
+}
+
+#endif /* aes_ctr_h */
@@ -0,0 +1,827 @@
+#ifndef aes_daemon_h
+#define aes_daemon_h
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/memfd.h>
+#include "aes_block.h"
+#include "aes_ctr.h"
+#include "aes_gcm_siv.h"
+#include "aes_thread.h"
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_GET_SEALS 1034
+#define F_SEAL_SHRINK 0x0002
+#endif
+
+/*
+    Local encryption daemon: one process holds the keys and serves CTR and
+    AES-GCM-SIV requests from many clients over a Unix socket. Clients
+    name a key by id and never see it.
+
+    The socket is SOCK_SEQPACKET, so every request and response is one
+    message:
+
+        request   64 bytes   "AESD", op, flags, 2 zero, key id (LE32),
+                             data length (LE32), AAD length (LE32), 4 zero,
+                             shared offset (LE64), counter block or
+                             12-byte nonce (16), tag for open (16)
+                  then the AAD, then the data unless it is shared
+        response  32 bytes   "AESD", status (LE32), data length (LE32),
+                             4 zero, tag from seal (16)
+                  then the data unless it is shared
+
+    Inline requests carry at most AESD_INLINE_MAX bytes. Larger payloads
+    go through a buffer the client shares once per connection: a sealed
+    memfd passed with SCM_RIGHTS. A request whose data lies in that buffer
+    carries only its offset, and the daemon works on it in place.
+
+    The daemon is one poll loop. Each round takes at most one request
+    from every ready client and then runs the whole round together. CTR
+    requests under one key have their counter blocks laid end to end in
+    one keystream buffer, and a single aes_encrypt_blocks call covers all
+    of them. GCM-SIV requests under one key go through the batch calls,
+    which derive the message keys of AES_LANES messages per kernel call.
+    So the more clients are busy, the wider the batches get.
+
+    Shared payloads of AESD_PAR_MIN bytes or more (up to 4 GiB) never run
+    on the loop: each gets a thread of its own, CTR spread over the cores,
+    and the loop answers when it finishes. Client sockets are non-blocking.
+    A response that does not fit the client's socket is parked, and the
+    client is not read again until it has taken it, so a client that stops
+    reading stalls only itself.
+*/
+
+#define AESD_MAGIC "AESD"
+#define AESD_HDR 64
+#define AESD_RESP 32
+#define AESD_INLINE_MAX (60*1024)    //AAD plus inline data
+#define AESD_MAX_CONN 256
+#define AESD_KS 2048                 //keystream blocks per coalesced call
+#define AESD_PAR_MIN (1024*1024)
+#define AESD_TILE (64*1024)
+
+typedef enum aesd_op
+{
+    AESD_OP_CTR = 1,
+    AESD_OP_SEAL,
+    AESD_OP_OPEN,
+    AESD_OP_SHARE                    //attach a shared buffer, no data
+}AESD_OP;
+
+#define AESD_SHARED 1                //request flag: data in the shared buffer
+
+typedef struct aesd_key
+{
+    uint32_t id;
+    bool siv;                        //GCM-SIV key-generating key, else CTR
+    uint8_t type;                    //0 (128), 1 (192, CTR only) or 2 (256)
+    AES_CTX ctx;
+}AESD_KEY;
+
+typedef struct aesd_conn
+{
+    int fd;
+    uint8_t *shm;                    //client's shared buffer
+    size_t shm_len;
+    uint8_t *buf;                    //one request message
+    uint8_t resp[AESD_RESP];         //response header being sent
+    const uint8_t *out;              //its inline data, in buf
+    size_t out_len;
+    bool parked;                     //response waits for POLLOUT
+    bool dead;                       //drop after this round
+    struct aesd_job *job;            //large shared request running
+}AESD_CONN;
+
+typedef struct aesd_req
+{
+    AESD_CONN *c;
+    const AESD_KEY *key;
+    uint8_t op;
+    uint8_t iv[16], tag[16];
+    uint8_t *aad, *data;
+    size_t aad_len, len;
+    bool shared;
+    int status;
+}AESD_REQ;
+
+typedef struct aesd_job
+{
+    AESD_REQ q;                      //q.c is stale, found again by job
+    unsigned threads;
+    int done;                        //write end of the completion pipe
+    pthread_t tid;
+}AESD_JOB;
+
+typedef struct aesd_seg
+{
+    uint8_t *data;
+    size_t len, ks;                  //bytes and keystream offset
+}AESD_SEG;
+
+typedef struct aes_daemon
+{
+    int lfd, stop[2], done[2];
+    const AESD_KEY *keys;
+    size_t nkeys;
+    unsigned threads;                //large shared CTR payloads, 0 all cores
+    AESD_CONN conns[AESD_MAX_CONN];
+    size_t nconns;
+    AESD_REQ reqs[AESD_MAX_CONN];
+    AESD_REQ *group[AESD_MAX_CONN];
+    AESD_SEG segs[AESD_MAX_CONN + 1];
+    AES_GCM_SIV_MSG msgs[AESD_MAX_CONN];
+    uint8_t ks[AESD_KS*AES_BLOCK];
+    uint64_t requests, batches;      //requests served, kernel passes
+}AES_DAEMON;
+
+static uint32_t aesd_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void aesd_put32(uint8_t *p, uint32_t v)
+{
+    for(int i = 0; i < 4; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+/*-------------------------------------------------------------------------
+                        START / STOP THE DAEMON
+ pre: keys stay valid while serving; path is a free socket path.
+ post: listening. serve runs until aes_daemon_stop (from another thread
+       or a signal handler), then closes every client. Returns 0, or -1
+       on a socket error.
+-------------------------------------------------------------------------*/
+int aes_daemon_listen(AES_DAEMON *s, const char *path, const AESD_KEY *keys, size_t nkeys, unsigned threads)
+{
+    struct sockaddr_un sa = {0};
+
+    memset(s, 0, sizeof(AES_DAEMON));
+    s->keys = keys;
+    s->nkeys = nkeys;
+    s->threads = threads;
+    if(strlen(path) >= sizeof(sa.sun_path))
+        return -1;
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+    s->lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(s->lfd < 0)
+        return -1;
+    if(bind(s->lfd, (struct sockaddr*)&sa, sizeof(sa)) != 0 || listen(s->lfd, 64) != 0 || pipe(s->stop) != 0)
+    {
+        close(s->lfd);
+        return -1;
+    }
+    if(pipe(s->done) != 0)
+    {
+        close(s->lfd);
+        close(s->stop[0]);
+        close(s->stop[1]);
+        return -1;
+    }
+    return 0;
+}
+
+void aes_daemon_stop(AES_DAEMON *s)
+{
+    if(write(s->stop[1], "", 1) != 1)
+        return;
+}
+
+static void aesd_drop(AES_DAEMON *s, size_t i)
+{
+    AESD_CONN *c = &s->conns[i];
+
+    close(c->fd);
+    if(c->shm)
+        munmap(c->shm, c->shm_len);
+    free(c->buf);
+    s->conns[i] = s->conns[--s->nconns];
+}
+
+static const AESD_KEY *aesd_key(const AES_DAEMON *s, uint32_t id)
+{
+    for(size_t i = 0; i < s->nkeys; i++)
+        if(s->keys[i].id == id)
+            return &s->keys[i];
+    return NULL;
+}
+
+/*-------------------------------------------------------------------------
+                        Attach a client's shared buffer
+ post: mapped if the memfd is sealed against shrinking, so the client
+       cannot truncate it under the daemon.
+-------------------------------------------------------------------------*/
+static int aesd_attach(AESD_CONN *c, int fd, uint64_t len)
+{
+    struct stat st;
+    int seals;
+    void *p;
+
+    if(fd < 0 || len == 0 || fstat(fd, &st) != 0 || (uint64_t)st.st_size < len)
+        return -1;
+    //F_GET_SEALS fails with -1 on anything but a memfd
+    seals = fcntl(fd, F_GET_SEALS);
+    if(seals < 0 || !(seals & F_SEAL_SHRINK))
+        return -1;
+    p = mmap(NULL, (size_t)len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED)
+        return -1;
+    if(c->shm)
+        munmap(c->shm, c->shm_len);
+    c->shm = p;
+    c->shm_len = (size_t)len;
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                        Send the pending response
+ post: 0 when sent or parked because the socket is full (c->parked), -1
+       when the client has gone. A SEQPACKET message goes whole or not at
+       all, so there is never a partial response to resume.
+-------------------------------------------------------------------------*/
+static int aesd_flush(AESD_CONN *c)
+{
+    struct iovec v[2] = {{c->resp, AESD_RESP}, {(void*)c->out, c->out_len}};
+    struct msghdr mh = {0};
+
+    mh.msg_iov = v;
+    mh.msg_iovlen = 2;
+    for(;;)
+    {
+        if(sendmsg(c->fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0)
+        {
+            c->parked = false;
+            return 0;
+        }
+        if(errno == EINTR)
+            continue;
+        if(errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+        c->parked = true;
+        return 0;
+    }
+}
+
+/*-------------------------------------------------------------------------
+                        Read one request
+ post: 1 and *q filled for a crypto request; 0 for a share request or a
+       malformed one (already answered) or when nothing was waiting after
+       all; -1 when the client has gone.
+-------------------------------------------------------------------------*/
+static int aesd_recv(AES_DAEMON *s, AESD_CONN *c, AESD_REQ *q)
+{
+    union { uint8_t buf[CMSG_SPACE(sizeof(int))]; struct cmsghdr align; } ctl;
+    struct iovec v = {c->buf, AESD_HDR + AESD_INLINE_MAX};
+    struct msghdr mh = {0};
+    struct cmsghdr *cm;
+    uint64_t off;
+    ssize_t n;
+    int fd = -1;
+
+    mh.msg_iov = &v;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = sizeof(ctl.buf);
+    n = recvmsg(c->fd, &mh, MSG_DONTWAIT);
+    if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+    if(n <= 0)
+        return -1;
+    for(cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm))
+        if(cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+            memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+
+    memset(q, 0, sizeof(AESD_REQ));
+    q->c = c;
+    q->status = -1;
+    q->op = c->buf[4];
+    q->shared = c->buf[5] & AESD_SHARED;
+    q->key = aesd_key(s, aesd_le32(c->buf + 8));
+    q->len = aesd_le32(c->buf + 12);
+    q->aad_len = aesd_le32(c->buf + 16);
+    off = load64_le(c->buf + 24);
+    memcpy(q->iv, c->buf + 32, 16);
+    memcpy(q->tag, c->buf + 48, 16);
+    q->aad = c->buf + AESD_HDR;
+
+    if(n < AESD_HDR || memcmp(c->buf, AESD_MAGIC, 4) != 0 || (mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+        q->op = 0;
+    else if(q->op == AESD_OP_SHARE)
+    {
+        q->status = aesd_attach(c, fd, off);
+        q->op = 0;
+    }
+    else if(!q->key || q->op < AESD_OP_CTR || q->op > AESD_OP_OPEN || q->key->siv != (q->op != AESD_OP_CTR))
+        q->op = 0;
+    else if(q->op == AESD_OP_CTR && q->aad_len)
+        q->op = 0;
+    else if(q->shared)
+    {
+        if(!c->shm || off > c->shm_len || q->len > c->shm_len - off || (size_t)n != AESD_HDR + q->aad_len)
+            q->op = 0;
+        else
+            q->data = c->shm + off;
+    }
+    else if((size_t)n != AESD_HDR + q->aad_len + q->len)
+        q->op = 0;
+    else
+        q->data = q->aad + q->aad_len;
+    if(fd >= 0)
+        close(fd);
+    if(q->op != 0)
+        return 1;
+
+    memset(c->resp, 0, AESD_RESP);
+    memcpy(c->resp, AESD_MAGIC, 4);
+    aesd_put32(c->resp + 4, (uint32_t)q->status);
+    c->out = NULL;
+    c->out_len = 0;
+    return aesd_flush(c);
+}
+
+/*-------------------------------------------------------------------------
+                        Coalesced CTR over one key
+ post: the keystream of every request is generated in shared passes of up
+       to AESD_KS blocks, one aes_encrypt_blocks call each.
+-------------------------------------------------------------------------*/
+typedef struct aesd_tile_job
+{
+    const AES_CTX *key;
+    const uint8_t *iv;
+    uint8_t *data;
+    size_t len;
+}AESD_TILE_JOB;
+
+static void aesd_ctr_tiles(void *arg, size_t lo, size_t hi)
+{
+    AESD_TILE_JOB *j = (AESD_TILE_JOB*)arg;
+    uint8_t ctr[AES_BLOCK];
+    size_t off, n;
+
+    for(size_t t = lo; t < hi; t++)
+    {
+        off = t * AESD_TILE;
+        n = j->len - off < AESD_TILE? j->len - off : AESD_TILE;
+        memcpy(ctr, j->iv, AES_BLOCK);
+        ctr128_add(ctr, off / AES_BLOCK);
+        aes_ctr_xor(j->key, ctr, j->data + off, j->data + off, n);
+    }
+}
+
+static void aesd_ctr_flush(AES_DAEMON *s, const AES_CTX *key, size_t blocks, size_t nseg)
+{
+    aes_encrypt_blocks(key, s->ks, s->ks, blocks);
+    for(size_t i = 0; i < nseg; i++)
+        for(size_t b = 0; b < s->segs[i].len; b++)
+            s->segs[i].data[b] ^= s->ks[s->segs[i].ks + b];
+    s->batches++;
+}
+
+static void aesd_ctr_batch(AES_DAEMON *s, AESD_REQ **q, size_t n)
+{
+    const AES_CTX *key = &q[0]->key->ctx;
+    uint8_t ctr[AES_BLOCK];
+    size_t fill = 0, nseg = 0, done, blocks, bytes;
+    AESD_TILE_JOB j;
+
+    for(size_t i = 0; i < n; i++)
+    {
+        q[i]->status = 0;
+        if(q[i]->len >= AESD_PAR_MIN)
+        {
+            j = (AESD_TILE_JOB){key, q[i]->iv, q[i]->data, q[i]->len};
+            aes_parallel_for((q[i]->len + AESD_TILE - 1) / AESD_TILE, s->threads, aesd_ctr_tiles, &j);
+            s->batches++;
+            continue;
+        }
+        memcpy(ctr, q[i]->iv, AES_BLOCK);
+        for(done = 0; done < q[i]->len; done += bytes)
+        {
+            blocks = (q[i]->len - done + AES_BLOCK - 1) / AES_BLOCK;
+            if(blocks > AESD_KS - fill)
+                blocks = AESD_KS - fill;
+            bytes = q[i]->len - done < blocks * AES_BLOCK? q[i]->len - done : blocks * AES_BLOCK;
+            for(size_t b = 0; b < blocks; b++)
+            {
+                memcpy(s->ks + AES_BLOCK * (fill + b), ctr, AES_BLOCK);
+                ctr128_inc(ctr);
+            }
+            s->segs[nseg++] = (AESD_SEG){q[i]->data + done, bytes, fill * AES_BLOCK};
+            fill += blocks;
+            if(fill == AESD_KS)
+            {
+                aesd_ctr_flush(s, key, fill, nseg);
+                fill = nseg = 0;
+            }
+        }
+    }
+    if(fill > 0)
+        aesd_ctr_flush(s, key, fill, nseg);
+}
+
+static void aesd_siv_batch(AES_DAEMON *s, AESD_REQ **q, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+        s->msgs[i] = (AES_GCM_SIV_MSG){q[i]->iv, q[i]->aad, q[i]->aad_len, q[i]->data, q[i]->data, q[i]->len, q[i]->tag, 0};
+    if(q[0]->op == AESD_OP_SEAL)
+        aes_gcm_siv_seal_batch(&q[0]->key->ctx, q[0]->key->type, s->msgs, n);
+    else
+        aes_gcm_siv_open_batch(&q[0]->key->ctx, q[0]->key->type, s->msgs, n);
+    for(size_t i = 0; i < n; i++)
+        q[i]->status = s->msgs[i].status;
+    s->batches++;
+}
+
+//a client that has gone is dropped after the round, which keeps indexes
+static void aesd_reply(AESD_REQ *q)
+{
+    AESD_CONN *c = q->c;
+
+    memset(c->resp, 0, AESD_RESP);
+    memcpy(c->resp, AESD_MAGIC, 4);
+    aesd_put32(c->resp + 4, (uint32_t)q->status);
+    aesd_put32(c->resp + 8, (uint32_t)q->len);
+    if(q->op == AESD_OP_SEAL)
+        memcpy(c->resp + 16, q->tag, 16);
+    c->out = q->data;
+    c->out_len = !q->shared && q->status == 0? q->len : 0;
+    if(aesd_flush(c) != 0)
+        c->dead = true;
+}
+
+/*-------------------------------------------------------------------------
+                        Large shared requests
+ post: the request runs on a thread of its own and its job pointer goes
+       down s->done when finished. The client is not polled meanwhile, so
+       its buffer and shared mapping stay put. Returns 0, or -1 if no
+       thread could be started (the caller then runs it in the round).
+-------------------------------------------------------------------------*/
+static void *aesd_job_run(void *arg)
+{
+    AESD_JOB *j = (AESD_JOB*)arg;
+    AESD_REQ *q = &j->q;
+    AESD_TILE_JOB t;
+    AES_GCM_SIV_MSG m;
+
+    if(q->op == AESD_OP_CTR)
+    {
+        t = (AESD_TILE_JOB){&q->key->ctx, q->iv, q->data, q->len};
+        aes_parallel_for((q->len + AESD_TILE - 1) / AESD_TILE, j->threads, aesd_ctr_tiles, &t);
+        q->status = 0;
+    }
+    else
+    {
+        m = (AES_GCM_SIV_MSG){q->iv, q->aad, q->aad_len, q->data, q->data, q->len, q->tag, 0};
+        if(q->op == AESD_OP_SEAL)
+            aes_gcm_siv_seal_batch(&q->key->ctx, q->key->type, &m, 1);
+        else
+            aes_gcm_siv_open_batch(&q->key->ctx, q->key->type, &m, 1);
+        q->status = m.status;
+    }
+    //pointer-sized writes to a pipe are atomic and there are at most
+    //AESD_MAX_CONN of them in flight, well under the pipe's capacity
+    if(write(j->done, &j, sizeof(j)) != sizeof(j))
+        return NULL;
+    return NULL;
+}
+
+static int aesd_start(AES_DAEMON *s, AESD_REQ *q)
+{
+    AESD_JOB *j = malloc(sizeof(AESD_JOB));
+
+    if(j == NULL)
+        return -1;
+    j->q = *q;
+    j->threads = s->threads;
+    j->done = s->done[1];
+    if(pthread_create(&j->tid, NULL, aesd_job_run, j) != 0)
+    {
+        free(j);
+        return -1;
+    }
+    q->c->job = j;
+    return 0;
+}
+
+//answer the finished jobs; their clients are found again by job pointer
+static void aesd_finish(AES_DAEMON *s)
+{
+    AESD_JOB *done[AESD_MAX_CONN];
+    ssize_t n;
+
+    n = read(s->done[0], done, sizeof(done));
+    for(ssize_t i = 0; i < n / (ssize_t)sizeof(AESD_JOB*); i++)
+    {
+        pthread_join(done[i]->tid, NULL);
+        for(size_t k = 0; k < s->nconns; k++)
+            if(s->conns[k].job == done[i])
+            {
+                s->conns[k].job = NULL;
+                done[i]->q.c = &s->conns[k];
+                aesd_reply(&done[i]->q);
+            }
+        s->requests++;
+        s->batches++;
+        free(done[i]);
+    }
+}
+
+/*-------------------------------------------------------------------------
+                            SERVE
+ post: runs rounds until stopped. Returns 0, or -1 if poll fails.
+-------------------------------------------------------------------------*/
+int aes_daemon_serve(AES_DAEMON *s)
+{
+    struct pollfd pfd[AESD_MAX_CONN + 3];
+    AESD_CONN *c;
+    size_t nreq, ng, nfd;
+    int fd, r;
+
+    for(;;)
+    {
+        pfd[0] = (struct pollfd){s->stop[0], POLLIN, 0};
+        pfd[1] = (struct pollfd){s->lfd, POLLIN, 0};
+        pfd[2] = (struct pollfd){s->done[0], POLLIN, 0};
+        //a client with a job running is left out until it is answered
+        for(size_t i = 0; i < s->nconns; i++)
+        {
+            c = &s->conns[i];
+            pfd[i + 3] = (struct pollfd){c->job? -1 : c->fd, c->parked? POLLOUT : POLLIN, 0};
+        }
+        nfd = s->nconns + 3;
+        if(poll(pfd, nfd, -1) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        if(pfd[0].revents)
+            break;
+
+        //one request from each ready client; walk down so drops keep indexes
+        nreq = 0;
+        for(size_t i = nfd - 3; i-- > 0;)
+        {
+            if(!pfd[i + 3].revents)
+                continue;
+            c = &s->conns[i];
+            r = c->parked? aesd_flush(c) : aesd_recv(s, c, &s->reqs[nreq]);
+            if(r < 0)
+            {
+                //an earlier request from the last client now points at slot i
+                for(size_t k = 0; k < nreq; k++)
+                    if(s->reqs[k].c == &s->conns[s->nconns - 1])
+                        s->reqs[k].c = &s->conns[i];
+                aesd_drop(s, i);
+            }
+            else
+                nreq += (size_t)r;
+        }
+
+        for(size_t i = 0; i < nreq; i++)
+            if(s->reqs[i].shared && s->reqs[i].len >= AESD_PAR_MIN && aesd_start(s, &s->reqs[i]) == 0)
+                s->reqs[i].op = 0;
+
+        //group by key and op, then one batched pass per group
+        for(size_t i = 0; i < nreq; i++)
+        {
+            if(s->reqs[i].op == 0)
+                continue;
+            ng = 0;
+            for(size_t k = i; k < nreq; k++)
+                if(s->reqs[k].op == s->reqs[i].op && s->reqs[k].key == s->reqs[i].key)
+                    s->group[ng++] = &s->reqs[k];
+            if(s->reqs[i].op == AESD_OP_CTR)
+                aesd_ctr_batch(s, s->group, ng);
+            else
+                aesd_siv_batch(s, s->group, ng);
+            for(size_t k = 0; k < ng; k++)
+            {
+                aesd_reply(s->group[k]);
+                s->group[k]->op = 0;
+            }
+            s->requests += ng;
+        }
+        if(pfd[2].revents)
+            aesd_finish(s);
+        for(size_t i = s->nconns; i-- > 0;)
+            if(s->conns[i].dead)
+                aesd_drop(s, i);
+
+        //raw syscall: the accept4 wrapper needs _GNU_SOURCE before every include
+        if(pfd[1].revents && (fd = (int)syscall(__NR_accept4, s->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+        {
+            if(s->nconns == AESD_MAX_CONN || !(s->conns[s->nconns].buf = malloc(AESD_HDR + AESD_INLINE_MAX)))
+                close(fd);
+            else
+            {
+                c = &s->conns[s->nconns];
+                c->fd = fd;
+                c->shm = NULL;
+                c->parked = c->dead = false;
+                c->job = NULL;
+                s->nconns++;
+            }
+        }
+    }
+    //running jobs still use their clients' buffers
+    for(size_t i = 0; i < s->nconns; i++)
+        if(s->conns[i].job)
+        {
+            pthread_join(s->conns[i].job->tid, NULL);
+            free(s->conns[i].job);
+        }
+    while(s->nconns > 0)
+        aesd_drop(s, s->nconns - 1);
+    return 0;
+}
+
+void aes_daemon_close(AES_DAEMON *s)
+{
+    close(s->lfd);
+    close(s->stop[0]);
+    close(s->stop[1]);
+    close(s->done[0]);
+    close(s->done[1]);
+}
+
+/*-------------------------------------------------------------------------
+                            CLIENT
+-------------------------------------------------------------------------*/
+typedef struct aesd_client
+{
+    int fd;
+    uint8_t *shm;                    //shared buffer, NULL until aesd_share
+    size_t shm_len;
+    uint8_t *buf;                    //request / response message
+}AESD_CLIENT;
+
+int aesd_connect(AESD_CLIENT *c, const char *path)
+{
+    struct sockaddr_un sa = {0};
+
+    memset(c, 0, sizeof(AESD_CLIENT));
+    if(strlen(path) >= sizeof(sa.sun_path))
+        return -1;
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+    c->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(c->fd < 0)
+        return -1;
+    c->buf = malloc(AESD_HDR + AESD_INLINE_MAX);
+    if(!c->buf || connect(c->fd, (struct sockaddr*)&sa, sizeof(sa)) != 0)
+    {
+        free(c->buf);
+        close(c->fd);
+        return -1;
+    }
+    return 0;
+}
+
+void aesd_disconnect(AESD_CLIENT *c)
+{
+    close(c->fd);
+    if(c->shm)
+        munmap(c->shm, c->shm_len);
+    free(c->buf);
+}
+
+//offer fd as the shared buffer of len bytes; the daemon's status, or -1
+static int aesd_send_share(AESD_CLIENT *c, int fd, size_t len)
+{
+    union { uint8_t buf[CMSG_SPACE(sizeof(int))]; struct cmsghdr align; } ctl = {{0}};
+    uint8_t hdr[AESD_HDR] = {0}, resp[AESD_RESP];
+    struct iovec v = {hdr, AESD_HDR};
+    struct msghdr mh = {0};
+    struct cmsghdr *cm;
+
+    memcpy(hdr, AESD_MAGIC, 4);
+    hdr[4] = AESD_OP_SHARE;
+    store64_le(hdr + 24, len);
+    mh.msg_iov = &v;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = sizeof(ctl.buf);
+    cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+    if(sendmsg(c->fd, &mh, MSG_NOSIGNAL) == AESD_HDR && recv(c->fd, resp, AESD_RESP, 0) == AESD_RESP)
+        return (int)aesd_le32(resp + 4);
+    return -1;
+}
+
+/*-------------------------------------------------------------------------
+                        Share a buffer with the daemon
+ post: c->shm holds len bytes the daemon also maps. Data placed there is
+       processed in place, with no copy through the socket. Returns 0 or
+       -1.
+-------------------------------------------------------------------------*/
+int aesd_share(AESD_CLIENT *c, size_t len)
+{
+    int fd, res = -1;
+
+    fd = (int)syscall(__NR_memfd_create, "aesd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(fd < 0)
+        return -1;
+    if(ftruncate(fd, (off_t)len) != 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK) != 0)
+        goto out;
+    c->shm = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(c->shm == MAP_FAILED)
+    {
+        c->shm = NULL;
+        goto out;
+    }
+    c->shm_len = len;
+    res = aesd_send_share(c, fd, len);
+out:
+    close(fd);
+    return res;
+}
+
+/*-------------------------------------------------------------------------
+                        One request and its response
+ pre: data either wholly inside c->shm (then out must equal in) or inline
+      with aad_len + len at most AESD_INLINE_MAX.
+ post: returns 0, or -1 on a refused request, a bad tag or a lost daemon.
+-------------------------------------------------------------------------*/
+static int aesd_call(AESD_CLIENT *c, uint8_t op, uint32_t key_id, const uint8_t *iv, size_t ivlen, const uint8_t *aad, size_t aad_len,
+                     const uint8_t *in, uint8_t *out, size_t len, uint8_t *tag)
+{
+    bool shared = c->shm && in >= c->shm && in < c->shm + c->shm_len;
+    uint8_t *h = c->buf;
+    ssize_t n;
+
+    if(len > UINT32_MAX || (shared && (in != out || len > c->shm_len - (size_t)(in - c->shm))))
+        return -1;
+    if(aad_len + (shared? 0 : len) > AESD_INLINE_MAX)
+        return -1;
+    memset(h, 0, AESD_HDR);
+    memcpy(h, AESD_MAGIC, 4);
+    h[4] = op;
+    h[5] = shared? AESD_SHARED : 0;
+    aesd_put32(h + 8, key_id);
+    aesd_put32(h + 12, (uint32_t)len);
+    aesd_put32(h + 16, (uint32_t)aad_len);
+    store64_le(h + 24, shared? (uint64_t)(in - c->shm) : 0);
+    memcpy(h + 32, iv, ivlen);
+    if(op == AESD_OP_OPEN)
+        memcpy(h + 48, tag, 16);
+    if(aad_len)
+        memcpy(h + AESD_HDR, aad, aad_len);
+    if(!shared && len)
+        memcpy(h + AESD_HDR + aad_len, in, len);
+
+    n = AESD_HDR + aad_len + (shared? 0 : len);
+    if(send(c->fd, h, (size_t)n, MSG_NOSIGNAL) != n)
+        return -1;
+    n = recv(c->fd, h, AESD_RESP + AESD_INLINE_MAX, 0);
+    if(n < AESD_RESP || memcmp(h, AESD_MAGIC, 4) != 0 || aesd_le32(h + 4) != 0)
+        return -1;
+    if(!shared)
+    {
+        if((size_t)n != AESD_RESP + len)
+            return -1;
+        memcpy(out, h + AESD_RESP, len);
+    }
+    if(op == AESD_OP_SEAL)
+        memcpy(tag, h + 16, 16);
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                        CLIENT REQUESTS
+ pre: a CTR key for aesd_ctr (16-byte counter block, encrypts and
+      decrypts), a GCM-SIV key for seal / open (12-byte nonce, 16-byte
+      tag). out may equal in.
+ post: returns 0, or -1 as aesd_call. A failed open leaves out untouched
+       inline, wiped when shared.
+-------------------------------------------------------------------------*/
+int aesd_ctr(AESD_CLIENT *c, uint32_t key_id, const uint8_t *ctr, const uint8_t *in, uint8_t *out, size_t len)
+{
+    return aesd_call(c, AESD_OP_CTR, key_id, ctr, 16, NULL, 0, in, out, len, NULL);
+}
+
+int aesd_seal(AESD_CLIENT *c, uint32_t key_id, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+              const uint8_t *in, uint8_t *out, size_t len, uint8_t *tag)
+{
+    return aesd_call(c, AESD_OP_SEAL, key_id, nonce, 12, aad, aad_len, in, out, len, tag);
+}
+
+int aesd_open(AESD_CLIENT *c, uint32_t key_id, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+              const uint8_t *in, uint8_t *out, size_t len, const uint8_t *tag)
+{
+    return aesd_call(c, AESD_OP_OPEN, key_id, nonce, 12, aad, aad_len, in, out, len, (uint8_t*)tag);
+}
+
+#endif /* aes_daemon_h */
@@ -0,0 +1,314 @@
+#ifndef aes_drbg_h
+#define aes_drbg_h
+#include <sys/random.h>
+#include "aes_block.h"
+#include "aes_ctr.h"
+#include "aes_thread.h"
+
+/*
+    CTR_DRBG with AES-256 (SP 800-90A 10.2), no derivation function, seeded
+    with full-entropy input from getrandom.
+
+    The state keeps both the 32-byte Key and its expanded schedule, so a
+    generate call costs one key expansion in its update step and one cipher
+    call per output block. Bulk output is cut into 64 KiB requests: the
+    updates between them are a few blocks each and are run first, in order,
+    recording (Key, V) of every request, then the keystream of all requests
+    goes through the CTR kernel in parallel.
+
+    aes_random draws from a per-thread instance, so the fast path takes no
+    lock and makes no system call. The instance is reseeded after
+    DRBG_RESEED_INTERVAL requests and after a fork, which a pthread_atfork
+    child handler signals by bumping a generation counter. It is wiped when
+    its thread exits.
+*/
+
+#define DRBG_SEEDLEN 48                   //key + block
+#define DRBG_MAX_REQUEST 65536            //2^19 bits per request
+#define DRBG_RESEED_INTERVAL (1ULL << 32) //requests between reseeds
+
+typedef struct aes_drbg
+{
+    AES_CTX aes;              //expanded Key
+    uint8_t key[32];
+    uint8_t v[16];
+    uint64_t reseed_counter;
+    uint64_t fork_gen;        //drbg_fork_gen when this state was seeded
+}AES_DRBG;
+
+/*-------------------------------------------------------------------------
+        Fork detection: the child handler bumps the generation, a state
+        seeded under an older generation reseeds before its next output
+-------------------------------------------------------------------------*/
+static uint64_t drbg_fork_gen;
+static pthread_once_t drbg_fork_once = PTHREAD_ONCE_INIT;
+
+static void drbg_forked(void)
+{
+    __atomic_fetch_add(&drbg_fork_gen, 1, __ATOMIC_RELAXED);
+}
+
+static void drbg_fork_register(void)
+{
+    pthread_atfork(NULL, NULL, drbg_forked);
+}
+
+static inline bool drbg_stale(const AES_DRBG *d)
+{
+    return d->reseed_counter > DRBG_RESEED_INTERVAL || d->fork_gen != __atomic_load_n(&drbg_fork_gen, __ATOMIC_RELAXED);
+}
+
+/*-------------------------------------------------------------------------
+                        CTR_DRBG_Update (10.2.1.2)
+ pre: data is DRBG_SEEDLEN bytes or NULL for all zero.
+ post: Key || V = (E(V+1) || E(V+2) || E(V+3)) ^ data
+-------------------------------------------------------------------------*/
+static void drbg_update(AES_DRBG *d, const uint8_t *data)
+{
+    uint8_t temp[3*AES_BLOCK];
+
+    ctr128_inc(d->v);
+    aes_ctr_keystream(&d->aes, d->v, temp, 3);
+    if(data)
+        for(uint8_t i = 0; i < DRBG_SEEDLEN; i++)
+            temp[i] ^= data[i];
+    memcpy(d->key, temp, 32);
+    memcpy(d->v, temp + 32, AES_BLOCK);
+    aes_setkey_enc(&d->aes, d->key, 2);
+    memset(temp, 0, sizeof(temp));
+}
+
+/*-------------------------------------------------------------------------
+        Seed material: entropy (or getrandom) XOR zero-padded extra input
+ post: returns false if entropy could not be read or extra is too long.
+-------------------------------------------------------------------------*/
+static bool drbg_seed_material(uint8_t *seed, const uint8_t *entropy, const uint8_t *extra, size_t elen)
+{
+    if(elen > DRBG_SEEDLEN)
+        return false;
+    if(entropy)
+        memcpy(seed, entropy, DRBG_SEEDLEN);
+    else if(getrandom(seed, DRBG_SEEDLEN, 0) != DRBG_SEEDLEN)
+        return false;
+    for(size_t i = 0; i < elen; i++)
+        seed[i] ^= extra[i];
+    return true;
+}
+
+/*-------------------------------------------------------------------------
+                        INSTANTIATE / RESEED
+ pre: entropy is DRBG_SEEDLEN bytes of full-entropy input, or NULL to read
+      it from getrandom. pers / addin at most DRBG_SEEDLEN bytes.
+ post: returns 0, or -1 on a bad length or no entropy.
+-------------------------------------------------------------------------*/
+int aes_drbg_instantiate(AES_DRBG *d, const uint8_t *entropy, const uint8_t *pers, size_t plen)
+{
+    uint8_t seed[DRBG_SEEDLEN];
+
+    if(!drbg_seed_material(seed, entropy, pers, plen))
+        return -1;
+    memset(d->key, 0, 32);
+    memset(d->v, 0, AES_BLOCK);
+    aes_setkey_enc(&d->aes, d->key, 2);
+    drbg_update(d, seed);
+    d->reseed_counter = 1;
+    pthread_once(&drbg_fork_once, drbg_fork_register);
+    d->fork_gen = __atomic_load_n(&drbg_fork_gen, __ATOMIC_RELAXED);
+    memset(seed, 0, DRBG_SEEDLEN);
+    return 0;
+}
+
+int aes_drbg_reseed(AES_DRBG *d, const uint8_t *entropy, const uint8_t *addin, size_t alen)
+{
+    uint8_t seed[DRBG_SEEDLEN];
+
+    if(!drbg_seed_material(seed, entropy, addin, alen))
+        return -1;
+    drbg_update(d, seed);
+    d->reseed_counter = 1;
+    pthread_once(&drbg_fork_once, drbg_fork_register);
+    d->fork_gen = __atomic_load_n(&drbg_fork_gen, __ATOMIC_RELAXED);
+    memset(seed, 0, DRBG_SEEDLEN);
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+            len bytes of E(V+1) || E(V+2) || ..., V itself unchanged
+-------------------------------------------------------------------------*/
+static void drbg_keystream(const AES_CTX *aes, const uint8_t *v, uint8_t *out, size_t len)
+{
+    uint8_t ctr[AES_BLOCK], last[AES_BLOCK];
+
+    memcpy(ctr, v, AES_BLOCK);
+    ctr128_inc(ctr);
+    aes_ctr_keystream(aes, ctr, out, len / AES_BLOCK);
+    if(len % AES_BLOCK)
+    {
+        aes_ctr_keystream(aes, ctr, last, 1);
+        memcpy(out + len - len % AES_BLOCK, last, len % AES_BLOCK);
+        memset(last, 0, AES_BLOCK);
+    }
+}
+
+/*-------------------------------------------------------------------------
+                        GENERATE (10.2.1.5.1)
+ pre: len at most DRBG_MAX_REQUEST, addin at most DRBG_SEEDLEN bytes.
+ post: returns 0, or -1 on a bad length or a reseed that failed. The state
+       reseeds itself from getrandom when the interval runs out or the
+       process forked.
+-------------------------------------------------------------------------*/
+int aes_drbg_generate(AES_DRBG *d, uint8_t *out, size_t len, const uint8_t *addin, size_t alen)
+{
+    uint8_t extra[DRBG_SEEDLEN];
+    const uint8_t *add = NULL;
+
+    if(len > DRBG_MAX_REQUEST || alen > DRBG_SEEDLEN)
+        return -1;
+    if(drbg_stale(d))
+        if(aes_drbg_reseed(d, NULL, NULL, 0) != 0)
+            return -1;
+    if(alen > 0)
+    {
+        memset(extra, 0, DRBG_SEEDLEN);
+        memcpy(extra, addin, alen);
+        add = extra;
+        drbg_update(d, add);
+    }
+
+    //V + 1 .. V + nblocks, V is left at the last block used
+    drbg_keystream(&d->aes, d->v, out, len);
+    ctr128_add(d->v, (len + AES_BLOCK - 1) / AES_BLOCK);
+    drbg_update(d, add);
+    d->reseed_counter++;
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                            BULK GENERATE
+ pre: threads = 0 uses every online core.
+ post: len bytes as consecutive DRBG_MAX_REQUEST requests without additional
+       input, the same output as calling aes_drbg_generate in a loop. Returns
+       0, or -1 if a reseed failed (the output is then not usable).
+-------------------------------------------------------------------------*/
+typedef struct drbg_plan
+{
+    uint8_t key[32];
+    uint8_t v[16];
+}DRBG_PLAN;
+
+typedef struct drbg_bulk
+{
+    const DRBG_PLAN *plan;
+    uint8_t *out;
+    size_t len;
+}DRBG_BULK;
+
+static void drbg_bulk_range(void *arg, size_t lo, size_t hi)
+{
+    DRBG_BULK *b = (DRBG_BULK*)arg;
+    AES_CTX aes;
+    size_t n;
+
+    for(size_t r = lo; r < hi; r++)
+    {
+        n = b->len - r*DRBG_MAX_REQUEST;
+        n = n < DRBG_MAX_REQUEST? n : DRBG_MAX_REQUEST;
+        aes_setkey_enc(&aes, b->plan[r].key, 2);
+        drbg_keystream(&aes, b->plan[r].v, b->out + r*DRBG_MAX_REQUEST, n);
+    }
+    aes_ctx_wipe(&aes);
+}
+
+int aes_drbg_bulk(AES_DRBG *d, uint8_t *out, size_t len, unsigned threads)
+{
+    size_t nreq = (len + DRBG_MAX_REQUEST - 1) / DRBG_MAX_REQUEST, n;
+    DRBG_PLAN *plan;
+    DRBG_BULK b;
+    int rc = 0;
+
+    if(nreq <= 1)
+        return aes_drbg_generate(d, out, len, NULL, 0);
+    plan = malloc(nreq * sizeof(DRBG_PLAN));
+    if(plan == NULL)
+        return -1;
+
+    //the updates only need V after each request, not the output itself
+    for(size_t r = 0; r < nreq && rc == 0; r++)
+    {
+        if(drbg_stale(d))
+            rc = aes_drbg_reseed(d, NULL, NULL, 0);
+        n = len - r*DRBG_MAX_REQUEST;
+        n = n < DRBG_MAX_REQUEST? n : DRBG_MAX_REQUEST;
+        memcpy(plan[r].key, d->key, 32);
+        memcpy(plan[r].v, d->v, AES_BLOCK);
+        ctr128_add(d->v, (n + AES_BLOCK - 1) / AES_BLOCK);
+        drbg_update(d, NULL);
+        d->reseed_counter++;
+    }
+    if(rc == 0)
+    {
+        b = (DRBG_BULK){plan, out, len};
+        aes_parallel_for(nreq, threads, drbg_bulk_range, &b);
+    }
+    memset(plan, 0, nreq * sizeof(DRBG_PLAN));
+    free(plan);
+    return rc;
+}
+
+/*-------------------------------------------------------------------------
+                                WIPE
+-------------------------------------------------------------------------*/
+void aes_drbg_wipe(AES_DRBG *d)
+{
+    volatile uint8_t *p = (volatile uint8_t*)d;
+
+    for(size_t i = 0; i < sizeof(AES_DRBG); i++)
+        p[i] = 0;
+}
+
+/*-------------------------------------------------------------------------
+                        PER-THREAD RANDOM BYTES
+ post: len bytes from this thread's instance, seeded from getrandom on first
+       use. Returns 0, or -1 if no entropy could be read.
+-------------------------------------------------------------------------*/
+static __thread AES_DRBG drbg_tls;
+static __thread bool drbg_tls_ready;
+static pthread_key_t drbg_tls_key;
+static pthread_once_t drbg_tls_once = PTHREAD_ONCE_INIT;
+
+//thread exit: the key's value is this thread's instance
+static void drbg_tls_exit(void *p)
+{
+    aes_drbg_wipe((AES_DRBG*)p);
+    drbg_tls_ready = false;
+}
+
+static void drbg_tls_key_create(void)
+{
+    pthread_key_create(&drbg_tls_key, drbg_tls_exit);
+}
+
+int aes_random(uint8_t *out, size_t len)
+{
+    size_t n;
+
+    if(!drbg_tls_ready)
+    {
+        if(aes_drbg_instantiate(&drbg_tls, NULL, NULL, 0) != 0)
+            return -1;
+        pthread_once(&drbg_tls_once, drbg_tls_key_create);
+        pthread_setspecific(drbg_tls_key, &drbg_tls);
+        drbg_tls_ready = true;
+    }
+    while(len > 0)
+    {
+        n = len < DRBG_MAX_REQUEST? len : DRBG_MAX_REQUEST;
+        if(aes_drbg_generate(&drbg_tls, out, n, NULL, 0) != 0)
+            return -1;
+        out += n;
+        len -= n;
+    }
+    return 0;
+}
+
+#endif /* aes_drbg_h */
@@ -0,0 +1,543 @@
+#ifndef aes_fpe_h
+#define aes_fpe_h
+#include "aes_block.h"
+
+/*
+    Format-preserving encryption, FF1 and FF3-1 (SP 800-38G Rev. 1), over
+    strings of numerals in radix 2 to 65536.
+
+    Both are Feistel networks whose round function is one or a few cipher
+    calls, so a single string keeps the kernel almost idle. The batch calls
+    run the rounds of up to AES_LANES strings in lockstep, each round's
+    cipher calls of all strings going through one kernel pass.
+
+    Strings are limited to FPE_MAX_LEN numerals, which covers card numbers,
+    SSNs and account IDs. For such short strings the radix conversions
+    run on a small fixed bignum and take as many numerals per multiply or
+    divide as fit in 32 bits (9 decimal digits). The byte length b of
+    NUM(B) in FF1 is tabulated per key, and the CBC-MAC over P and the
+    round-independent part of Q is computed once per string, not per round.
+*/
+
+#define FPE_MAX_LEN 128               //numerals per string
+#define FPE_MAX_TWEAK 256             //FF1 tweak bytes
+#define FPE_LIMBS 34                  //32-bit limbs, radix^(FPE_MAX_LEN/2) plus PRF output
+#define FF1_MSG_MAX (2*AES_BLOCK + FPE_MAX_TWEAK)
+#define FF1_S_MAX (9*AES_BLOCK)       //d <= 132 bytes
+
+typedef struct aes_fpe_ctx
+{
+    AES_CTX aes;
+    uint32_t radix;
+    uint32_t rk;                      //radix^k, numerals per 32-bit chunk
+    uint8_t k;
+    uint8_t minlen, maxlen;
+    uint8_t b[FPE_MAX_LEN/2 + 1];     //FF1: bytes of NUM_radix(B) for |B| = v
+    bool ff3;
+}AES_FPE_CTX;
+
+typedef struct aes_fpe_item
+{
+    const uint16_t *in;
+    uint16_t *out;                    //may equal in
+    size_t len;
+    const uint8_t *tweak;             //FF1 up to FPE_MAX_TWEAK bytes, FF3-1 7 (8: legacy FF3)
+    size_t tlen;
+    int status;                       //0 ok, -1 bad length, numeral or tweak
+}AES_FPE_ITEM;
+
+typedef struct fpe_big
+{
+    uint32_t w[FPE_LIMBS];            //little-endian limbs
+    uint8_t n;                        //limbs in use
+}FPE_BIG;
+
+typedef struct fpe_lane
+{
+    AES_FPE_ITEM *item;
+    uint16_t h[2][FPE_MAX_LEN/2 + 1];
+    uint16_t *a, *b;
+    size_t u, v;
+    uint8_t x[AES_BLOCK];             //FF1: CBC-MAC over P and the constant part of Q
+    uint8_t y[AES_BLOCK];             //running chain
+    uint8_t msg[FF1_MSG_MAX];
+    size_t mblk, qfix;                //blocks in msg, bytes of Q before the per-round tail
+    uint8_t bb, d, pad;
+}FPE_LANE;
+
+/*-------------------------------------------------------------------------
+                        Small bignum helpers
+-------------------------------------------------------------------------*/
+static void big_mul_add(FPE_BIG *x, uint32_t m, uint32_t a)
+{
+    uint64_t c = a;
+
+    for(uint8_t i = 0; i < x->n; i++)
+    {
+        c += (uint64_t)x->w[i] * m;
+        x->w[i] = (uint32_t)c;
+        c >>= 32;
+    }
+    if(c)
+        x->w[x->n++] = (uint32_t)c;
+}
+
+static uint32_t big_divmod(FPE_BIG *x, uint32_t m)
+{
+    uint64_t r = 0;
+
+    for(uint8_t i = x->n; i-- > 0;)
+    {
+        r = (r << 32) | x->w[i];
+        x->w[i] = (uint32_t)(r / m);
+        r %= m;
+    }
+    while(x->n && x->w[x->n - 1] == 0)
+        x->n--;
+    return (uint32_t)r;
+}
+
+static void big_from_bytes(FPE_BIG *x, const uint8_t *in, size_t len)
+{
+    x->n = (uint8_t)((len + 3) / 4);
+    memset(x->w, 0, 4*x->n);
+    for(size_t j = 0; j < len; j++)
+        x->w[j/4] |= (uint32_t)in[len - 1 - j] << (8*(j%4));
+    while(x->n && x->w[x->n - 1] == 0)
+        x->n--;
+}
+
+static void big_to_bytes(const FPE_BIG *x, uint8_t *out, size_t len)
+{
+    for(size_t j = 0; j < len; j++)
+        out[len - 1 - j] = j/4 < x->n? (uint8_t)(x->w[j/4] >> (8*(j%4))) : 0;
+}
+
+static uint16_t big_bits(const FPE_BIG *x)
+{
+    uint16_t bits;
+    uint32_t top;
+
+    if(x->n == 0) return 0;
+    bits = 32*(x->n - 1);
+    for(top = x->w[x->n - 1]; top; top >>= 1)
+        bits++;
+    return bits;
+}
+
+/*-------------------------------------------------------------------------
+                NUM_radix(X) or NUM_radix(REV(X)), k numerals a step
+-------------------------------------------------------------------------*/
+static void fpe_num(const AES_FPE_CTX *ctx, const uint16_t *d, size_t len, bool rev, FPE_BIG *x)
+{
+    uint32_t acc = 0, mult = 1;
+    uint8_t cnt = 0;
+
+    x->n = 0;
+    for(size_t i = 0; i < len; i++)
+    {
+        acc = acc * ctx->radix + d[rev? len - 1 - i : i];
+        mult *= ctx->radix;
+        if(++cnt == ctx->k)
+        {
+            big_mul_add(x, mult, acc);
+            acc = 0;
+            mult = 1;
+            cnt = 0;
+        }
+    }
+    if(cnt)
+        big_mul_add(x, mult, acc);
+}
+
+/*-------------------------------------------------------------------------
+        dst = dst +/- (y mod radix^m), numerals of y least significant first
+ rev: dst[0] is the least significant numeral (FF3-1), else dst[m-1].
+ post: y destroyed.
+-------------------------------------------------------------------------*/
+static void fpe_combine(const AES_FPE_CTX *ctx, uint16_t *dst, FPE_BIG *y, size_t m, bool rev, bool sub)
+{
+    int32_t carry = 0, s;
+    uint32_t r = 0;
+    size_t idx;
+
+    for(size_t j = 0; j < m; j++)
+    {
+        if(j % ctx->k == 0)
+            r = y->n? big_divmod(y, ctx->rk) : 0;
+        idx = rev? j : m - 1 - j;
+        s = sub? (int32_t)dst[idx] - (int32_t)(r % ctx->radix) + carry : (int32_t)dst[idx] + (int32_t)(r % ctx->radix) + carry;
+        r /= ctx->radix;
+        carry = 0;
+        if(s < 0)
+        {
+            s += (int32_t)ctx->radix;
+            carry = -1;
+        }
+        else if((uint32_t)s >= ctx->radix)
+        {
+            s -= (int32_t)ctx->radix;
+            carry = 1;
+        }
+        dst[idx] = (uint16_t)s;
+    }
+}
+
+/*-------------------------------------------------------------------------
+                            FPE Key Setup
+ pre: type (0) 128, (1) 192, (2) 256; radix 2 to 65536.
+ post: returns 0, or -1 on a bad radix. FF3-1 keys the cipher with REVB(K).
+-------------------------------------------------------------------------*/
+static int fpe_setkey(AES_FPE_CTX *ctx, const uint8_t *key, uint8_t type, uint32_t radix, bool ff3)
+{
+    uint8_t rkey[32], klen = 16 + 8*type;
+    uint64_t p = 1;
+    FPE_BIG x, t;
+
+    if(radix < 2 || radix > 65536)
+        return -1;
+    ctx->radix = radix;
+    ctx->ff3 = ff3;
+    if(ff3)
+    {
+        for(uint8_t i = 0; i < klen; i++)
+            rkey[i] = key[klen - 1 - i];
+        aes_setkey_enc(&ctx->aes, rkey, type);
+        memset(rkey, 0, sizeof(rkey));
+    }
+    else
+        aes_setkey_enc(&ctx->aes, key, type);
+
+    for(ctx->k = 0, ctx->rk = 1; (uint64_t)ctx->rk * radix <= 0xffffffffULL; ctx->k++)
+        ctx->rk *= radix;
+
+    //radix^minlen >= 1000000
+    for(ctx->minlen = 0; p < 1000000; ctx->minlen++)
+        p *= radix;
+    if(ctx->minlen < 2)
+        ctx->minlen = 2;
+
+    //b[v] = ceil(ceil(v * log2(radix)) / 8) = bytes of radix^v - 1
+    x.n = 1;
+    x.w[0] = 1;
+    ctx->maxlen = FPE_MAX_LEN;
+    ctx->b[0] = 0;
+    for(uint8_t v = 1; v <= FPE_MAX_LEN/2; v++)
+    {
+        big_mul_add(&x, radix, 0);
+        t = x;
+        for(uint8_t i = 0; i < t.n; i++)
+            if(t.w[i]-- != 0)
+                break;
+        while(t.n && t.w[t.n - 1] == 0)
+            t.n--;
+        ctx->b[v] = (uint8_t)((big_bits(&t) + 7) / 8);
+        //FF3-1: maxlen = 2 * floor(log_radix(2^96))
+        if(ff3 && big_bits(&t) > 96 && ctx->maxlen == FPE_MAX_LEN)
+            ctx->maxlen = (uint8_t)(2*(v - 1));
+    }
+    return 0;
+}
+
+int aes_ff1_setkey(AES_FPE_CTX *ctx, const uint8_t *key, uint8_t type, uint32_t radix)
+{
+    return fpe_setkey(ctx, key, type, radix, false);
+}
+
+int aes_ff3_1_setkey(AES_FPE_CTX *ctx, const uint8_t *key, uint8_t type, uint32_t radix)
+{
+    return fpe_setkey(ctx, key, type, radix, true);
+}
+
+/*-------------------------------------------------------------------------
+                    Load an item into a lane
+ post: returns false (status -1) if the item is not valid.
+-------------------------------------------------------------------------*/
+static bool fpe_load(const AES_FPE_CTX *ctx, FPE_LANE *ln, AES_FPE_ITEM *it)
+{
+    size_t n = it->len;
+
+    it->status = -1;
+    if(n < ctx->minlen || n > ctx->maxlen)
+        return false;
+    if(ctx->ff3? it->tweak == NULL || (it->tlen != 7 && it->tlen != 8) : (it->tlen > FPE_MAX_TWEAK || (it->tlen && it->tweak == NULL)))
+        return false;
+    for(size_t i = 0; i < n; i++)
+        if(it->in[i] >= ctx->radix)
+            return false;
+
+    ln->item = it;
+    ln->u = ctx->ff3? (n + 1) / 2 : n / 2;
+    ln->v = n - ln->u;
+    memcpy(ln->h[0], it->in, ln->u * sizeof(uint16_t));
+    memcpy(ln->h[1], it->in + ln->u, ln->v * sizeof(uint16_t));
+    ln->a = ln->h[0];
+    ln->b = ln->h[1];
+    return true;
+}
+
+static void fpe_store(FPE_LANE *ln)
+{
+    memcpy(ln->item->out, ln->a, ln->u * sizeof(uint16_t));
+    memcpy(ln->item->out + ln->u, ln->b, ln->v * sizeof(uint16_t));
+    ln->item->status = 0;
+}
+
+/*-------------------------------------------------------------------------
+            CBC-MAC of each lane's msg, chained on y, in lockstep
+-------------------------------------------------------------------------*/
+static void fpe_cbcmac(const AES_CTX *aes, FPE_LANE *lane, size_t cnt)
+{
+    uint8_t buf[AES_LANES*AES_BLOCK];
+    size_t idx[AES_LANES], p, most = 0;
+
+    for(size_t l = 0; l < cnt; l++)
+        most = lane[l].mblk > most? lane[l].mblk : most;
+    for(size_t k = 0; k < most; k++)
+    {
+        p = 0;
+        for(size_t l = 0; l < cnt; l++)
+            if(k < lane[l].mblk)
+            {
+                xor_block(buf + AES_BLOCK*p, lane[l].y, lane[l].msg + AES_BLOCK*k);
+                idx[p++] = l;
+            }
+        aes_encrypt_lanes(aes, buf, buf, p);
+        for(size_t i = 0; i < p; i++)
+            memcpy(lane[idx[i]].y, buf + AES_BLOCK*i, AES_BLOCK);
+    }
+}
+
+/*-------------------------------------------------------------------------
+                    FF1 over up to AES_LANES lanes
+ P = [1][2][1] [radix]3 [10] [u mod 256] [n]4 [t]4
+ Q = T || 0^pad || [i] || [NUM_radix(B)]b, R = PRF(P || Q)
+-------------------------------------------------------------------------*/
+static void ff1_lanes(const AES_FPE_CTX *ctx, FPE_LANE *lane, size_t cnt, bool decrypt)
+{
+    uint8_t s[AES_LANES][FF1_S_MAX], ext[AES_LANES*8*AES_BLOCK];
+    size_t owner[AES_LANES*8], ne, t, n, m, tail;
+    uint16_t *src, *dst, *tmp;
+    FPE_BIG x;
+    uint8_t round;
+
+    //CIPH(P) and the blocks of Q that hold only T and zero padding
+    for(size_t l = 0; l < cnt; l++)
+    {
+        FPE_LANE *ln = &lane[l];
+        t = ln->item->tlen;
+        n = ln->item->len;
+        ln->bb = ctx->b[ln->v];
+        ln->d = (uint8_t)(4*((ln->bb + 3) / 4) + 4);
+        ln->pad = (uint8_t)((16 - (t + ln->bb + 1) % 16) % 16);
+        ln->qfix = (t + ln->pad) / AES_BLOCK * AES_BLOCK;
+
+        memset(ln->msg, 0, AES_BLOCK + ln->qfix);
+        ln->msg[0] = 1;
+        ln->msg[1] = 2;
+        ln->msg[2] = 1;
+        ln->msg[3] = (uint8_t)(ctx->radix >> 16);
+        ln->msg[4] = (uint8_t)(ctx->radix >> 8);
+        ln->msg[5] = (uint8_t)ctx->radix;
+        ln->msg[6] = 10;
+        ln->msg[7] = (uint8_t)ln->u;
+        for(uint8_t i = 0; i < 4; i++)
+        {
+            ln->msg[8 + i] = (uint8_t)(n >> (24 - 8*i));
+            ln->msg[12 + i] = (uint8_t)(t >> (24 - 8*i));
+        }
+        if(ln->qfix)
+            memcpy(ln->msg + AES_BLOCK, ln->item->tweak, t < ln->qfix? t : ln->qfix);
+        ln->mblk = 1 + ln->qfix / AES_BLOCK;
+        memset(ln->y, 0, AES_BLOCK);
+    }
+    fpe_cbcmac(&ctx->aes, lane, cnt);
+    for(size_t l = 0; l < cnt; l++)
+        memcpy(lane[l].x, lane[l].y, AES_BLOCK);
+
+    for(uint8_t r = 0; r < 10; r++)
+    {
+        round = decrypt? 9 - r : r;
+
+        //rest of Q: end of T, padding, [i], [NUM_radix(B)]b
+        for(size_t l = 0; l < cnt; l++)
+        {
+            FPE_LANE *ln = &lane[l];
+            t = ln->item->tlen;
+            src = decrypt? ln->a : ln->b;
+            m = round % 2? ln->v : ln->u;
+            tail = t + ln->pad - ln->qfix;
+            memset(ln->msg, 0, tail);
+            if(t > ln->qfix)
+                memcpy(ln->msg, ln->item->tweak + ln->qfix, t - ln->qfix);
+            ln->msg[tail] = round;
+            //src holds the other half: v numerals if m = u, else u
+            fpe_num(ctx, src, m == ln->u? ln->v : ln->u, false, &x);
+            big_to_bytes(&x, ln->msg + tail + 1, ln->bb);
+            ln->mblk = (tail + 1 + ln->bb) / AES_BLOCK;
+            memcpy(ln->y, ln->x, AES_BLOCK);
+        }
+        fpe_cbcmac(&ctx->aes, lane, cnt);
+
+        //S = R || CIPH(R ^ [1]16) || CIPH(R ^ [2]16) ...
+        ne = 0;
+        for(size_t l = 0; l < cnt; l++)
+        {
+            memcpy(s[l], lane[l].y, AES_BLOCK);
+            for(uint8_t j = 1; j < (lane[l].d + AES_BLOCK - 1) / AES_BLOCK; j++)
+            {
+                memcpy(ext + AES_BLOCK*ne, lane[l].y, AES_BLOCK);
+                ext[AES_BLOCK*ne + 15] ^= j;
+                owner[ne++] = l;
+            }
+        }
+        aes_encrypt_blocks(&ctx->aes, ext, ext, ne);
+        for(size_t e = 0, j = 1; e < ne; e++, j++)
+        {
+            if(e > 0 && owner[e] != owner[e - 1])
+                j = 1;
+            memcpy(s[owner[e]] + AES_BLOCK*j, ext + AES_BLOCK*e, AES_BLOCK);
+        }
+
+        //c = NUM(A) + y (encrypt) or NUM(B) - y (decrypt) mod radix^m
+        for(size_t l = 0; l < cnt; l++)
+        {
+            FPE_LANE *ln = &lane[l];
+            m = round % 2? ln->v : ln->u;
+            dst = decrypt? ln->b : ln->a;
+            big_from_bytes(&x, s[l], ln->d);
+            fpe_combine(ctx, dst, &x, m, false, decrypt);
+            tmp = ln->a;
+            ln->a = ln->b;
+            ln->b = tmp;
+        }
+    }
+}
+
+/*-------------------------------------------------------------------------
+                    FF3-1 over up to AES_LANES lanes
+ T_L = T[0..27] || 0^4, T_R = T[32..55] || T[28..31] || 0^4, or with an
+ 8-byte tweak the original FF3 split T_L = T[0..31], T_R = T[32..63], kept
+ for tokens issued before FF3-1.
+ P = W ^ [i]4 || [NUM_radix(REV(B))]12, S = REVB(CIPH(REVB(P)))
+-------------------------------------------------------------------------*/
+static void ff3_tweak(const uint8_t *tw, size_t tlen, uint8_t *tl, uint8_t *tr)
+{
+    if(tlen == 8)
+    {
+        memcpy(tl, tw, 4);
+        memcpy(tr, tw + 4, 4);
+        return;
+    }
+    tl[0] = tw[0];
+    tl[1] = tw[1];
+    tl[2] = tw[2];
+    tl[3] = tw[3] & 0xf0;
+    tr[0] = tw[4];
+    tr[1] = tw[5];
+    tr[2] = tw[6];
+    tr[3] = (uint8_t)(tw[3] << 4);
+}
+
+static void ff3_lanes(const AES_FPE_CTX *ctx, FPE_LANE *lane, size_t cnt, bool decrypt)
+{
+    uint8_t buf[AES_LANES*AES_BLOCK], p[AES_BLOCK], tl[4], tr[4];
+    const uint8_t *w;
+    uint16_t *src, *dst, *tmp;
+    size_t m;
+    FPE_BIG x;
+    uint8_t round;
+
+    for(uint8_t r = 0; r < 8; r++)
+    {
+        round = decrypt? 7 - r : r;
+        for(size_t l = 0; l < cnt; l++)
+        {
+            FPE_LANE *ln = &lane[l];
+            ff3_tweak(ln->item->tweak, ln->item->tlen, tl, tr);
+            w = round % 2? tl : tr;
+            m = round % 2? ln->v : ln->u;
+            src = decrypt? ln->a : ln->b;
+
+            memcpy(p, w, 4);
+            p[3] ^= round;
+            fpe_num(ctx, src, m == ln->u? ln->v : ln->u, true, &x);
+            big_to_bytes(&x, p + 4, 12);
+            for(uint8_t i = 0; i < AES_BLOCK; i++)
+                buf[AES_BLOCK*l + i] = p[15 - i];
+        }
+        aes_encrypt_lanes(&ctx->aes, buf, buf, cnt);
+        for(size_t l = 0; l < cnt; l++)
+        {
+            FPE_LANE *ln = &lane[l];
+            m = round % 2? ln->v : ln->u;
+            dst = decrypt? ln->b : ln->a;
+            for(uint8_t i = 0; i < AES_BLOCK; i++)
+                p[i] = buf[AES_BLOCK*l + 15 - i];
+            big_from_bytes(&x, p, AES_BLOCK);
+            fpe_combine(ctx, dst, &x, m, true, decrypt);
+            tmp = ln->a;
+            ln->a = ln->b;
+            ln->b = tmp;
+        }
+    }
+}
+
+/*-------------------------------------------------------------------------
+                            FPE BATCH
+ post: items[i].status set, valid items encrypted (decrypted) into out.
+-------------------------------------------------------------------------*/
+static void fpe_batch(const AES_FPE_CTX *ctx, AES_FPE_ITEM *items, size_t n, bool decrypt)
+{
+    FPE_LANE lane[AES_LANES];
+    size_t next = 0, cnt;
+
+    while(next < n)
+    {
+        cnt = 0;
+        while(cnt < AES_LANES && next < n)
+            if(fpe_load(ctx, &lane[cnt], &items[next++]))
+                cnt++;
+        if(cnt == 0)
+            break;
+        if(ctx->ff3)
+            ff3_lanes(ctx, lane, cnt, decrypt);
+        else
+            ff1_lanes(ctx, lane, cnt, decrypt);
+        for(size_t l = 0; l < cnt; l++)
+            fpe_store(&lane[l]);
+    }
+}
+
+void aes_fpe_encrypt_batch(const AES_FPE_CTX *ctx, AES_FPE_ITEM *items, size_t n)
+{
+    fpe_batch(ctx, items, n, false);
+}
+
+void aes_fpe_decrypt_batch(const AES_FPE_CTX *ctx, AES_FPE_ITEM *items, size_t n)
+{
+    fpe_batch(ctx, items, n, true);
+}
+
+/*-------------------------------------------------------------------------
+                        FPE SINGLE STRING
+ pre: ctx set up by aes_ff1_setkey or aes_ff3_1_setkey.
+ post: returns 0, or -1 on a bad length, numeral or tweak.
+-------------------------------------------------------------------------*/
+int aes_fpe_encrypt(const AES_FPE_CTX *ctx, const uint8_t *tweak, size_t tlen, const uint16_t *in, uint16_t *out, size_t len)
+{
+    AES_FPE_ITEM it = {in, out, len, tweak, tlen, 0};
+
+    fpe_batch(ctx, &it, 1, false);
+    return it.status;
+}
+
+int aes_fpe_decrypt(const AES_FPE_CTX *ctx, const uint8_t *tweak, size_t tlen, const uint16_t *in, uint16_t *out, size_t len)
+{
+    AES_FPE_ITEM it = {in, out, len, tweak, tlen, 0};
+
+    fpe_batch(ctx, &it, 1, true);
+    return it.status;
+}
+
+#endif /* aes_fpe_h */
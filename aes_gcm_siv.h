@@ -0,0 +1,215 @@
+#ifndef aes_gcm_siv_h
+#define aes_gcm_siv_h
+#include "aes_block.h"
+#include "aes_polyval.h"
+
+/*
+    AES-GCM-SIV nonce-misuse-resistant AEAD (RFC 8452), AES-128 and AES-256.
+
+    Every message derives its own authentication and encryption keys from
+    the key-generating key and the 96-bit nonce. The batch calls derive the
+    keys of AES_LANES messages in one run of the batched kernel and expand
+    the message keys forward only, so the per-message cost is a handful of
+    kernel lanes and one key expansion. The CTR pass (32-bit little-endian
+    counter) runs AES_LANES blocks per call, the tag is POLYVAL over the AAD,
+    the plaintext and their lengths.
+*/
+
+#define GCM_SIV_MAX_LEN ((uint64_t)1 << 36) //plaintext and AAD limit in bytes
+
+typedef struct aes_gcm_siv_msg
+{
+    const uint8_t *nonce; //12 bytes
+    const uint8_t *aad;
+    size_t aad_len;
+    const uint8_t *in;
+    uint8_t *out;         //may equal in
+    size_t len;
+    uint8_t *tag;         //16 bytes, written on seal and checked on open
+    int status;           //set by the batch calls: 0 ok, -1 bad length or tag
+}AES_GCM_SIV_MSG;
+
+/*-------------------------------------------------------------------------
+                Per-message key derivation for up to AES_LANES nonces
+ pre: kgk expanded as type 0 (128) or 2 (256).
+ post: auth[i] (16 bytes) and enc[i] (16 or 32 bytes) for each nonce.
+-------------------------------------------------------------------------*/
+static void gcm_siv_derive(const AES_CTX *kgk, uint8_t type, const uint8_t **nonces, size_t n, uint8_t auth[][16], uint8_t enc[][32])
+{
+    uint8_t buf[AES_LANES*6*AES_BLOCK];
+    uint8_t nb = type == 2? 6 : 4, *b;
+
+    for(size_t m = 0; m < n; m++)
+    {
+        for(uint8_t i = 0; i < nb; i++)
+        {
+            b = buf + AES_BLOCK*(m*nb + i);
+            b[0] = i; b[1] = 0; b[2] = 0; b[3] = 0;
+            memcpy(b + 4, nonces[m], 12);
+        }
+    }
+    aes_encrypt_blocks(kgk, buf, buf, n*nb);
+
+    //the first 8 bytes of each output block
+    for(size_t m = 0; m < n; m++)
+    {
+        b = buf + AES_BLOCK*m*nb;
+        memcpy(auth[m], b, 8);
+        memcpy(auth[m] + 8, b + AES_BLOCK, 8);
+        for(uint8_t i = 2; i < nb; i++)
+            memcpy(enc[m] + 8*(i - 2), b + AES_BLOCK*i, 8);
+    }
+    memset(buf, 0, sizeof(buf));
+}
+
+/*-------------------------------------------------------------------------
+                CTR with a 32-bit little-endian counter
+ the counter block is the tag with its top bit set.
+-------------------------------------------------------------------------*/
+static void gcm_siv_ctr(const AES_CTX *ctx, const uint8_t *tag, const uint8_t *in, uint8_t *out, size_t len)
+{
+    uint8_t ks[AES_LANES*AES_BLOCK], cb[AES_BLOCK];
+    uint32_t ctr;
+    size_t lanes, n;
+
+    memcpy(cb, tag, AES_BLOCK);
+    cb[15] |= 0x80;
+    ctr = (uint32_t)cb[0] | ((uint32_t)cb[1] << 8) | ((uint32_t)cb[2] << 16) | ((uint32_t)cb[3] << 24);
+
+    while(len > 0)
+    {
+        lanes = (len + AES_BLOCK - 1) / AES_BLOCK;
+        lanes = lanes < AES_LANES? lanes : AES_LANES;
+        for(size_t l = 0; l < lanes; l++, ctr++)
+        {
+            memcpy(ks + AES_BLOCK*l, cb, AES_BLOCK);
+            ks[AES_BLOCK*l]     = (uint8_t)ctr;
+            ks[AES_BLOCK*l + 1] = (uint8_t)(ctr >> 8);
+            ks[AES_BLOCK*l + 2] = (uint8_t)(ctr >> 16);
+            ks[AES_BLOCK*l + 3] = (uint8_t)(ctr >> 24);
+        }
+        aes_encrypt_lanes(ctx, ks, ks, lanes);
+
+        n = lanes*AES_BLOCK < len? lanes*AES_BLOCK : len;
+        for(size_t i = 0; i < n; i++)
+            out[i] = in[i] ^ ks[i];
+        in += n;
+        out += n;
+        len -= n;
+    }
+}
+
+/*-------------------------------------------------------------------------
+        Tag = E(enc, POLYVAL(auth, AAD || P || lengths) ^ nonce, msb cleared)
+-------------------------------------------------------------------------*/
+static void gcm_siv_tag(const AES_CTX *ek, const uint8_t *auth, const AES_GCM_SIV_MSG *m, const uint8_t *pt, uint8_t *tag)
+{
+    POLYVAL_CTX pv;
+    uint8_t lb[AES_BLOCK];
+
+    polyval_init(&pv, auth);
+    polyval_update_padded(&pv, m->aad, m->aad_len);
+    polyval_update_padded(&pv, pt, m->len);
+    store64_le(lb, (uint64_t)m->aad_len * 8);
+    store64_le(lb + 8, (uint64_t)m->len * 8);
+    polyval_update(&pv, lb, 1);
+    polyval_final(&pv, tag);
+
+    for(uint8_t i = 0; i < 12; i++)
+        tag[i] ^= m->nonce[i];
+    tag[15] &= 0x7f;
+    aes_encrypt_block(ek, tag, tag);
+    memset(&pv, 0, sizeof(pv));
+}
+
+/*-------------------------------------------------------------------------
+                    Seal / open one message with derived keys
+-------------------------------------------------------------------------*/
+static int gcm_siv_one(const uint8_t *auth, const uint8_t *enc, uint8_t type, AES_GCM_SIV_MSG *m, bool open)
+{
+    uint8_t expect[AES_BLOCK], diff = 0;
+    AES_CTX ek;
+
+    if((uint64_t)m->len > GCM_SIV_MAX_LEN || (uint64_t)m->aad_len > GCM_SIV_MAX_LEN)
+        return -1;
+    aes_setkey_enc(&ek, enc, type);
+
+    if(!open)
+    {
+        gcm_siv_tag(&ek, auth, m, m->in, m->tag);
+        gcm_siv_ctr(&ek, m->tag, m->in, m->out, m->len);
+        aes_ctx_wipe(&ek);
+        return 0;
+    }
+
+    gcm_siv_ctr(&ek, m->tag, m->in, m->out, m->len);
+    gcm_siv_tag(&ek, auth, m, m->out, expect);
+    aes_ctx_wipe(&ek);
+    for(uint8_t i = 0; i < AES_BLOCK; i++)
+        diff |= expect[i] ^ m->tag[i];
+    if(diff != 0)
+    {
+        memset(m->out, 0, m->len);
+        return -1;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                        GCM-SIV BATCH
+ pre: n messages under the key-generating key kgk (type 0 or 2).
+ post: msgs[i].status set, key derivation runs AES_LANES messages per call.
+-------------------------------------------------------------------------*/
+static void gcm_siv_batch(const AES_CTX *kgk, uint8_t type, AES_GCM_SIV_MSG *msgs, size_t n, bool open)
+{
+    const uint8_t *nonces[AES_LANES];
+    uint8_t auth[AES_LANES][16], enc[AES_LANES][32];
+    size_t k;
+
+    for(size_t base = 0; base < n; base += k)
+    {
+        k = n - base < AES_LANES? n - base : AES_LANES;
+        for(size_t m = 0; m < k; m++)
+            nonces[m] = msgs[base + m].nonce;
+        gcm_siv_derive(kgk, type, nonces, k, auth, enc);
+        for(size_t m = 0; m < k; m++)
+            msgs[base + m].status = gcm_siv_one(auth[m], enc[m], type, &msgs[base + m], open);
+    }
+    memset(auth, 0, sizeof(auth));
+    memset(enc, 0, sizeof(enc));
+}
+
+void aes_gcm_siv_seal_batch(const AES_CTX *kgk, uint8_t type, AES_GCM_SIV_MSG *msgs, size_t n)
+{
+    gcm_siv_batch(kgk, type, msgs, n, false);
+}
+
+void aes_gcm_siv_open_batch(const AES_CTX *kgk, uint8_t type, AES_GCM_SIV_MSG *msgs, size_t n)
+{
+    gcm_siv_batch(kgk, type, msgs, n, true);
+}
+
+/*-------------------------------------------------------------------------
+                        GCM-SIV SINGLE MESSAGE
+ post: returns 0, or -1 on a length over 2^36 bytes or (open) a tag mismatch,
+       in which case out is wiped.
+-------------------------------------------------------------------------*/
+int aes_gcm_siv_seal(const AES_CTX *kgk, uint8_t type, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+                     const uint8_t *in, uint8_t *out, size_t len, uint8_t *tag)
+{
+    AES_GCM_SIV_MSG m = {nonce, aad, aad_len, in, out, len, tag, 0};
+
+    gcm_siv_batch(kgk, type, &m, 1, false);
+    return m.status;
+}
+
+int aes_gcm_siv_open(const AES_CTX *kgk, uint8_t type, const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+                     const uint8_t *in, uint8_t *out, size_t len, const uint8_t *tag)
+{
+    AES_GCM_SIV_MSG m = {nonce, aad, aad_len, in, out, len, (uint8_t*)tag, 0};
+
+    gcm_siv_batch(kgk, type, &m, 1, true);
+    return m.status;
+}
+
+#endif /* aes_gcm_siv_h */
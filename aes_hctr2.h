@@ -0,0 +1,247 @@
+#ifndef aes_hctr2_h
+#define aes_hctr2_h
+#include "aes_block.h"
+#include "aes_polyval.h"
+
+/*
+    HCTR2 length-preserving tweakable encryption (Crowley, Huckleberry,
+    Biggers 2021), the mode Linux fscrypt uses for filenames.
+
+    A message P = M || N of at least one block is encrypted as
+        MM = M ^ H(T, N), UU = E(MM), S = MM ^ UU ^ L,
+        V = N ^ XCTR(S), U = UU ^ H(T, V)
+    with H the POLYVAL hash under h = E(0), L = E(1) and XCTR block i equal
+    to E(S ^ le(i)) from i = 1. Any change to the ciphertext scrambles the
+    whole plaintext. h and L are computed at key setup, and POLYVAL uses
+    carry-less multiply when built with -mpclmul, else the portable path.
+
+    The hash state after the length block and the tweak is the same for
+    both hashes of a message and is computed once. The batch calls run the
+    block-cipher steps of up to AES_LANES records together and pack the
+    XCTR blocks of consecutive records into the same kernel passes, so many
+    short names do not each run a mostly empty pass.
+*/
+
+typedef struct aes_hctr2_ctx
+{
+    AES_CTX aes;
+    POLYVAL_CTX poly; //keyed with h = E(0)
+    uint8_t l[16];    //L = E(1)
+}AES_HCTR2_CTX;
+
+typedef struct aes_hctr2_rec
+{
+    const uint8_t *tweak;
+    size_t tlen;
+    const uint8_t *in;
+    uint8_t *out;         //may equal in
+    size_t len;           //at least 16
+    int status;           //0 ok, -1 shorter than a block
+}AES_HCTR2_REC;
+
+typedef struct hctr2_lane
+{
+    AES_HCTR2_REC *rec;
+    POLYVAL_CTX th;       //after the length block and the tweak
+    uint8_t mm[16], uu[16], s[16];
+}HCTR2_LANE;
+
+/*-------------------------------------------------------------------------
+                            HCTR2 Key Setup
+ pre: type (0) 128, (1) 192, (2) 256.
+-------------------------------------------------------------------------*/
+void aes_hctr2_setkey(AES_HCTR2_CTX *ctx, const uint8_t *key, uint8_t type)
+{
+    uint8_t h[AES_BLOCK];
+
+    aes_setkey(&ctx->aes, key, type);
+    memset(h, 0, AES_BLOCK);
+    memset(ctx->l, 0, AES_BLOCK);
+    ctx->l[0] = 1;
+    aes_encrypt_block(&ctx->aes, h, h);
+    aes_encrypt_block(&ctx->aes, ctx->l, ctx->l);
+    polyval_init(&ctx->poly, h);
+    memset(h, 0, AES_BLOCK);
+}
+
+/*-------------------------------------------------------------------------
+            Hash state over le(2|T| + 2 + (|N| mod 16 != 0)) || pad(T)
+-------------------------------------------------------------------------*/
+static void hctr2_tweak(const AES_HCTR2_CTX *ctx, const uint8_t *tweak, size_t tlen, size_t nlen, POLYVAL_CTX *th)
+{
+    uint8_t blk[AES_BLOCK];
+
+    *th = ctx->poly;
+    memset(blk, 0, AES_BLOCK);
+    store64_le(blk, (uint64_t)tlen * 16 + 2 + (nlen % AES_BLOCK != 0));
+    polyval_update(th, blk, 1);
+    polyval_update_padded(th, tweak, tlen);
+}
+
+/*-------------------------------------------------------------------------
+            H(T, X): the tweak state over X, or pad(X || 1) if partial
+-------------------------------------------------------------------------*/
+static void hctr2_hash(const POLYVAL_CTX *th, const uint8_t *x, size_t len, uint8_t *out)
+{
+    uint8_t blk[AES_BLOCK];
+    POLYVAL_CTX c = *th;
+
+    polyval_update(&c, x, len / AES_BLOCK);
+    if(len % AES_BLOCK)
+    {
+        memset(blk, 0, AES_BLOCK);
+        memcpy(blk, x + len - len % AES_BLOCK, len % AES_BLOCK);
+        blk[len % AES_BLOCK] = 0x01;
+        polyval_update(&c, blk, 1);
+    }
+    polyval_final(&c, out);
+}
+
+/*-------------------------------------------------------------------------
+            XCTR over the tails of a group, packed across records
+ out[16..] = in[16..] ^ E(S ^ le(1)) || E(S ^ le(2)) ...
+-------------------------------------------------------------------------*/
+static void hctr2_xctr(const AES_HCTR2_CTX *ctx, HCTR2_LANE *lane, size_t cnt)
+{
+    uint8_t ks[AES_LANES*AES_BLOCK];
+    size_t owner[AES_LANES], off[AES_LANES];
+    size_t r = 0, pos = AES_BLOCK, lanes, take;
+    uint64_t i;
+
+    while(r < cnt && lane[r].rec->len == AES_BLOCK) r++;
+    while(r < cnt)
+    {
+        lanes = 0;
+        while(lanes < AES_LANES && r < cnt)
+        {
+            i = pos / AES_BLOCK;
+            memcpy(ks + AES_BLOCK*lanes, lane[r].s, AES_BLOCK);
+            store64_le(ks + AES_BLOCK*lanes, load64_le(lane[r].s) ^ i);
+            owner[lanes] = r;
+            off[lanes] = pos;
+            lanes++;
+            pos += AES_BLOCK;
+            if(pos >= lane[r].rec->len)
+            {
+                pos = AES_BLOCK;
+                r++;
+                while(r < cnt && lane[r].rec->len == AES_BLOCK) r++;
+            }
+        }
+        aes_encrypt_lanes(&ctx->aes, ks, ks, lanes);
+        for(size_t l = 0; l < lanes; l++)
+        {
+            const AES_HCTR2_REC *rec = lane[owner[l]].rec;
+            take = rec->len - off[l];
+            take = take < AES_BLOCK? take : AES_BLOCK;
+            for(size_t b = 0; b < take; b++)
+                rec->out[off[l] + b] = rec->in[off[l] + b] ^ ks[AES_BLOCK*l + b];
+        }
+    }
+}
+
+/*-------------------------------------------------------------------------
+                    HCTR2 over up to AES_LANES records
+ encrypt: MM = M ^ H(T, N), UU = E(MM), V = N ^ XCTR(S), U = UU ^ H(T, V)
+ decrypt: UU = U ^ H(T, V), MM = D(UU), N = V ^ XCTR(S), M = MM ^ H(T, N)
+-------------------------------------------------------------------------*/
+static void hctr2_lanes(const AES_HCTR2_CTX *ctx, HCTR2_LANE *lane, size_t cnt, bool decrypt)
+{
+    uint8_t buf[AES_LANES*AES_BLOCK], hash[AES_BLOCK];
+
+    for(size_t l = 0; l < cnt; l++)
+    {
+        AES_HCTR2_REC *rec = lane[l].rec;
+        hctr2_tweak(ctx, rec->tweak, rec->tlen, rec->len - AES_BLOCK, &lane[l].th);
+        hctr2_hash(&lane[l].th, rec->in + AES_BLOCK, rec->len - AES_BLOCK, hash);
+        xor_block(buf + AES_BLOCK*l, rec->in, hash);
+    }
+    if(decrypt)
+    {
+        for(size_t l = 0; l < cnt; l++)
+            memcpy(lane[l].uu, buf + AES_BLOCK*l, AES_BLOCK);
+        aes_decrypt_lanes(&ctx->aes, buf, buf, cnt);
+        for(size_t l = 0; l < cnt; l++)
+            memcpy(lane[l].mm, buf + AES_BLOCK*l, AES_BLOCK);
+    }
+    else
+    {
+        for(size_t l = 0; l < cnt; l++)
+            memcpy(lane[l].mm, buf + AES_BLOCK*l, AES_BLOCK);
+        aes_encrypt_lanes(&ctx->aes, buf, buf, cnt);
+        for(size_t l = 0; l < cnt; l++)
+            memcpy(lane[l].uu, buf + AES_BLOCK*l, AES_BLOCK);
+    }
+    for(size_t l = 0; l < cnt; l++)
+    {
+        xor_block(lane[l].s, lane[l].mm, lane[l].uu);
+        xor_block(lane[l].s, lane[l].s, ctx->l);
+    }
+
+    hctr2_xctr(ctx, lane, cnt);
+
+    for(size_t l = 0; l < cnt; l++)
+    {
+        AES_HCTR2_REC *rec = lane[l].rec;
+        hctr2_hash(&lane[l].th, rec->out + AES_BLOCK, rec->len - AES_BLOCK, hash);
+        xor_block(rec->out, decrypt? lane[l].mm : lane[l].uu, hash);
+        rec->status = 0;
+    }
+}
+
+/*-------------------------------------------------------------------------
+                            HCTR2 BATCH
+ post: recs[i].status set, records of at least one block processed.
+-------------------------------------------------------------------------*/
+static void hctr2_batch(const AES_HCTR2_CTX *ctx, AES_HCTR2_REC *recs, size_t n, bool decrypt)
+{
+    HCTR2_LANE lane[AES_LANES];
+    size_t next = 0, cnt;
+
+    while(next < n)
+    {
+        cnt = 0;
+        while(cnt < AES_LANES && next < n)
+        {
+            recs[next].status = -1;
+            if(recs[next].len >= AES_BLOCK)
+                lane[cnt++].rec = &recs[next];
+            next++;
+        }
+        if(cnt > 0)
+            hctr2_lanes(ctx, lane, cnt, decrypt);
+    }
+}
+
+void aes_hctr2_encrypt_batch(const AES_HCTR2_CTX *ctx, AES_HCTR2_REC *recs, size_t n)
+{
+    hctr2_batch(ctx, recs, n, false);
+}
+
+void aes_hctr2_decrypt_batch(const AES_HCTR2_CTX *ctx, AES_HCTR2_REC *recs, size_t n)
+{
+    hctr2_batch(ctx, recs, n, true);
+}
+
+/*-------------------------------------------------------------------------
+                        HCTR2 SINGLE RECORD
+ pre: len at least 16, out may equal in.
+ post: returns 0, or -1 if len is shorter than a block.
+-------------------------------------------------------------------------*/
+int aes_hctr2_encrypt(const AES_HCTR2_CTX *ctx, const uint8_t *tweak, size_t tlen, const uint8_t *in, uint8_t *out, size_t len)
+{
+    AES_HCTR2_REC r = {tweak, tlen, in, out, len, 0};
+
+    hctr2_batch(ctx, &r, 1, false);
+    return r.status;
+}
+
+int aes_hctr2_decrypt(const AES_HCTR2_CTX *ctx, const uint8_t *tweak, size_t tlen, const uint8_t *in, uint8_t *out, size_t len)
+{
+    AES_HCTR2_REC r = {tweak, tlen, in, out, len, 0};
+
+    hctr2_batch(ctx, &r, 1, true);
+    return r.status;
+}
+
+#endif /* aes_hctr2_h */
@@ -0,0 +1,148 @@
+#ifndef aes_iov_h
+#define aes_iov_h
+#include <sys/uio.h>
+#include "aes_stream.h"
+
+/*
+    Scatter-gather encryption over iovec chains, on top of the streaming
+    context (ECB, CBC, CTR, PKCS#7 padding as set on the context).
+
+    The input is walked fragment by fragment, and each step hands
+    aes_stream_update the longest run that fits both the current input
+    fragment and the room left in the current output fragment. So whole
+    blocks go from the caller's fragments straight to the bulk kernels.
+    The context's partial-block buffer handles a block split across input
+    fragments. Only a block split across output fragments is written
+    through a 16-byte bounce buffer and scattered. Nothing is linearized.
+*/
+
+typedef struct iov_cur
+{
+    const struct iovec *v;
+    size_t n, i, off; //fragments, current fragment, offset in it
+}IOV_CUR;
+
+/*-------------------------------------------------------------------------
+                Contiguous bytes at the cursor, skipping empty fragments
+-------------------------------------------------------------------------*/
+static size_t iov_run(IOV_CUR *c)
+{
+    while(c->i < c->n && c->off == c->v[c->i].iov_len)
+    {
+        c->i++;
+        c->off = 0;
+    }
+    return c->i < c->n? c->v[c->i].iov_len - c->off : 0;
+}
+
+static inline uint8_t *iov_ptr(const IOV_CUR *c)
+{
+    return (uint8_t*)c->v[c->i].iov_base + c->off;
+}
+
+/*-------------------------------------------------------------------------
+                    Scatter len bytes at the cursor
+ post: returns false if the chain runs out.
+-------------------------------------------------------------------------*/
+static bool iov_scatter(IOV_CUR *c, const uint8_t *src, size_t len)
+{
+    size_t room, take;
+
+    while(len > 0)
+    {
+        room = iov_run(c);
+        if(room == 0)
+            return false;
+        take = len < room? len : room;
+        memcpy(iov_ptr(c), src, take);
+        c->off += take;
+        src += take;
+        len -= take;
+    }
+    return true;
+}
+
+/*-------------------------------------------------------------------------
+                Input bytes that produce at most room bytes of output
+-------------------------------------------------------------------------*/
+static size_t iov_fit(const AES_STREAM *s, size_t room)
+{
+    size_t k = room / AES_BLOCK;
+
+    if(s->mode == AES_MODE_CTR)
+        return room;
+    //update emits whole blocks, one held back when unpadding
+    return AES_BLOCK*(k + 1) - s->n - (s->decrypt && s->padding? 0 : 1);
+}
+
+static int iov_update(AES_STREAM *s, IOV_CUR *in, IOV_CUR *out, size_t *outl)
+{
+    uint8_t bounce[AES_BLOCK];
+    size_t run, room, r, ol;
+
+    while((run = iov_run(in)) > 0)
+    {
+        room = iov_run(out);
+        if(s->mode == AES_MODE_CTR && room == 0)
+            return -1;
+        if(s->mode == AES_MODE_CTR || room >= AES_BLOCK)
+        {
+            r = iov_fit(s, room);
+            r = r < run? r : run;
+            aes_stream_update(s, iov_ptr(in), r, iov_ptr(out), &ol);
+            out->off += ol;
+        }
+        else
+        {
+            //the next block straddles output fragments: feed up to it, bounce it
+            r = iov_fit(s, 0) + 1;
+            r = r < run? r : run;
+            aes_stream_update(s, iov_ptr(in), r, bounce, &ol);
+            if(!iov_scatter(out, bounce, ol))
+                return -1;
+        }
+        in->off += r;
+        *outl += ol;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                        SCATTER-GATHER UPDATE
+ pre: the out chain has room for the input plus one block; out must not
+      overlap in unless the mode is CTR.
+ post: returns 0, or -1 if the out chain is too short. *outl bytes written
+       from the start of out.
+-------------------------------------------------------------------------*/
+int aes_stream_updatev(AES_STREAM *s, const struct iovec *in, size_t nin, const struct iovec *out, size_t nout, size_t *outl)
+{
+    IOV_CUR ci = {in, nin, 0, 0}, co = {out, nout, 0, 0};
+
+    *outl = 0;
+    return iov_update(s, &ci, &co, outl);
+}
+
+/*-------------------------------------------------------------------------
+                    SCATTER-GATHER ONE SHOT (update + final)
+ post: returns 0, or -1 if the out chain is too short or final fails
+       (length or padding). *outl bytes written from the start of out.
+-------------------------------------------------------------------------*/
+int aes_stream_cryptv(AES_STREAM *s, const struct iovec *in, size_t nin, const struct iovec *out, size_t nout, size_t *outl)
+{
+    IOV_CUR ci = {in, nin, 0, 0}, co = {out, nout, 0, 0};
+    uint8_t last[AES_BLOCK];
+    size_t ol;
+
+    *outl = 0;
+    if(iov_update(s, &ci, &co, outl) != 0)
+        return -1;
+    if(aes_stream_final(s, last, &ol) != 0)
+        return -1;
+    if(!iov_scatter(&co, last, ol))
+        return -1;
+    *outl += ol;
+    memset(last, 0, AES_BLOCK);
+    return 0;
+}
+
+#endif /* aes_iov_h */
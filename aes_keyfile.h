@@ -0,0 +1,81 @@
+#ifndef aes_keyfile_h
+#define aes_keyfile_h
+#include <ctype.h>
+#include "aes.h"
+
+/*
+    Key loading for the command line tools. A key is given in hex on the
+    command line, in a hex key file or in a raw key file; the caller says
+    which, so a file is never read as raw or hex depending on its size.
+*/
+
+/*-------------------------------------------------------------------------
+                    Hex string to a 16, 24 or 32-byte key
+ post: returns 0, or -1 unless hex is exactly 32, 48 or 64 hex digits.
+-------------------------------------------------------------------------*/
+static inline int aes_hex_nibble(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    c = (char)tolower((unsigned char)c);
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+int aes_key_from_hex(const char *hex, uint8_t *key, size_t *klen)
+{
+    size_t n = strlen(hex);
+    int hi, lo;
+
+    if(n != 32 && n != 48 && n != 64)
+        return -1;
+    for(size_t i = 0; i < n / 2; i++)
+    {
+        hi = aes_hex_nibble(hex[2*i]);
+        lo = aes_hex_nibble(hex[2*i + 1]);
+        if(hi < 0 || lo < 0)
+            return -1;
+        key[i] = (uint8_t)(hi << 4 | lo);
+    }
+    *klen = n / 2;
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                                KEY FILE
+ pre: raw selects a file of exactly 16, 24 or 32 key bytes; otherwise the
+      file holds the key in hex, optionally followed by white space.
+ post: returns 0, or -1 if the file cannot be read or holds no valid key.
+-------------------------------------------------------------------------*/
+int aes_key_from_file(const char *file, bool raw, uint8_t *key, size_t *klen)
+{
+    char buf[130];
+    size_t n;
+    int rc = -1;
+    FILE *f;
+
+    f = fopen(file, "rb");
+    if(f == NULL)
+        return -1;
+    n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    if(raw)
+    {
+        if(n == 16 || n == 24 || n == 32)
+        {
+            memcpy(key, buf, n);
+            *klen = n;
+            rc = 0;
+        }
+    }
+    else
+    {
+        while(n > 0 && isspace((unsigned char)buf[n-1]))
+            n--;
+        buf[n] = 0;
+        rc = aes_key_from_hex(buf, key, klen);
+    }
+    memset(buf, 0, sizeof(buf));
+    return rc;
+}
+
+#endif /* aes_keyfile_h */
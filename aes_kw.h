@@ -0,0 +1,268 @@
+#ifndef aes_kw_h
+#define aes_kw_h
+#include "aes_block.h"
+
+/*
+    AES Key Wrap (RFC 3394) and Key Wrap with Padding (RFC 5649).
+
+    The key-encryption key is expanded once into an AES_CTX and reused for
+    every wrap and unwrap, instead of running KeyExpansion per block as
+    aes_decrypt does. Each wrapped key is a serial chain of 6n cipher calls,
+    so the batch calls interleave up to AES_LANES independent keys, one step
+    of each per kernel pass, and refill a lane as soon as its key is done.
+*/
+
+typedef struct aes_kw_job
+{
+    const uint8_t *in;
+    size_t in_len;
+    uint8_t *out;   //in_len + 8 (wrap, KWP rounded up to 8) or in_len - 8 bytes (unwrap)
+    size_t out_len; //set on success
+    bool pad;       //RFC 5649 KWP instead of RFC 3394 KW
+    int status;     //0 ok, -1 bad length or integrity check failed
+}AES_KW_JOB;
+
+typedef struct kw_lane
+{
+    AES_KW_JOB *job;
+    uint8_t a[8];    //integrity register A
+    uint8_t *r;      //R[1..n], in the output buffer
+    size_t n, s;     //64-bit blocks, steps done out of 6n
+    bool single;     //KWP with n == 1: one plain ECB block
+}KW_LANE;
+
+static const uint8_t kw_iv[8] = {0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6, 0xa6};
+static const uint8_t kwp_iv[4] = {0xa6, 0x59, 0x59, 0xa6};
+
+/*-------------------------------------------------------------------------
+                    Load a job into a lane
+ post: returns false (status -1) if the lengths are not valid.
+-------------------------------------------------------------------------*/
+static bool kw_load(KW_LANE *ln, AES_KW_JOB *job, bool unwrap)
+{
+    size_t len = job->in_len, n;
+
+    ln->job = job;
+    ln->s = 0;
+    job->status = -1;
+    job->out_len = 0;
+    if(!unwrap)
+    {
+        if(job->pad)
+        {
+            if(len == 0 || (uint64_t)len > 0xffffffffULL) return false;
+            n = (len + 7) / 8;
+            memcpy(ln->a, kwp_iv, 4);
+            for(uint8_t i = 0; i < 4; i++) ln->a[4 + i] = (uint8_t)(len >> (24 - 8*i));
+            memmove(job->out + 8, job->in, len);
+            memset(job->out + 8 + len, 0, 8*n - len);
+        }
+        else
+        {
+            if(len % 8 || len < 16) return false;
+            n = len / 8;
+            memcpy(ln->a, kw_iv, 8);
+            memmove(job->out + 8, job->in, len);
+        }
+        ln->r = job->out + 8;
+    }
+    else
+    {
+        if(len % 8 || len < (job->pad? 16 : 24)) return false;
+        n = len / 8 - 1;
+        memcpy(ln->a, job->in, 8);
+        memmove(job->out, job->in + 8, 8*n);
+        ln->r = job->out;
+    }
+    ln->n = n;
+    ln->single = job->pad && n == 1;
+    return true;
+}
+
+/*-------------------------------------------------------------------------
+                Gather the next step of a lane into blk
+ wrap step s: j = s / n, i = s % n + 1, B = E(A || R[i])
+ unwrap step s: j = 5 - s / n, i = n - s % n, B = D(A ^ t || R[i])
+-------------------------------------------------------------------------*/
+static void kw_gather(const KW_LANE *ln, uint8_t *blk, bool unwrap)
+{
+    size_t i, j;
+    uint64_t t;
+
+    if(ln->single)
+    {
+        memcpy(blk, ln->a, 8);
+        memcpy(blk + 8, ln->r, 8);
+        return;
+    }
+    j = unwrap? 5 - ln->s / ln->n : ln->s / ln->n;
+    i = unwrap? ln->n - ln->s % ln->n : ln->s % ln->n + 1;
+    memcpy(blk, ln->a, 8);
+    if(unwrap)
+    {
+        t = (uint64_t)ln->n * j + i;
+        for(uint8_t b = 0; b < 8; b++)
+            blk[7 - b] ^= (uint8_t)(t >> (8*b));
+    }
+    memcpy(blk + 8, ln->r + 8*(i - 1), 8);
+}
+
+/*-------------------------------------------------------------------------
+                    Scatter a step, returns true when done
+-------------------------------------------------------------------------*/
+static bool kw_scatter(KW_LANE *ln, const uint8_t *blk, bool unwrap)
+{
+    size_t i, j;
+    uint64_t t;
+
+    if(ln->single)
+    {
+        memcpy(ln->a, blk, 8);
+        memcpy(ln->r, blk + 8, 8);
+        return true;
+    }
+    j = unwrap? 5 - ln->s / ln->n : ln->s / ln->n;
+    i = unwrap? ln->n - ln->s % ln->n : ln->s % ln->n + 1;
+    memcpy(ln->a, blk, 8);
+    if(!unwrap)
+    {
+        t = (uint64_t)ln->n * j + i;
+        for(uint8_t b = 0; b < 8; b++)
+            ln->a[7 - b] ^= (uint8_t)(t >> (8*b));
+    }
+    memcpy(ln->r + 8*(i - 1), blk + 8, 8);
+    return ++ln->s == 6*ln->n;
+}
+
+/*-------------------------------------------------------------------------
+                    Finish a lane: output A or check it
+-------------------------------------------------------------------------*/
+static void kw_finish(KW_LANE *ln, bool unwrap)
+{
+    AES_KW_JOB *job = ln->job;
+    uint8_t diff = 0;
+    uint32_t mli;
+    size_t n = ln->n;
+
+    if(!unwrap)
+    {
+        memcpy(job->out, ln->a, 8);
+        job->out_len = 8*(n + 1);
+        job->status = 0;
+        return;
+    }
+
+    if(!job->pad)
+    {
+        for(uint8_t b = 0; b < 8; b++)
+            diff |= ln->a[b] ^ kw_iv[b];
+        job->out_len = 8*n;
+    }
+    else
+    {
+        for(uint8_t b = 0; b < 4; b++)
+            diff |= ln->a[b] ^ kwp_iv[b];
+        mli = ((uint32_t)ln->a[4] << 24) | ((uint32_t)ln->a[5] << 16) | ((uint32_t)ln->a[6] << 8) | ln->a[7];
+        if(mli <= 8*(n - 1) || mli > 8*n)
+            diff |= 1;
+        else
+            for(size_t b = mli; b < 8*n; b++)
+                diff |= ln->r[b];
+        job->out_len = mli;
+    }
+    if(diff != 0)
+    {
+        memset(job->out, 0, 8*n);
+        job->out_len = 0;
+        return;
+    }
+    job->status = 0;
+}
+
+/*-------------------------------------------------------------------------
+                        KEY WRAP BATCH
+ post: jobs[i].status and out_len set.
+-------------------------------------------------------------------------*/
+static void kw_batch(const AES_CTX *kek, AES_KW_JOB *jobs, size_t n, bool unwrap)
+{
+    uint8_t buf[AES_LANES*AES_BLOCK];
+    KW_LANE lane[AES_LANES];
+    size_t next = 0, active = 0;
+
+    for(;;)
+    {
+        while(active < AES_LANES && next < n)
+        {
+            if(kw_load(&lane[active], &jobs[next], unwrap))
+                active++;
+            next++;
+        }
+        if(active == 0)
+            break;
+
+        for(size_t l = 0; l < active; l++)
+            kw_gather(&lane[l], buf + AES_BLOCK*l, unwrap);
+        if(unwrap)
+            aes_decrypt_lanes(kek, buf, buf, active);
+        else
+            aes_encrypt_lanes(kek, buf, buf, active);
+
+        //retire finished keys, the last lane moves into the hole
+        for(size_t l = active; l-- > 0;)
+        {
+            if(kw_scatter(&lane[l], buf + AES_BLOCK*l, unwrap))
+            {
+                kw_finish(&lane[l], unwrap);
+                active--;
+                lane[l] = lane[active];
+            }
+        }
+    }
+}
+
+void aes_kw_wrap_batch(const AES_CTX *kek, AES_KW_JOB *jobs, size_t n)
+{
+    kw_batch(kek, jobs, n, false);
+}
+
+void aes_kw_unwrap_batch(const AES_CTX *kek, AES_KW_JOB *jobs, size_t n)
+{
+    kw_batch(kek, jobs, n, true);
+}
+
+/*-------------------------------------------------------------------------
+                        SINGLE KEY WRAP / UNWRAP
+ pre: kek expanded with aes_setkey (unwrap needs the inverse schedule).
+ post: returns 0, or -1 on a bad length or a failed integrity check. out_len
+       (KWP) receives the output length.
+-------------------------------------------------------------------------*/
+static int kw_one(const AES_CTX *kek, const uint8_t *in, size_t len, uint8_t *out, size_t *out_len, bool pad, bool unwrap)
+{
+    AES_KW_JOB job = {in, len, out, 0, pad, 0};
+
+    kw_batch(kek, &job, 1, unwrap);
+    if(out_len) *out_len = job.out_len;
+    return job.status;
+}
+
+int aes_kw_wrap(const AES_CTX *kek, const uint8_t *in, size_t len, uint8_t *out)
+{
+    return kw_one(kek, in, len, out, NULL, false, false);
+}
+
+int aes_kw_unwrap(const AES_CTX *kek, const uint8_t *in, size_t len, uint8_t *out)
+{
+    return kw_one(kek, in, len, out, NULL, false, true);
+}
+
+int aes_kwp_wrap(const AES_CTX *kek, const uint8_t *in, size_t len, uint8_t *out, size_t *out_len)
+{
+    return kw_one(kek, in, len, out, out_len, true, false);
+}
+
+int aes_kwp_unwrap(const AES_CTX *kek, const uint8_t *in, size_t len, uint8_t *out, size_t *out_len)
+{
+    return kw_one(kek, in, len, out, out_len, true, true);
+}
+
+#endif /* aes_kw_h */
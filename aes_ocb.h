@@ -0,0 +1,492 @@
+#ifndef aes_ocb_h
+#define aes_ocb_h
+#include "aes_block.h"
+#include "aes_cmac.h"
+
+/*
+    OCB3 authenticated encryption (RFC 7253).
+
+    L_*, L_$ and the table L_i = 2^i * L_$ * 2 are computed at key setup, so
+    the offset of block i is the previous offset XOR L_ntz(i). The offsets of
+    AES_LANES blocks are laid out first, then the pass goes through the
+    batched kernel: encryption through the cipher, decryption through the
+    equivalent inverse cipher. Authentication is a running XOR checksum of
+    the plaintext, no field multiplication.
+*/
+
+#define OCB_L_MAX 32 //L_0 to L_31, messages of up to 2^32 - 1 blocks
+#define OCB_MAX_BLOCKS (((uint64_t)1 << OCB_L_MAX) - 1)
+
+typedef struct aes_ocb_ctx
+{
+    AES_CTX aes;
+    uint8_t ls[16];            //L_*
+    uint8_t ld[16];            //L_$
+    uint8_t l[OCB_L_MAX][16];  //L_i
+    uint8_t taglen;            //bytes, 8 to 16
+}AES_OCB_CTX;
+
+/*-------------------------------------------------------------------------
+                            OCB Key Setup
+ pre: type (0) 128, (1) 192, (2) 256; taglen in bytes (8, 12 or 16).
+ post: returns 0, or -1 on a taglen outside 8 to 16.
+-------------------------------------------------------------------------*/
+int aes_ocb_setkey(AES_OCB_CTX *ctx, const uint8_t *key, uint8_t type, uint8_t taglen)
+{
+    if(taglen < 8 || taglen > AES_BLOCK) return -1;
+    aes_setkey(&ctx->aes, key, type);
+    memset(ctx->ls, 0, AES_BLOCK);
+    aes_encrypt_block(&ctx->aes, ctx->ls, ctx->ls);
+    cmac_dbl(ctx->ld, ctx->ls);
+    cmac_dbl(ctx->l[0], ctx->ld);
+    for(uint8_t i = 1; i < OCB_L_MAX; i++)
+        cmac_dbl(ctx->l[i], ctx->l[i-1]);
+    ctx->taglen = taglen;
+    return 0;
+}
+
+//the L table covers OCB_MAX_BLOCKS full blocks of data and of AAD
+static inline bool ocb_args_ok(const AES_OCB_CTX *ctx, uint8_t nlen, size_t alen, size_t len)
+{
+    return nlen >= 1 && nlen <= 15 && ctx->taglen >= 8 && ctx->taglen <= AES_BLOCK &&
+           (uint64_t)(len / AES_BLOCK) <= OCB_MAX_BLOCKS && (uint64_t)(alen / AES_BLOCK) <= OCB_MAX_BLOCKS;
+}
+
+/*-------------------------------------------------------------------------
+                    Number of trailing zeros of i > 0
+-------------------------------------------------------------------------*/
+static inline uint8_t ocb_ntz(uint64_t i)
+{
+    uint8_t n = 0;
+    while((i & 1) == 0)
+    {
+        i >>= 1;
+        n++;
+    }
+    return n;
+}
+
+/*-------------------------------------------------------------------------
+                            Offset_0 from the nonce
+ Nonce = taglen mod 128 (7 bits) || 0* || 1 || N, Ktop = E(Nonce, low 6
+ bits cleared), Offset_0 = (Ktop || Ktop[1..64] ^ Ktop[9..72]) << bottom.
+-------------------------------------------------------------------------*/
+static uint8_t ocb_nonce_block(const AES_OCB_CTX *ctx, const uint8_t *nonce, uint8_t nlen, uint8_t *n)
+{
+    uint8_t bottom;
+
+    memset(n, 0, AES_BLOCK);
+    n[0] = (uint8_t)(((ctx->taglen * 8) % 128) << 1);
+    n[15 - nlen] |= 0x01;
+    memcpy(n + 16 - nlen, nonce, nlen);
+    bottom = n[15] & 0x3f;
+    n[15] &= 0xc0;
+    return bottom;
+}
+
+static void ocb_stretch(const uint8_t *ktop, uint8_t bottom, uint8_t *off)
+{
+    uint8_t stretch[24], byte = bottom / 8, bit = bottom % 8;
+
+    memcpy(stretch, ktop, AES_BLOCK);
+    for(uint8_t i = 0; i < 8; i++)
+        stretch[16 + i] = stretch[i] ^ stretch[i + 1];
+    for(uint8_t i = 0; i < AES_BLOCK; i++)
+        off[i] = bit == 0? stretch[i + byte] :
+                 (uint8_t)((stretch[i + byte] << bit) | (stretch[i + byte + 1] >> (8 - bit)));
+}
+
+static void ocb_offset0(const AES_OCB_CTX *ctx, const uint8_t *nonce, uint8_t nlen, uint8_t *off)
+{
+    uint8_t n[AES_BLOCK], bottom;
+
+    bottom = ocb_nonce_block(ctx, nonce, nlen, n);
+    aes_encrypt_block(&ctx->aes, n, n);
+    ocb_stretch(n, bottom, off);
+}
+
+/*-------------------------------------------------------------------------
+                            HASH(K, A)
+-------------------------------------------------------------------------*/
+static void ocb_hash(const AES_OCB_CTX *ctx, const uint8_t *a, size_t alen, uint8_t *sum)
+{
+    uint8_t off[AES_BLOCK], buf[AES_LANES*AES_BLOCK];
+    size_t m = alen / AES_BLOCK, i = 0, lanes;
+
+    memset(off, 0, AES_BLOCK);
+    memset(sum, 0, AES_BLOCK);
+    while(i < m)
+    {
+        lanes = m - i < AES_LANES? m - i : AES_LANES;
+        for(size_t l = 0; l < lanes; l++)
+        {
+            xor_block(off, off, ctx->l[ocb_ntz(i + l + 1)]);
+            xor_block(buf + AES_BLOCK*l, a + AES_BLOCK*(i + l), off);
+        }
+        aes_encrypt_lanes(&ctx->aes, buf, buf, lanes);
+        for(size_t l = 0; l < lanes; l++)
+            xor_block(sum, sum, buf + AES_BLOCK*l);
+        i += lanes;
+    }
+    if(alen % AES_BLOCK)
+    {
+        xor_block(off, off, ctx->ls);
+        memset(buf, 0, AES_BLOCK);
+        memcpy(buf, a + m*AES_BLOCK, alen % AES_BLOCK);
+        buf[alen % AES_BLOCK] = 0x80;
+        xor_block(buf, buf, off);
+        aes_encrypt_block(&ctx->aes, buf, buf);
+        xor_block(sum, sum, buf);
+    }
+}
+
+/*-------------------------------------------------------------------------
+                    Full blocks of one message, AES_LANES at a time
+ post: out holds m blocks; off and sum are carried past them.
+-------------------------------------------------------------------------*/
+static void ocb_blocks(const AES_OCB_CTX *ctx, const uint8_t *in, uint8_t *out, size_t m, uint8_t *off, uint8_t *sum, bool decrypt)
+{
+    uint8_t offs[AES_LANES*AES_BLOCK], buf[AES_LANES*AES_BLOCK];
+    size_t i = 0, lanes;
+
+    while(i < m)
+    {
+        lanes = m - i < AES_LANES? m - i : AES_LANES;
+        for(size_t l = 0; l < lanes; l++)
+        {
+            xor_block(off, off, ctx->l[ocb_ntz(i + l + 1)]);
+            memcpy(offs + AES_BLOCK*l, off, AES_BLOCK);
+            xor_block(buf + AES_BLOCK*l, in + AES_BLOCK*(i + l), off);
+            if(!decrypt)
+                xor_block(sum, sum, in + AES_BLOCK*(i + l));
+        }
+        if(decrypt)
+            aes_decrypt_lanes(&ctx->aes, buf, buf, lanes);
+        else
+            aes_encrypt_lanes(&ctx->aes, buf, buf, lanes);
+        for(size_t l = 0; l < lanes; l++)
+        {
+            xor_block(out + AES_BLOCK*(i + l), buf + AES_BLOCK*l, offs + AES_BLOCK*l);
+            if(decrypt)
+                xor_block(sum, sum, out + AES_BLOCK*(i + l));
+        }
+        i += lanes;
+    }
+}
+
+/*-------------------------------------------------------------------------
+                    OCB core, both directions
+ post: out holds the ciphertext (plaintext), tag the computed tag.
+-------------------------------------------------------------------------*/
+static void ocb_crypt(const AES_OCB_CTX *ctx, const uint8_t *nonce, uint8_t nlen, const uint8_t *aad, size_t alen,
+                      const uint8_t *in, uint8_t *out, size_t len, uint8_t *tag, bool decrypt)
+{
+    uint8_t off[AES_BLOCK], sum[AES_BLOCK], pad[AES_BLOCK], buf[AES_BLOCK];
+    size_t m = len / AES_BLOCK, r = len % AES_BLOCK;
+
+    ocb_offset0(ctx, nonce, nlen, off);
+    memset(sum, 0, AES_BLOCK);
+    ocb_blocks(ctx, in, out, m, off, sum, decrypt);
+
+    if(r)
+    {
+        xor_block(off, off, ctx->ls);
+        aes_encrypt_block(&ctx->aes, off, pad);
+        memset(buf, 0, AES_BLOCK);
+        for(size_t b = 0; b < r; b++)
+        {
+            buf[b] = decrypt? in[m*AES_BLOCK + b] ^ pad[b] : in[m*AES_BLOCK + b];
+            out[m*AES_BLOCK + b] = in[m*AES_BLOCK + b] ^ pad[b];
+        }
+        buf[r] = 0x80;
+        xor_block(sum, sum, buf);
+    }
+
+    //Tag = E(Checksum ^ Offset ^ L_$) ^ HASH(K, A)
+    xor_block(sum, sum, off);
+    xor_block(sum, sum, ctx->ld);
+    aes_encrypt_block(&ctx->aes, sum, tag);
+    ocb_hash(ctx, aad, alen, pad);
+    xor_block(tag, tag, pad);
+}
+
+/*-------------------------------------------------------------------------
+                        OCB ENCRYPTION / DECRYPTION
+ pre: nonce of 1 to 15 bytes, out may equal in.
+ post: returns 0, or -1 on a bad nonce length, data or AAD over
+       OCB_MAX_BLOCKS blocks, or (decryption) a tag that does not match, in
+       which case out is wiped.
+-------------------------------------------------------------------------*/
+int aes_ocb_encrypt(const AES_OCB_CTX *ctx, const uint8_t *nonce, uint8_t nlen, const uint8_t *aad, size_t alen,
+                    const uint8_t *in, uint8_t *out, size_t len, uint8_t *tag)
+{
+    uint8_t full[AES_BLOCK];
+
+    if(!ocb_args_ok(ctx, nlen, alen, len)) return -1;
+    ocb_crypt(ctx, nonce, nlen, aad, alen, in, out, len, full, false);
+    memcpy(tag, full, ctx->taglen);
+    return 0;
+}
+
+int aes_ocb_decrypt(const AES_OCB_CTX *ctx, const uint8_t *nonce, uint8_t nlen, const uint8_t *aad, size_t alen,
+                    const uint8_t *in, uint8_t *out, size_t len, const uint8_t *tag)
+{
+    uint8_t full[AES_BLOCK], diff = 0;
+
+    if(!ocb_args_ok(ctx, nlen, alen, len)) return -1;
+    ocb_crypt(ctx, nonce, nlen, aad, alen, in, out, len, full, true);
+    for(uint8_t i = 0; i < ctx->taglen; i++)
+        diff |= full[i] ^ tag[i];
+    if(diff != 0)
+    {
+        memset(out, 0, len);
+        return -1;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                        OCB MULTI-BUFFER BATCH
+ Messages go through in groups of OCB_GROUP. Each pass over a group lays
+ the blocks of one kind from every message end to end, AES_LANES to a
+ kernel call, so short packets still fill the lanes:
+     nonces    one block per message, skipped when the nonce shares Ktop
+               with the previous one (consecutive counters)
+     data      the full blocks of messages shorter than AES_LANES blocks;
+               a longer message fills the lanes by itself and goes
+               through them on its own, as aes_ocb_encrypt would
+     hash      AAD blocks and the pad of each partial last block
+     tags      one block per message
+-------------------------------------------------------------------------*/
+#define OCB_GROUP 64
+
+typedef struct aes_ocb_msg
+{
+    const uint8_t *nonce;
+    uint8_t nlen;         //1 to 15 bytes
+    const uint8_t *aad;
+    size_t aad_len;
+    const uint8_t *in;
+    uint8_t *out;         //may equal in
+    size_t len;
+    uint8_t *tag;         //taglen bytes, written on encryption and checked on decryption
+    int status;           //set by the batch calls: 0 ok, -1 bad length or tag
+}AES_OCB_MSG;
+
+typedef struct ocb_lanes
+{
+    uint8_t buf[AES_LANES*AES_BLOCK], offs[AES_LANES*AES_BLOCK];
+    size_t who[AES_LANES], blk[AES_LANES];
+    size_t fill;
+}OCB_LANES;
+
+typedef struct ocb_msg_state
+{
+    uint8_t off[AES_BLOCK], sum[AES_BLOCK], hash[AES_BLOCK];
+}OCB_MSG_STATE;
+
+//data lanes: output = kernel ^ offset, decryption sums the plaintext
+static void ocb_flush_data(const AES_OCB_CTX *ctx, OCB_LANES *q, AES_OCB_MSG *m, OCB_MSG_STATE *st, bool decrypt)
+{
+    uint8_t *out;
+
+    if(decrypt)
+        aes_decrypt_lanes(&ctx->aes, q->buf, q->buf, q->fill);
+    else
+        aes_encrypt_lanes(&ctx->aes, q->buf, q->buf, q->fill);
+    for(size_t l = 0; l < q->fill; l++)
+    {
+        out = m[q->who[l]].out + AES_BLOCK*q->blk[l];
+        xor_block(out, q->buf + AES_BLOCK*l, q->offs + AES_BLOCK*l);
+        if(decrypt)
+            xor_block(st[q->who[l]].sum, st[q->who[l]].sum, out);
+    }
+    q->fill = 0;
+}
+
+//hash lanes: blk is an AAD block, or SIZE_MAX for the pad of a partial last data block
+static void ocb_flush_hash(const AES_OCB_CTX *ctx, OCB_LANES *q, AES_OCB_MSG *m, OCB_MSG_STATE *st, bool decrypt)
+{
+    AES_OCB_MSG *p;
+    uint8_t last[AES_BLOCK];
+    size_t full, r;
+
+    aes_encrypt_lanes(&ctx->aes, q->buf, q->buf, q->fill);
+    for(size_t l = 0; l < q->fill; l++)
+    {
+        p = &m[q->who[l]];
+        if(q->blk[l] != SIZE_MAX)
+        {
+            xor_block(st[q->who[l]].hash, st[q->who[l]].hash, q->buf + AES_BLOCK*l);
+            continue;
+        }
+        full = p->len / AES_BLOCK * AES_BLOCK;
+        r = p->len % AES_BLOCK;
+        memset(last, 0, AES_BLOCK);
+        for(size_t b = 0; b < r; b++)
+        {
+            last[b] = decrypt? p->in[full + b] ^ q->buf[AES_BLOCK*l + b] : p->in[full + b];
+            p->out[full + b] = p->in[full + b] ^ q->buf[AES_BLOCK*l + b];
+        }
+        last[r] = 0x80;
+        xor_block(st[q->who[l]].sum, st[q->who[l]].sum, last);
+    }
+    q->fill = 0;
+}
+
+static void ocb_group(const AES_OCB_CTX *ctx, AES_OCB_MSG *m, size_t n, bool decrypt)
+{
+    OCB_MSG_STATE st[OCB_GROUP];
+    uint8_t nb[OCB_GROUP][AES_BLOCK], bottom[OCB_GROUP], ktop[AES_BLOCK], aoff[AES_BLOCK], sum[AES_BLOCK], diff;
+    size_t src[OCB_GROUP], k = 0, blocks, r;
+    OCB_LANES q;
+
+    memset(st, 0, sizeof(st));
+    //nonces: messages whose nonce blocks match share one Ktop
+    for(size_t i = 0; i < n; i++)
+    {
+        m[i].status = ocb_args_ok(ctx, m[i].nlen, m[i].aad_len, m[i].len)? 0 : -1;
+        if(m[i].status != 0)
+            continue;
+        bottom[i] = ocb_nonce_block(ctx, m[i].nonce, m[i].nlen, nb[i]);
+        //distinct blocks are packed to the front of nb, src[i] picks one
+        if(k > 0 && memcmp(nb[i], nb[k - 1], AES_BLOCK) == 0)
+            src[i] = k - 1;
+        else
+        {
+            memcpy(nb[k], nb[i], AES_BLOCK);
+            src[i] = k++;
+        }
+    }
+    aes_encrypt_blocks(&ctx->aes, nb[0], nb[0], k);
+    for(size_t i = 0; i < n; i++)
+    {
+        if(m[i].status != 0)
+            continue;
+        memcpy(ktop, nb[src[i]], AES_BLOCK);
+        ocb_stretch(ktop, bottom[i], st[i].off);
+    }
+
+    //full data blocks of the short messages, end to end
+    q.fill = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+        if(m[i].status != 0)
+            continue;
+        //local copies: stores through out could alias st
+        blocks = m[i].len / AES_BLOCK;
+        memcpy(aoff, st[i].off, AES_BLOCK);
+        memcpy(sum, st[i].sum, AES_BLOCK);
+        if(blocks >= AES_LANES)
+        {
+            ocb_blocks(ctx, m[i].in, m[i].out, blocks, aoff, sum, decrypt);
+            blocks = 0;
+        }
+        for(size_t b = 0; b < blocks; b++)
+        {
+            xor_block(aoff, aoff, ctx->l[ocb_ntz(b + 1)]);
+            memcpy(q.offs + AES_BLOCK*q.fill, aoff, AES_BLOCK);
+            xor_block(q.buf + AES_BLOCK*q.fill, m[i].in + AES_BLOCK*b, aoff);
+            if(!decrypt)
+                xor_block(sum, sum, m[i].in + AES_BLOCK*b);
+            q.who[q.fill] = i;
+            q.blk[q.fill] = b;
+            if(++q.fill == AES_LANES)
+                ocb_flush_data(ctx, &q, m, st, decrypt);
+        }
+        memcpy(st[i].off, aoff, AES_BLOCK);
+        if(!decrypt || m[i].len / AES_BLOCK >= AES_LANES)
+            memcpy(st[i].sum, sum, AES_BLOCK);
+    }
+    if(q.fill)
+        ocb_flush_data(ctx, &q, m, st, decrypt);
+
+    //AAD blocks and partial-block pads, all through the cipher
+    for(size_t i = 0; i < n; i++)
+    {
+        if(m[i].status != 0)
+            continue;
+        blocks = (m[i].aad_len + AES_BLOCK - 1) / AES_BLOCK;
+        memset(aoff, 0, AES_BLOCK);
+        for(size_t b = 0; b < blocks; b++)
+        {
+            r = m[i].aad_len - AES_BLOCK*b;
+            if(r >= AES_BLOCK)
+            {
+                xor_block(aoff, aoff, ctx->l[ocb_ntz(b + 1)]);
+                xor_block(q.buf + AES_BLOCK*q.fill, m[i].aad + AES_BLOCK*b, aoff);
+            }
+            else
+            {
+                xor_block(aoff, aoff, ctx->ls);
+                memset(ktop, 0, AES_BLOCK);
+                memcpy(ktop, m[i].aad + AES_BLOCK*b, r);
+                ktop[r] = 0x80;
+                xor_block(q.buf + AES_BLOCK*q.fill, ktop, aoff);
+            }
+            q.who[q.fill] = i;
+            q.blk[q.fill] = b;
+            if(++q.fill == AES_LANES)
+                ocb_flush_hash(ctx, &q, m, st, decrypt);
+        }
+        if(m[i].len % AES_BLOCK)
+        {
+            xor_block(st[i].off, st[i].off, ctx->ls);
+            memcpy(q.buf + AES_BLOCK*q.fill, st[i].off, AES_BLOCK);
+            q.who[q.fill] = i;
+            q.blk[q.fill] = SIZE_MAX;
+            if(++q.fill == AES_LANES)
+                ocb_flush_hash(ctx, &q, m, st, decrypt);
+        }
+    }
+    if(q.fill)
+        ocb_flush_hash(ctx, &q, m, st, decrypt);
+
+    //Tag = E(Checksum ^ Offset ^ L_$) ^ HASH(K, A), every message in one run
+    for(size_t i = 0; i < n; i++)
+    {
+        xor_block(nb[i], st[i].sum, st[i].off);
+        xor_block(nb[i], nb[i], ctx->ld);
+    }
+    aes_encrypt_blocks(&ctx->aes, nb[0], nb[0], n);
+    for(size_t i = 0; i < n; i++)
+    {
+        if(m[i].status != 0)
+            continue;
+        xor_block(nb[i], nb[i], st[i].hash);
+        if(!decrypt)
+        {
+            memcpy(m[i].tag, nb[i], ctx->taglen);
+            continue;
+        }
+        diff = 0;
+        for(uint8_t b = 0; b < ctx->taglen; b++)
+            diff |= nb[i][b] ^ m[i].tag[b];
+        if(diff != 0)
+        {
+            memset(m[i].out, 0, m[i].len);
+            m[i].status = -1;
+        }
+    }
+    memset(st, 0, sizeof(st));
+}
+
+/*-------------------------------------------------------------------------
+                            OCB BATCH
+ pre: n messages under one key; in and out of different messages do not
+      overlap.
+ post: msgs[i].status set; a message that fails has its out wiped.
+-------------------------------------------------------------------------*/
+void aes_ocb_encrypt_batch(const AES_OCB_CTX *ctx, AES_OCB_MSG *msgs, size_t n)
+{
+    for(size_t i = 0; i < n; i += OCB_GROUP)
+        ocb_group(ctx, msgs + i, n - i < OCB_GROUP? n - i : OCB_GROUP, false);
+}
+
+void aes_ocb_decrypt_batch(const AES_OCB_CTX *ctx, AES_OCB_MSG *msgs, size_t n)
+{
+    for(size_t i = 0; i < n; i += OCB_GROUP)
+        ocb_group(ctx, msgs + i, n - i < OCB_GROUP? n - i : OCB_GROUP, true);
+}
+
+#endif /* aes_ocb_h */
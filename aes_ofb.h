@@ -0,0 +1,88 @@
+#ifndef aes_ofb_h
+#define aes_ofb_h
+#include "aes_block.h"
+
+/*
+    Output Feedback (OFB) streaming encoder, SP 800-38A 6.4.
+
+    The keystream O_i = Cipher(O_i-1) is a serial chain but does not depend
+    on the data, so it is generated OFB_KS_BLOCKS blocks at a time into a
+    buffer ahead of the data and XORed in a word at a time.
+    aes_ofb_precompute lets a caller fill the buffer while it waits for
+    input. Encryption and decryption are the same operation.
+*/
+
+#define OFB_KS_BLOCKS (4*AES_LANES) //keystream blocks held ahead
+
+typedef struct aes_ofb
+{
+    const AES_CTX *key;                     //shared expanded key
+    uint8_t ks[OFB_KS_BLOCKS*AES_BLOCK];    //precomputed keystream
+    uint8_t ov[16];                         //last output block generated
+    size_t used, avail;                     //bytes of ks consumed and generated
+}AES_OFB;
+
+/*-------------------------------------------------------------------------
+                            OFB INIT
+-------------------------------------------------------------------------*/
+void aes_ofb_init(AES_OFB *s, const AES_CTX *key, const uint8_t *iv)
+{
+    s->key = key;
+    memcpy(s->ov, iv, AES_BLOCK);
+    s->used = 0;
+    s->avail = 0;
+}
+
+/*-------------------------------------------------------------------------
+                        OFB KEYSTREAM REFILL
+ post: unused keystream moved to the front and the buffer filled up.
+-------------------------------------------------------------------------*/
+void aes_ofb_precompute(AES_OFB *s)
+{
+    size_t left = s->avail - s->used;
+
+    memmove(s->ks, s->ks + s->used, left);
+    s->used = 0;
+    s->avail = left;
+    while(s->avail + AES_BLOCK <= sizeof(s->ks))
+    {
+        aes_encrypt_block(s->key, s->ov, s->ov);
+        memcpy(s->ks + s->avail, s->ov, AES_BLOCK);
+        s->avail += AES_BLOCK;
+    }
+}
+
+/*-------------------------------------------------------------------------
+                        OFB ENCRYPTION / DECRYPTION
+ pre: any len, calls may split a message at any byte.
+-------------------------------------------------------------------------*/
+void aes_ofb_update(AES_OFB *s, const uint8_t *in, uint8_t *out, size_t len)
+{
+    uint64_t a, k;
+    size_t n;
+
+    while(len > 0)
+    {
+        if(s->used == s->avail)
+            aes_ofb_precompute(s);
+
+        n = s->avail - s->used;
+        n = n < len? n : len;
+        for(size_t i = 0; i + 8 <= n; i += 8)
+        {
+            memcpy(&a, in + i, 8);
+            memcpy(&k, s->ks + s->used + i, 8);
+            a ^= k;
+            memcpy(out + i, &a, 8);
+        }
+        for(size_t i = n & ~(size_t)7; i < n; i++)
+            out[i] = in[i] ^ s->ks[s->used + i];
+
+        s->used += n;
+        in += n;
+        out += n;
+        len -= n;
+    }
+}
+
+#endif /* aes_ofb_h */
@@ -0,0 +1,665 @@
+#ifndef aes_pipe_h
+#define aes_pipe_h
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "aes_block.h"
+#include "aes_ctr.h"
+#include "aes_xts.h"
+#include "aes_thread.h"
+
+/*
+    Read -> encrypt -> write pipeline over a file range, so that
+    encrypting a file takes about as long as copying it.
+
+    A fixed ring of depth chunk buffers is registered with io_uring. The
+    calling thread owns the ring and only submits and reaps. A chunk is
+    read with READ_FIXED and handed to a pool of worker threads. When it
+    comes back encrypted it is written with WRITE_FIXED to the same offset
+    of the output, and its buffer goes back to reading. While one chunk is
+    on the device, others are being encrypted, so neither the device nor
+    the cores wait on each other. Workers signal finished chunks through
+    an eventfd that has a read pending on the ring, so the submitting
+    thread only ever blocks in io_uring_enter. The ring is driven with the
+    raw syscalls, so no liburing is needed.
+
+    With direct set, the descriptors are expected to be opened O_DIRECT.
+    The buffers are page aligned, a short tail is written padded to the
+    page, and the output is cut back to length at the end. A short tail is
+    only accepted where the data ends at the end of a regular input file
+    and nothing in the output lies past it, so the padding never lands on
+    bytes outside the range.
+
+    When io_uring is not available (old kernel, seccomp, a container that
+    blocks it), or with force_threads, depth threads each run pread ->
+    transform -> pwrite on chunks they claim in turn, which still overlaps
+    I/O and encryption.
+*/
+
+#define PIPE_ALIGN 4096
+#define PIPE_EV UINT64_MAX //user_data of the eventfd read
+
+//returns 0, or -1 to fail the run (EINVAL) before the chunk is written
+typedef int (*AES_PIPE_FN)(void *arg, uint64_t offset, uint8_t *buf, size_t len);
+
+typedef struct aes_pipe
+{
+    int in_fd, out_fd;          //may be the same descriptor
+    uint64_t offset, len;       //range, written to the same offsets of out
+    size_t chunk;               //bytes per buffer, 0 for 1 MiB
+    unsigned depth;             //buffers in flight, 0 for 8
+    unsigned threads;           //encryption workers, 0 for every core
+    bool direct;                //descriptors opened O_DIRECT
+    bool force_threads;         //skip io_uring
+    AES_PIPE_FN fn;             //transforms a chunk in place
+    void *arg;
+}AES_PIPE;
+
+//ready made transforms: CTR with counter = iv + offset / 16, XTS sectors.
+//A file tail shorter than a sector is one short data unit, with ciphertext
+//stealing; a tail under 16 bytes cannot be encrypted and fails the run.
+typedef struct aes_pipe_ctr
+{
+    const AES_CTX *key;
+    uint8_t iv[16];
+}AES_PIPE_CTR;
+
+typedef struct aes_pipe_xts
+{
+    const AES_XTS_CTX *ctx;
+    size_t sector_size;
+    bool decrypt;
+}AES_PIPE_XTS;
+
+int aes_pipe_ctr(void *arg, uint64_t offset, uint8_t *buf, size_t len)
+{
+    const AES_PIPE_CTR *c = (const AES_PIPE_CTR*)arg;
+    uint8_t ctr[AES_BLOCK];
+
+    memcpy(ctr, c->iv, AES_BLOCK);
+    ctr128_add(ctr, offset / AES_BLOCK);
+    aes_ctr_xor(c->key, ctr, buf, buf, len);
+    return 0;
+}
+
+int aes_pipe_xts(void *arg, uint64_t offset, uint8_t *buf, size_t len)
+{
+    const AES_PIPE_XTS *x = (const AES_PIPE_XTS*)arg;
+    uint64_t first = offset / x->sector_size;
+    size_t n = len / x->sector_size, tail = len % x->sector_size;
+    uint8_t *t = buf + n * x->sector_size;
+
+    if(offset % x->sector_size || (tail && tail < AES_BLOCK))
+        return -1;
+    //the pipeline workers already occupy the cores
+    if(x->decrypt)
+    {
+        if(aes_xts_decrypt_sectors(x->ctx, first, buf, buf, x->sector_size, n, 1) != 0)
+            return -1;
+        return tail? aes_xts_decrypt(x->ctx, first + n, t, t, tail) : 0;
+    }
+    if(aes_xts_encrypt_sectors(x->ctx, first, buf, buf, x->sector_size, n, 1) != 0)
+        return -1;
+    return tail? aes_xts_encrypt(x->ctx, first + n, t, t, tail) : 0;
+}
+
+typedef enum pipe_state
+{
+    PIPE_FREE,
+    PIPE_READING,
+    PIPE_WORKING,
+    PIPE_WRITING
+}PIPE_STATE;
+
+typedef struct pipe_slot
+{
+    uint8_t *buf;
+    struct iovec iov;           //for the unregistered fallback ops
+    uint64_t off;               //file offset of the chunk
+    size_t len, io_len, done;   //data bytes, bytes to transfer, transferred
+    PIPE_STATE state;
+    struct pipe_slot *next;
+}PIPE_SLOT;
+
+typedef struct pipe_ring
+{
+    int fd;
+    unsigned entries, pending;
+    unsigned *sq_tail, *sq_head, *sq_mask, *sq_array;
+    unsigned *cq_tail, *cq_head, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    bool fixed;                 //buffers registered
+}PIPE_RING;
+
+typedef struct pipe_engine
+{
+    const AES_PIPE *p;
+    PIPE_SLOT *slots;
+    size_t chunk;
+    unsigned depth;
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    PIPE_SLOT *todo, *todo_tail;//read, waiting for a worker
+    PIPE_SLOT *ready;           //transformed, waiting to be written
+    bool stop;
+    int efd;
+    uint64_t next, end, moved;  //threads fallback: next offset, end of input, bytes done
+    bool padded;                //a tail was written past the data
+    int err;
+}PIPE_ENGINE;
+
+/*-------------------------------------------------------------------------
+                        io_uring setup / teardown
+ post: returns 0, or -1 if io_uring cannot be used here.
+-------------------------------------------------------------------------*/
+static int pipe_ring_init(PIPE_RING *r, unsigned entries)
+{
+    struct io_uring_params prm;
+    uint8_t *sq, *cq;
+
+    memset(r, 0, sizeof(PIPE_RING));
+    memset(&prm, 0, sizeof(prm));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &prm);
+    if(r->fd < 0)
+        return -1;
+    r->entries = prm.sq_entries;
+    r->sq_size = prm.sq_off.array + prm.sq_entries*sizeof(unsigned);
+    r->cq_size = prm.cq_off.cqes + prm.cq_entries*sizeof(struct io_uring_cqe);
+    if(prm.features & IORING_FEAT_SINGLE_MMAP)
+        r->sq_size = r->cq_size = r->sq_size > r->cq_size? r->sq_size : r->cq_size;
+    r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if(r->sq_ptr == MAP_FAILED)
+        goto fail;
+    r->cq_ptr = r->sq_ptr;
+    if(!(prm.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if(r->cq_ptr == MAP_FAILED)
+            goto fail;
+    }
+    r->sqes_size = prm.sq_entries*sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if(r->sqes == MAP_FAILED)
+        goto fail;
+
+    sq = (uint8_t*)r->sq_ptr;
+    cq = (uint8_t*)r->cq_ptr;
+    r->sq_tail = (unsigned*)(sq + prm.sq_off.tail);
+    r->sq_head = (unsigned*)(sq + prm.sq_off.head);
+    r->sq_mask = (unsigned*)(sq + prm.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq + prm.sq_off.array);
+    r->cq_tail = (unsigned*)(cq + prm.cq_off.tail);
+    r->cq_head = (unsigned*)(cq + prm.cq_off.head);
+    r->cq_mask = (unsigned*)(cq + prm.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + prm.cq_off.cqes);
+    return 0;
+
+fail:
+    if(r->sq_ptr && r->sq_ptr != MAP_FAILED) munmap(r->sq_ptr, r->sq_size);
+    if(r->cq_ptr && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_size);
+    close(r->fd);
+    return -1;
+}
+
+static void pipe_ring_free(PIPE_RING *r)
+{
+    munmap(r->sqes, r->sqes_size);
+    if(r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_size);
+    munmap(r->sq_ptr, r->sq_size);
+    close(r->fd);
+}
+
+/*-------------------------------------------------------------------------
+                Queue one read or write (single producer)
+-------------------------------------------------------------------------*/
+static void pipe_sqe(PIPE_RING *r, uint8_t op, int fd, void *addr, size_t len, uint64_t off, unsigned buf_index, uint64_t data)
+{
+    unsigned tail = *r->sq_tail, i = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[i];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = (uint32_t)len;
+    sqe->off = off;
+    sqe->buf_index = (uint16_t)buf_index;
+    sqe->user_data = data;
+    r->sq_array[i] = i;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->pending++;
+}
+
+//the rest of a slot's current transfer
+static void pipe_slot_io(PIPE_ENGINE *e, PIPE_RING *r, PIPE_SLOT *s, bool write)
+{
+    const AES_PIPE *p = e->p;
+    int fd = write? p->out_fd : p->in_fd;
+    size_t idx = (size_t)(s - e->slots);
+
+    if(r->fixed)
+        pipe_sqe(r, write? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED, fd, s->buf + s->done,
+                 s->io_len - s->done, s->off + s->done, (unsigned)idx, idx);
+    else
+    {
+        s->iov.iov_base = s->buf + s->done;
+        s->iov.iov_len = s->io_len - s->done;
+        pipe_sqe(r, write? IORING_OP_WRITEV : IORING_OP_READV, fd, &s->iov, 1, s->off + s->done, 0, idx);
+    }
+}
+
+static int pipe_enter(PIPE_RING *r, unsigned wait)
+{
+    long n;
+
+    do
+        n = syscall(__NR_io_uring_enter, r->fd, r->pending, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+    while(n < 0 && errno == EINTR);
+    if(n < 0)
+        return -1;
+    r->pending -= (unsigned)n;
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                Worker: transform chunks handed over by the ring
+-------------------------------------------------------------------------*/
+static void *pipe_worker(void *arg)
+{
+    PIPE_ENGINE *e = (PIPE_ENGINE*)arg;
+    const AES_PIPE *p = e->p;
+    uint64_t one = 1;
+    PIPE_SLOT *s;
+    int rc;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&e->mu);
+        while(e->todo == NULL && !e->stop)
+            pthread_cond_wait(&e->cv, &e->mu);
+        if(e->todo == NULL)
+        {
+            pthread_mutex_unlock(&e->mu);
+            return NULL;
+        }
+        s = e->todo;
+        e->todo = s->next;
+        pthread_mutex_unlock(&e->mu);
+
+        rc = p->fn(p->arg, s->off, s->buf, s->len);
+        memset(s->buf + s->len, 0, s->io_len - s->len);
+
+        //a refused chunk is handed back untransformed and never written
+        pthread_mutex_lock(&e->mu);
+        if(rc != 0 && e->err == 0)
+            e->err = EINVAL;
+        s->next = e->ready;
+        e->ready = s;
+        pthread_mutex_unlock(&e->mu);
+        if(write(e->efd, &one, sizeof(one)) < 0)
+            e->err = errno;
+    }
+}
+
+static size_t pipe_round(const PIPE_ENGINE *e, size_t len)
+{
+    return e->p->direct? (len + PIPE_ALIGN - 1) & ~(size_t)(PIPE_ALIGN - 1) : len;
+}
+
+/*-------------------------------------------------------------------------
+            A read finished: more to read, end of file, or transform
+-------------------------------------------------------------------------*/
+static void pipe_read_done(PIPE_ENGINE *e, PIPE_RING *r, PIPE_SLOT *s, int res, uint64_t *end, unsigned *busy)
+{
+    if(res > 0)
+    {
+        s->done += (size_t)res;
+        //a direct read short of the page only happens at end of file
+        if(s->done < s->len && !(e->p->direct && s->done % PIPE_ALIGN))
+        {
+            pipe_slot_io(e, r, s, false);
+            return;
+        }
+    }
+    //end of file inside this chunk: nothing past it is read
+    if(s->done < s->len)
+    {
+        if(s->off + s->done < *end)
+            *end = s->off + s->done;
+        s->len = s->done;
+    }
+    if(s->len == 0)
+    {
+        s->state = PIPE_FREE;
+        (*busy)--;
+        return;
+    }
+    s->io_len = pipe_round(e, s->len);
+    s->state = PIPE_WORKING;
+    s->next = NULL;
+    pthread_mutex_lock(&e->mu);
+    if(e->todo == NULL)
+        e->todo = s;
+    else
+        e->todo_tail->next = s;
+    e->todo_tail = s;
+    pthread_cond_signal(&e->cv);
+    pthread_mutex_unlock(&e->mu);
+}
+
+/*-------------------------------------------------------------------------
+                    Pipeline on io_uring
+ post: returns 0, -1 with e->err set on an I/O error, or -2 if io_uring
+       is unavailable (nothing has been read or written).
+-------------------------------------------------------------------------*/
+static int pipe_uring(PIPE_ENGINE *e)
+{
+    const AES_PIPE *p = e->p;
+    uint64_t next = p->offset, end = p->offset + p->len, ev = 0, one = 1;
+    pthread_t tid[AES_MAX_THREADS];
+    struct iovec iov[AES_MAX_THREADS];
+    unsigned nthreads = p->threads? p->threads : aes_ncpu(), started = 0, busy = 0;
+    bool ev_armed = false, closing = false;
+    struct iovec ev_iov = {&ev, sizeof(ev)};
+    PIPE_RING r;
+    PIPE_SLOT *s, *list;
+    unsigned head, tail;
+
+    if(pipe_ring_init(&r, e->depth + 1) != 0)
+        return -2;
+    e->efd = eventfd(0, EFD_CLOEXEC);
+    if(e->efd < 0)
+    {
+        pipe_ring_free(&r);
+        return -2;
+    }
+    for(unsigned i = 0; i < e->depth; i++)
+        iov[i] = (struct iovec){e->slots[i].buf, e->chunk};
+    r.fixed = syscall(__NR_io_uring_register, r.fd, IORING_REGISTER_BUFFERS, iov, e->depth) == 0;
+
+    if(nthreads > AES_MAX_THREADS) nthreads = AES_MAX_THREADS;
+    for(; started < nthreads; started++)
+        if(pthread_create(&tid[started], NULL, pipe_worker, e) != 0)
+            break;
+    if(started == 0)
+        e->err = EAGAIN;
+
+    for(;;)
+    {
+        //free buffers start reading the next chunks
+        for(unsigned i = 0; i < e->depth && !closing && e->err == 0 && next < end; i++)
+        {
+            s = &e->slots[i];
+            if(s->state != PIPE_FREE)
+                continue;
+            s->off = next;
+            s->len = end - next < e->chunk? (size_t)(end - next) : e->chunk;
+            s->io_len = pipe_round(e, s->len);
+            s->done = 0;
+            s->state = PIPE_READING;
+            pipe_slot_io(e, &r, s, false);
+            next += s->len;
+            busy++;
+        }
+        if(!ev_armed)
+        {
+            pipe_sqe(&r, IORING_OP_READV, e->efd, &ev_iov, 1, 0, 0, PIPE_EV);
+            ev_armed = true;
+        }
+        if(busy == 0 && !closing)
+        {
+            //complete the eventfd read so nothing is left on the ring
+            closing = true;
+            if(write(e->efd, &one, sizeof(one)) < 0)
+                e->err = errno;
+        }
+        if(pipe_enter(&r, 1) != 0)
+        {
+            e->err = errno;
+            break;
+        }
+
+        head = *r.cq_head;
+        tail = __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != tail; head++)
+        {
+            struct io_uring_cqe *cqe = &r.cqes[head & *r.cq_mask];
+            int res = cqe->res;
+
+            if(cqe->user_data == PIPE_EV)
+            {
+                ev_armed = false;
+                pthread_mutex_lock(&e->mu);
+                list = e->ready;
+                e->ready = NULL;
+                pthread_mutex_unlock(&e->mu);
+                for(; list; list = s)
+                {
+                    s = list->next;
+                    if(e->err != 0)
+                    {
+                        list->state = PIPE_FREE;
+                        busy--;
+                        continue;
+                    }
+                    list->done = 0;
+                    list->state = PIPE_WRITING;
+                    pipe_slot_io(e, &r, list, true);
+                    if(list->io_len > list->len)
+                        e->padded = true;
+                }
+                continue;
+            }
+            s = &e->slots[cqe->user_data];
+            if(res == -EINTR || res == -EAGAIN)
+            {
+                pipe_slot_io(e, &r, s, s->state == PIPE_WRITING);
+                continue;
+            }
+            if(res < 0 || (res == 0 && s->state == PIPE_WRITING) || e->err != 0)
+            {
+                if(e->err == 0)
+                    e->err = res < 0? -res : EIO;
+                s->state = PIPE_FREE;
+                busy--;
+                continue;
+            }
+            if(s->state == PIPE_READING)
+                pipe_read_done(e, &r, s, res, &end, &busy);
+            else
+            {
+                s->done += (size_t)res;
+                if(s->done < s->io_len)
+                    pipe_slot_io(e, &r, s, true);
+                else
+                {
+                    e->moved += s->len;
+                    s->state = PIPE_FREE;
+                    busy--;
+                }
+            }
+        }
+        __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+        if(closing && !ev_armed)
+            break;
+    }
+
+    pthread_mutex_lock(&e->mu);
+    e->stop = true;
+    pthread_cond_broadcast(&e->cv);
+    pthread_mutex_unlock(&e->mu);
+    for(unsigned i = 0; i < started; i++)
+        pthread_join(tid[i], NULL);
+    pipe_ring_free(&r);
+    close(e->efd);
+    return e->err? -1 : 0;
+}
+
+/*-------------------------------------------------------------------------
+            Fallback: each thread reads, transforms, writes its chunks
+-------------------------------------------------------------------------*/
+typedef struct pipe_arg
+{
+    PIPE_ENGINE *e;
+    PIPE_SLOT *s;
+}PIPE_ARG;
+
+static void *pipe_thread(void *arg)
+{
+    PIPE_ENGINE *e = ((PIPE_ARG*)arg)->e;
+    PIPE_SLOT *s = ((PIPE_ARG*)arg)->s;
+    const AES_PIPE *p = e->p;
+    uint64_t end, eof;
+    ssize_t n;
+
+    for(;;)
+    {
+        s->off = __atomic_fetch_add(&e->next, e->chunk, __ATOMIC_RELAXED);
+        end = __atomic_load_n(&e->end, __ATOMIC_RELAXED);
+        if(s->off >= end || __atomic_load_n(&e->err, __ATOMIC_RELAXED))
+            return NULL;
+        s->len = end - s->off < e->chunk? (size_t)(end - s->off) : e->chunk;
+        s->io_len = pipe_round(e, s->len);
+        for(s->done = 0; s->done < s->len; s->done += (size_t)n)
+        {
+            n = pread(p->in_fd, s->buf + s->done, s->io_len - s->done, (off_t)(s->off + s->done));
+            if(n < 0 && errno == EINTR) { n = 0; continue; }
+            if(n < 0) { __atomic_store_n(&e->err, errno, __ATOMIC_RELAXED); return NULL; }
+            if(n == 0 || (p->direct && (s->done + (size_t)n) % PIPE_ALIGN)) { s->done += (size_t)n; break; }
+        }
+        //end of file: no thread reads past it
+        eof = s->off + s->done;
+        while(s->done < s->len && eof < end && !__atomic_compare_exchange_n(&e->end, &end, eof, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        if(s->done == 0)
+            continue;
+        s->len = s->done < s->len? s->done : s->len;
+        s->io_len = pipe_round(e, s->len);
+        if(p->fn(p->arg, s->off, s->buf, s->len) != 0)
+        {
+            __atomic_store_n(&e->err, EINVAL, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        memset(s->buf + s->len, 0, s->io_len - s->len);
+        if(s->io_len > s->len)
+            __atomic_store_n(&e->padded, true, __ATOMIC_RELAXED);
+        for(s->done = 0; s->done < s->io_len; s->done += (size_t)n)
+        {
+            n = pwrite(p->out_fd, s->buf + s->done, s->io_len - s->done, (off_t)(s->off + s->done));
+            if(n < 0 && errno == EINTR) { n = 0; continue; }
+            if(n <= 0) { __atomic_store_n(&e->err, n < 0? errno : EIO, __ATOMIC_RELAXED); return NULL; }
+        }
+        __atomic_fetch_add(&e->moved, s->len, __ATOMIC_RELAXED);
+    }
+}
+
+static int pipe_threads(PIPE_ENGINE *e)
+{
+    pthread_t tid[AES_MAX_THREADS];
+    PIPE_ARG arg[AES_MAX_THREADS];
+    unsigned started = 0;
+
+    e->next = e->p->offset;
+    e->end = e->p->offset + e->p->len;
+    for(unsigned i = 0; i < e->depth; i++)
+        arg[i] = (PIPE_ARG){e, &e->slots[i]};
+    for(; started < e->depth; started++)
+        if(pthread_create(&tid[started], NULL, pipe_thread, &arg[started]) != 0)
+            break;
+    if(started == 0)
+        pipe_thread(&arg[0]);
+    for(unsigned i = 0; i < started; i++)
+        pthread_join(tid[i], NULL);
+    return e->err? -1 : 0;
+}
+
+/*-------------------------------------------------------------------------
+                            RUN THE PIPELINE
+ pre: chunk a multiple of 16 (and of the transform's unit, e.g. the XTS
+      sector); with direct, chunk and offset multiples of 4096, and the
+      data either ending on a multiple of 4096 or at the end of a regular
+      input file with the output no longer than that end.
+ post: returns 0, or -1 on bad parameters, a chunk the transform refuses,
+       a memory or I/O error (errno set). *moved holds the bytes written, less than len if the input
+       ends first.
+-------------------------------------------------------------------------*/
+int aes_pipe_run(const AES_PIPE *p, uint64_t *moved)
+{
+    PIPE_ENGINE e;
+    struct stat ist, ost;
+    uint64_t data_end, out_size = 0;
+    int rc = -2;
+
+    memset(&e, 0, sizeof(e));
+    e.p = p;
+    e.chunk = p->chunk? p->chunk : 1 << 20;
+    e.depth = p->depth? p->depth : 8;
+    *moved = 0;
+    if(e.chunk % AES_BLOCK || e.depth > AES_MAX_THREADS || p->fn == NULL ||
+       (p->direct && (e.chunk % PIPE_ALIGN || p->offset % PIPE_ALIGN)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    //a padded tail is written past the data, and the output cut back after
+    if(p->direct)
+    {
+        if(fstat(p->in_fd, &ist) != 0 || fstat(p->out_fd, &ost) != 0)
+            return -1;
+        data_end = p->offset + p->len;
+        if(S_ISREG(ist.st_mode) && (uint64_t)ist.st_size < data_end)
+            data_end = (uint64_t)ist.st_size;
+        out_size = S_ISREG(ost.st_mode)? (uint64_t)ost.st_size : 0;
+        if(data_end % PIPE_ALIGN && (!S_ISREG(ist.st_mode) || !S_ISREG(ost.st_mode) || out_size > data_end))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    e.slots = calloc(e.depth, sizeof(PIPE_SLOT));
+    if(e.slots == NULL)
+        return -1;
+    for(unsigned i = 0; i < e.depth; i++)
+    {
+        if(posix_memalign((void**)&e.slots[i].buf, PIPE_ALIGN, e.chunk) != 0)
+        {
+            e.err = ENOMEM;
+            e.depth = i;
+            break;
+        }
+    }
+    pthread_mutex_init(&e.mu, NULL);
+    pthread_cond_init(&e.cv, NULL);
+
+    if(e.err == 0 && !p->force_threads)
+        rc = pipe_uring(&e);
+    if(e.err == 0 && rc == -2)
+        rc = pipe_threads(&e);
+    if(e.err == 0 && e.padded && ftruncate(p->out_fd, (off_t)(p->offset + e.moved > out_size? p->offset + e.moved : out_size)) != 0)
+        e.err = errno;
+
+    pthread_mutex_destroy(&e.mu);
+    pthread_cond_destroy(&e.cv);
+    for(unsigned i = 0; i < e.depth; i++)
+    {
+        memset(e.slots[i].buf, 0, e.chunk);
+        free(e.slots[i].buf);
+    }
+    free(e.slots);
+    *moved = e.moved;
+    if(e.err)
+    {
+        errno = e.err;
+        return -1;
+    }
+    return 0;
+}
+
+#endif /* aes_pipe_h */
@@ -0,0 +1,216 @@
+#ifndef aes_polyval_h
+#define aes_polyval_h
+#include "aes_block.h"
+#if defined(__PCLMUL__) && defined(__SSE2__)
+#include <wmmintrin.h>
+#include <emmintrin.h>
+#define POLYVAL_CLMUL 1
+#endif
+
+/*
+    POLYVAL universal hash (RFC 8452 3), the GF(2^128) hash under
+    AES-GCM-SIV and HCTR2, with GHASH derivable from it (RFC 8452 A).
+
+    Field elements are little-endian: bit i of the 128-bit integer read from
+    the 16 bytes is the coefficient of x^i, modulo
+    P(x) = x^128 + x^127 + x^126 + x^121 + 1. dot(a, b) = a*b*x^-128.
+
+    Built with -mpclmul the 64x64 carry-less products use PCLMULQDQ,
+    otherwise a constant-time integer multiply with holes (every fourth bit)
+    stands in for it. Four blocks are hashed per reduction against the
+    precomputed powers H, H^2, H^3, H^4 (in the dot sense).
+*/
+
+#define POLYVAL_POWERS 4
+
+typedef struct polyval_ctx
+{
+    uint64_t h[POLYVAL_POWERS][2]; //h[i] = H^(i+1), {lo, hi}
+    uint64_t s[2];                 //accumulator
+}POLYVAL_CTX;
+
+/*-------------------------------------------------------------------------
+                Reduce C3:C2:C1:C0 * x^-128 modulo P(x)
+ Two Montgomery steps, each folds the low word with
+ P = 1 + x^64 * (x^57 + x^62 + x^63) + x^128.
+-------------------------------------------------------------------------*/
+static inline void polyval_reduce(const uint64_t c[4], uint64_t r[2])
+{
+    uint64_t d1, d2, d3;
+
+    d1 = c[1] ^ (c[0] << 63) ^ (c[0] << 62) ^ (c[0] << 57);
+    d2 = c[2] ^ c[0] ^ (c[0] >> 1) ^ (c[0] >> 2) ^ (c[0] >> 7);
+    d3 = c[3];
+    r[0] = d2 ^ (d1 << 63) ^ (d1 << 62) ^ (d1 << 57);
+    r[1] = d3 ^ d1 ^ (d1 >> 1) ^ (d1 >> 2) ^ (d1 >> 7);
+}
+
+#ifdef POLYVAL_CLMUL
+/*-------------------------------------------------------------------------
+            128x128 carry-less product, accumulated into c (PCLMULQDQ)
+-------------------------------------------------------------------------*/
+static inline void polyval_mul_acc(const uint64_t a[2], const uint64_t b[2], uint64_t c[4])
+{
+    __m128i x = _mm_set_epi64x((long long)a[1], (long long)a[0]);
+    __m128i y = _mm_set_epi64x((long long)b[1], (long long)b[0]);
+    __m128i lo, hi, m0, m1;
+    uint64_t t[2];
+
+    lo = _mm_clmulepi64_si128(x, y, 0x00);
+    hi = _mm_clmulepi64_si128(x, y, 0x11);
+    m0 = _mm_clmulepi64_si128(x, y, 0x01);
+    m1 = _mm_clmulepi64_si128(x, y, 0x10);
+    m0 = _mm_xor_si128(m0, m1);
+
+    _mm_storeu_si128((__m128i*)t, lo);
+    c[0] ^= t[0]; c[1] ^= t[1];
+    _mm_storeu_si128((__m128i*)t, hi);
+    c[2] ^= t[0]; c[3] ^= t[1];
+    _mm_storeu_si128((__m128i*)t, m0);
+    c[1] ^= t[0]; c[2] ^= t[1];
+}
+#else
+/*-------------------------------------------------------------------------
+        Low 64 bits of a 64x64 carry-less product, constant time
+ Keeping one data bit in four leaves three zero bits of room between
+ them, so integer carries never reach the next bit that is kept.
+-------------------------------------------------------------------------*/
+static inline uint64_t bmul64(uint64_t x, uint64_t y)
+{
+    uint64_t x0, x1, x2, x3, y0, y1, y2, y3, z0, z1, z2, z3;
+
+    x0 = x & 0x1111111111111111ULL; x1 = x & 0x2222222222222222ULL;
+    x2 = x & 0x4444444444444444ULL; x3 = x & 0x8888888888888888ULL;
+    y0 = y & 0x1111111111111111ULL; y1 = y & 0x2222222222222222ULL;
+    y2 = y & 0x4444444444444444ULL; y3 = y & 0x8888888888888888ULL;
+    z0 = (x0 * y0) ^ (x1 * y3) ^ (x2 * y2) ^ (x3 * y1);
+    z1 = (x0 * y1) ^ (x1 * y0) ^ (x2 * y3) ^ (x3 * y2);
+    z2 = (x0 * y2) ^ (x1 * y1) ^ (x2 * y0) ^ (x3 * y3);
+    z3 = (x0 * y3) ^ (x1 * y2) ^ (x2 * y1) ^ (x3 * y0);
+    return (z0 & 0x1111111111111111ULL) | (z1 & 0x2222222222222222ULL) |
+           (z2 & 0x4444444444444444ULL) | (z3 & 0x8888888888888888ULL);
+}
+
+static inline uint64_t rev64(uint64_t x)
+{
+    x = ((x & 0x5555555555555555ULL) << 1) | ((x >> 1) & 0x5555555555555555ULL);
+    x = ((x & 0x3333333333333333ULL) << 2) | ((x >> 2) & 0x3333333333333333ULL);
+    x = ((x & 0x0f0f0f0f0f0f0f0fULL) << 4) | ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL);
+    x = ((x & 0x00ff00ff00ff00ffULL) << 8) | ((x >> 8) & 0x00ff00ff00ff00ffULL);
+    x = ((x & 0x0000ffff0000ffffULL) << 16) | ((x >> 16) & 0x0000ffff0000ffffULL);
+    return (x << 32) | (x >> 32);
+}
+
+/*-------------------------------------------------------------------------
+                    64x64 carry-less product, {lo, hi}
+ the high half is the low half of the bit-reversed operands, reversed.
+-------------------------------------------------------------------------*/
+static inline void clmul64(uint64_t x, uint64_t y, uint64_t *lo, uint64_t *hi)
+{
+    *lo = bmul64(x, y);
+    *hi = rev64(bmul64(rev64(x), rev64(y))) >> 1;
+}
+
+/*-------------------------------------------------------------------------
+            128x128 carry-less product, accumulated into c (Karatsuba)
+-------------------------------------------------------------------------*/
+static inline void polyval_mul_acc(const uint64_t a[2], const uint64_t b[2], uint64_t c[4])
+{
+    uint64_t l0, l1, h0, h1, m0, m1;
+
+    clmul64(a[0], b[0], &l0, &l1);
+    clmul64(a[1], b[1], &h0, &h1);
+    clmul64(a[0] ^ a[1], b[0] ^ b[1], &m0, &m1);
+    m0 ^= l0 ^ h0;
+    m1 ^= l1 ^ h1;
+    c[0] ^= l0;
+    c[1] ^= l1 ^ m0;
+    c[2] ^= h0 ^ m1;
+    c[3] ^= h1;
+}
+#endif
+
+/*-------------------------------------------------------------------------
+                        dot(a, b) = a*b*x^-128
+-------------------------------------------------------------------------*/
+static inline void polyval_dot(const uint64_t a[2], const uint64_t b[2], uint64_t r[2])
+{
+    uint64_t c[4] = {0, 0, 0, 0};
+
+    polyval_mul_acc(a, b, c);
+    polyval_reduce(c, r);
+}
+
+/*-------------------------------------------------------------------------
+                            POLYVAL Init
+ post: powers of H precomputed, accumulator cleared.
+-------------------------------------------------------------------------*/
+void polyval_init(POLYVAL_CTX *ctx, const uint8_t *H)
+{
+    ctx->h[0][0] = load64_le(H);
+    ctx->h[0][1] = load64_le(H + 8);
+    for(uint8_t i = 1; i < POLYVAL_POWERS; i++)
+        polyval_dot(ctx->h[i-1], ctx->h[0], ctx->h[i]);
+    ctx->s[0] = ctx->s[1] = 0;
+}
+
+/*-------------------------------------------------------------------------
+                        POLYVAL over whole blocks
+ S = dot(S ^ X_i, H) per block, four blocks per reduction.
+-------------------------------------------------------------------------*/
+void polyval_update(POLYVAL_CTX *ctx, const uint8_t *data, size_t nblocks)
+{
+    uint64_t c[4], x[2];
+
+    while(nblocks >= POLYVAL_POWERS)
+    {
+        c[0] = c[1] = c[2] = c[3] = 0;
+        for(uint8_t i = 0; i < POLYVAL_POWERS; i++)
+        {
+            x[0] = load64_le(data + AES_BLOCK*i);
+            x[1] = load64_le(data + AES_BLOCK*i + 8);
+            if(i == 0)
+            {
+                x[0] ^= ctx->s[0];
+                x[1] ^= ctx->s[1];
+            }
+            polyval_mul_acc(x, ctx->h[POLYVAL_POWERS - 1 - i], c);
+        }
+        polyval_reduce(c, ctx->s);
+        data += POLYVAL_POWERS*AES_BLOCK;
+        nblocks -= POLYVAL_POWERS;
+    }
+    for(; nblocks > 0; nblocks--, data += AES_BLOCK)
+    {
+        x[0] = ctx->s[0] ^ load64_le(data);
+        x[1] = ctx->s[1] ^ load64_le(data + 8);
+        polyval_dot(x, ctx->h[0], ctx->s);
+    }
+}
+
+/*-------------------------------------------------------------------------
+            POLYVAL over len bytes, last block zero padded
+-------------------------------------------------------------------------*/
+void polyval_update_padded(POLYVAL_CTX *ctx, const uint8_t *data, size_t len)
+{
+    uint8_t blk[AES_BLOCK];
+
+    polyval_update(ctx, data, len / AES_BLOCK);
+    if(len % AES_BLOCK)
+    {
+        memset(blk, 0, AES_BLOCK);
+        memcpy(blk, data + len - len % AES_BLOCK, len % AES_BLOCK);
+        polyval_update(ctx, blk, 1);
+    }
+}
+
+/*-------------------------------------------------------------------------
+                            POLYVAL Final
+-------------------------------------------------------------------------*/
+void polyval_final(const POLYVAL_CTX *ctx, uint8_t *out)
+{
+    store64_le(out, ctx->s[0]);
+    store64_le(out + 8, ctx->s[1]);
+}
+
+#endif /* aes_polyval_h */
@@ -0,0 +1,319 @@
+#ifndef aes_rekey_h
+#define aes_rekey_h
+#include <time.h>
+#include <errno.h>
+#include "aes_block.h"
+#include "aes_ctr.h"
+#include "aes_xts.h"
+#include "aes_thread.h"
+
+/*
+    Key rotation: data encrypted under an old key is re-encrypted under a
+    new one in a single pass.
+
+    The data is cut into tiles of REKEY_TILE bytes (whole sectors for XTS).
+    Each tile is decrypted under the old key into the output buffer and
+    encrypted under the new key right after, while the plaintext is still
+    in L1/L2. The plaintext never makes a trip through memory. Tiles are
+    spread across cores with aes_parallel_for. Either side may be XTS
+    (sector number = offset / sector size) or CTR (counter = iv + offset /
+    16), so any aligned offset can be processed on its own.
+
+    The file driver works in REKEY_CHUNK pieces. It reports the offset
+    after each chunk is on disk, so an interrupted run can resume from
+    there. In place, the old ciphertext of each chunk goes to a journal
+    before the chunk is overwritten, and a resume puts it back first, so a
+    crash halfway through a chunk loses nothing. It is paced to a bandwidth
+    cap so it can run beside production traffic.
+*/
+
+#define REKEY_TILE (32*1024)         //bytes re-encrypted in cache per step
+#define REKEY_CHUNK (8*1024*1024)    //file I/O unit
+#define REKEY_JOURNAL_DATA 4096      //journal: header sector, then the old chunk
+
+typedef enum aes_rekey_mode
+{
+    AES_REKEY_XTS,
+    AES_REKEY_CTR
+}AES_REKEY_MODE;
+
+typedef struct aes_rekey_key
+{
+    AES_REKEY_MODE mode;
+    AES_XTS_CTX xts;
+    AES_CTX ctr;
+    uint8_t iv[16];                  //CTR counter block at offset 0
+}AES_REKEY_KEY;
+
+typedef struct aes_rekey
+{
+    const AES_REKEY_KEY *from, *to;
+    size_t sector_size;              //XTS data unit, a multiple of 16
+    unsigned threads;                //0 uses every online core
+    uint64_t bw_limit;               //bytes per second, 0 for no cap
+    void (*progress)(void *arg, uint64_t done); //file driver, after each chunk
+    void *arg;
+    bool journaled;                  //file driver in place: keep old chunks in journal_fd
+    int journal_fd;
+}AES_REKEY;
+
+/*-------------------------------------------------------------------------
+                        Old / new key setup
+ pre: XTS key of 32 (type 0) or 64 (type 2) bytes; CTR key of 16, 24 or 32
+      bytes and a 16-byte counter block.
+-------------------------------------------------------------------------*/
+void aes_rekey_key_xts(AES_REKEY_KEY *k, const uint8_t *key, uint8_t type)
+{
+    k->mode = AES_REKEY_XTS;
+    aes_xts_setkey(&k->xts, key, type);
+}
+
+void aes_rekey_key_ctr(AES_REKEY_KEY *k, const uint8_t *key, uint8_t type, const uint8_t *iv)
+{
+    k->mode = AES_REKEY_CTR;
+    aes_setkey_enc(&k->ctr, key, type);
+    memcpy(k->iv, iv, AES_BLOCK);
+}
+
+void aes_rekey_key_wipe(AES_REKEY_KEY *k)
+{
+    volatile uint8_t *p = (volatile uint8_t*)k;
+
+    for(size_t i = 0; i < sizeof(AES_REKEY_KEY); i++)
+        p[i] = 0;
+}
+
+/*-------------------------------------------------------------------------
+                    One side over a tile at offset
+-------------------------------------------------------------------------*/
+static void rekey_side(const AES_REKEY_KEY *k, size_t sector_size, uint64_t offset, const uint8_t *in, uint8_t *out, size_t len, bool decrypt)
+{
+    uint8_t ctr[AES_BLOCK];
+
+    if(k->mode == AES_REKEY_CTR)
+    {
+        memcpy(ctr, k->iv, AES_BLOCK);
+        ctr128_add(ctr, offset / AES_BLOCK);
+        aes_ctr_xor(&k->ctr, ctr, in, out, len);
+        return;
+    }
+    for(size_t s = 0; s < len; s += sector_size)
+    {
+        if(decrypt)
+            aes_xts_decrypt(&k->xts, (offset + s) / sector_size, in + s, out + s, sector_size);
+        else
+            aes_xts_encrypt(&k->xts, (offset + s) / sector_size, in + s, out + s, sector_size);
+    }
+}
+
+typedef struct rekey_job
+{
+    const AES_REKEY *r;
+    uint64_t offset;
+    const uint8_t *in;
+    uint8_t *out;
+    size_t len, tile;
+}REKEY_JOB;
+
+static void rekey_tiles(void *arg, size_t lo, size_t hi)
+{
+    REKEY_JOB *j = (REKEY_JOB*)arg;
+    size_t off, n;
+
+    for(size_t t = lo; t < hi; t++)
+    {
+        off = t * j->tile;
+        n = j->len - off < j->tile? j->len - off : j->tile;
+        rekey_side(j->r->from, j->r->sector_size, j->offset + off, j->in + off, j->out + off, n, true);
+        rekey_side(j->r->to, j->r->sector_size, j->offset + off, j->out + off, j->out + off, n, false);
+    }
+}
+
+/*-------------------------------------------------------------------------
+                        RE-ENCRYPT A BUFFER
+ pre: in holds len bytes of the data at offset; out may equal in. XTS:
+      offset and len whole sectors; CTR: offset a multiple of 16.
+ post: out holds the data under the new key. Returns 0, or -1 on a
+       misaligned offset or length.
+-------------------------------------------------------------------------*/
+int aes_rekey_buffer(const AES_REKEY *r, uint64_t offset, const uint8_t *in, uint8_t *out, size_t len)
+{
+    bool xts = r->from->mode == AES_REKEY_XTS || r->to->mode == AES_REKEY_XTS;
+    size_t tile = REKEY_TILE;
+    REKEY_JOB j;
+
+    if(offset % AES_BLOCK)
+        return -1;
+    if(xts)
+    {
+        if(r->sector_size < AES_BLOCK || r->sector_size % AES_BLOCK || offset % r->sector_size || len % r->sector_size)
+            return -1;
+        tile = r->sector_size > tile? r->sector_size : tile - tile % r->sector_size;
+    }
+    j = (REKEY_JOB){r, offset, in, out, len, tile};
+    aes_parallel_for((len + tile - 1) / tile, r->threads, rekey_tiles, &j);
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                Pace to bw_limit: sleep until bytes are due
+-------------------------------------------------------------------------*/
+static double rekey_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void rekey_pace(uint64_t bw_limit, double start, uint64_t bytes)
+{
+    double due, wait;
+    struct timespec ts;
+
+    if(bw_limit == 0)
+        return;
+    due = start + (double)bytes / (double)bw_limit;
+    wait = due - rekey_now();
+    if(wait <= 0)
+        return;
+    ts.tv_sec = (time_t)wait;
+    ts.tv_nsec = (long)((wait - (double)ts.tv_sec) * 1e9);
+    while(nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+/*-------------------------------------------------------------------------
+        Journal of the chunk in flight: the old ciphertext is synced
+        first, then the header (magic, offset, length) that makes it valid
+-------------------------------------------------------------------------*/
+static int rekey_pio(int fd, uint8_t *buf, size_t len, uint64_t off, bool write)
+{
+    ssize_t n;
+
+    while(len > 0)
+    {
+        n = write? pwrite(fd, buf, len, (off_t)off) : pread(fd, buf, len, (off_t)off);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        buf += n;
+        len -= (size_t)n;
+        off += (uint64_t)n;
+    }
+    return 0;
+}
+
+static int rekey_journal_save(int jfd, uint64_t offset, uint8_t *old, size_t len)
+{
+    uint8_t hdr[24];
+
+    memcpy(hdr, "AESRKJ01", 8);
+    store64_le(hdr + 8, offset);
+    store64_le(hdr + 16, len);
+    if(rekey_pio(jfd, old, len, REKEY_JOURNAL_DATA, true) != 0 || fdatasync(jfd) != 0)
+        return -1;
+    if(rekey_pio(jfd, hdr, sizeof(hdr), 0, true) != 0 || fdatasync(jfd) != 0)
+        return -1;
+    return 0;
+}
+
+//a record for the resume offset means the chunk there may be half written
+static int rekey_journal_restore(int jfd, int out_fd, uint64_t offset, uint8_t *buf, size_t chunk)
+{
+    uint8_t hdr[24];
+    uint64_t len;
+
+    if(pread(jfd, hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) || memcmp(hdr, "AESRKJ01", 8) != 0
+       || load64_le(hdr + 8) != offset)
+        return 0;
+    len = load64_le(hdr + 16);
+    if(len == 0 || len > chunk || rekey_pio(jfd, buf, (size_t)len, REKEY_JOURNAL_DATA, false) != 0)
+        return -1;
+    if(rekey_pio(out_fd, buf, (size_t)len, offset, true) != 0 || fdatasync(out_fd) != 0)
+        return -1;
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                        RE-ENCRYPT A FILE RANGE
+ pre: [offset, end) of in_fd, aligned as for aes_rekey_buffer (end may be
+      the end of the file). out_fd may equal in_fd for rotation in place;
+      set journaled and a journal_fd then, and keep the journal between
+      a run and its resume (empty it to start a new rotation).
+ post: returns 0, or -1 on an I/O error or bad alignment. *done (and the
+       progress callback) hold the offset up to which the output is on
+       disk, so a later call from *done resumes the rotation. The journal
+       is emptied when the range is done.
+-------------------------------------------------------------------------*/
+int aes_rekey_file(const AES_REKEY *r, int in_fd, int out_fd, uint64_t offset, uint64_t end, uint64_t *done)
+{
+    uint8_t *buf;
+    size_t chunk = REKEY_CHUNK, n, got;
+    double start = rekey_now();
+    uint64_t moved = 0;
+    ssize_t rc;
+    int ret = 0;
+
+    if(r->sector_size > 0 && chunk % r->sector_size)
+        chunk -= chunk % r->sector_size;
+    buf = malloc(chunk);
+    if(buf == NULL)
+        return -1;
+    *done = offset;
+    if(r->journaled && rekey_journal_restore(r->journal_fd, out_fd, offset, buf, chunk) != 0)
+    {
+        free(buf);
+        return -1;
+    }
+
+    while(offset < end)
+    {
+        n = end - offset < chunk? (size_t)(end - offset) : chunk;
+        for(got = 0; got < n; got += (size_t)rc)
+        {
+            rc = pread(in_fd, buf + got, n - got, (off_t)(offset + got));
+            if(rc < 0 && errno == EINTR) { rc = 0; continue; }
+            if(rc < 0) { ret = -1; break; }
+            if(rc == 0) break;
+        }
+        if(ret != 0 || got == 0)
+            break;
+        if(r->journaled && rekey_journal_save(r->journal_fd, offset, buf, got) != 0)
+        {
+            ret = -1;
+            break;
+        }
+        if(aes_rekey_buffer(r, offset, buf, buf, got) != 0)
+        {
+            ret = -1;
+            break;
+        }
+        for(size_t put = 0; put < got; put += (size_t)rc)
+        {
+            rc = pwrite(out_fd, buf + put, got - put, (off_t)(offset + put));
+            if(rc < 0 && errno == EINTR) { rc = 0; continue; }
+            if(rc <= 0) { ret = -1; break; }
+        }
+        if(ret != 0 || fdatasync(out_fd) != 0)
+        {
+            ret = -1;
+            break;
+        }
+        offset += got;
+        *done = offset;
+        if(r->progress)
+            r->progress(r->arg, offset);
+        moved += got;
+        rekey_pace(r->bw_limit, start, moved);
+        if(got < n)
+            break;
+    }
+    if(ret == 0 && r->journaled && (ftruncate(r->journal_fd, 0) != 0 || fdatasync(r->journal_fd) != 0))
+        ret = -1;
+    memset(buf, 0, chunk);
+    free(buf);
+    return ret;
+}
+
+#endif /* aes_rekey_h */
@@ -0,0 +1,317 @@
+#ifndef aes_shmring_h
+#define aes_shmring_h
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/memfd.h>
+#include "aes_block.h"
+#include "aes_ocb.h"
+#include "aes_drbg.h"
+
+/*
+    Encrypted message ring in shared memory, for processes on one host
+    that must not leave plaintext in the segment.
+
+        header   "AESRING1", slot count, slot size, nonce salt,
+                 head and tail on their own cache lines
+        slot i   seq (8), len (4), 4 zero, tag (16), slot size bytes of data
+
+    The ring is a bounded MPSC queue: any number of producers, one
+    consumer. Every slot has a sequence word. Position p is free when the
+    sequence of its slot is p, and full when it is p + 1. A producer claims
+    a run of positions with one CAS on head, encrypts each message straight
+    into its slot with OCB and publishes it by storing the sequence.
+    The consumer opens each slot into its own buffer, then hands the slot
+    back by storing p + slot count. With one producer the CAS never
+    retries and the ring is SPSC.
+
+    Nothing is allocated per message. The nonce is the 7-byte salt drawn
+    when the ring is created followed by the position (big-endian 64).
+    Positions never repeat in a ring, so no nonce is used twice. The
+    length is the associated data. A message moved to another slot, cut
+    short or edited fails its tag.
+*/
+
+#define SHMRING_MAGIC "AESRING1"
+#define SHMRING_SLOT_HDR 32
+
+typedef struct aes_shmring_hdr
+{
+    char magic[8];
+    uint32_t nslots, slot_size;
+    uint8_t salt[8];                                  //7 used
+    uint64_t head __attribute__((aligned(64)));       //next position to claim
+    uint64_t tail __attribute__((aligned(64)));       //next position to consume
+}AES_SHMRING_HDR;
+
+typedef struct aes_shmring_slot
+{
+    uint64_t seq;
+    uint32_t len, zero;
+    uint8_t tag[16];
+    uint8_t data[];
+}AES_SHMRING_SLOT;
+
+typedef struct aes_shmring
+{
+    const AES_OCB_CTX *key;          //16-byte tags
+    AES_SHMRING_HDR *hdr;
+    uint8_t *slots;
+    size_t stride, map_len;
+    uint32_t slot_size;              //kept here, the segment is shared
+    uint64_t mask;
+    int fd;                          //memfd from create, -1 after attach
+}AES_SHMRING;
+
+typedef struct aes_shmring_msg
+{
+    uint8_t *buf;                    //recv: at least slot size bytes
+    size_t len;                      //recv: set to the message length
+    int status;                      //recv: 0, or -1 on a bad tag
+}AES_SHMRING_MSG;
+
+static AES_SHMRING_SLOT *shmring_slot(const AES_SHMRING *r, uint64_t pos)
+{
+    return (AES_SHMRING_SLOT*)(r->slots + (pos & r->mask) * r->stride);
+}
+
+static void shmring_nonce(const AES_SHMRING *r, uint64_t pos, uint8_t *nonce)
+{
+    memcpy(nonce, r->hdr->salt, 7);
+    for(int i = 0; i < 8; i++)
+        nonce[7 + i] = (uint8_t)(pos >> (56 - 8 * i));
+}
+
+static void shmring_seal(const AES_SHMRING *r, uint64_t pos, AES_SHMRING_SLOT *s, const uint8_t *in, size_t len)
+{
+    uint8_t nonce[15], ad[4];
+
+    shmring_nonce(r, pos, nonce);
+    for(int i = 0; i < 4; i++)
+        ad[i] = (uint8_t)(len >> (8 * i));
+    s->len = (uint32_t)len;
+    aes_ocb_encrypt(r->key, nonce, 15, ad, 4, in, s->data, len, s->tag);
+    __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+static int shmring_map(AES_SHMRING *r, const AES_OCB_CTX *key, int fd, size_t map_len)
+{
+    r->key = key;
+    r->map_len = map_len;
+    r->hdr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(r->hdr == MAP_FAILED)
+        return -1;
+    r->slots = (uint8_t*)r->hdr + sizeof(AES_SHMRING_HDR);
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                        Close a ring
+ post: unmapped; the memfd of a created ring is closed. The segment lives
+       on while another process has it mapped.
+-------------------------------------------------------------------------*/
+void aes_shmring_close(AES_SHMRING *r)
+{
+    munmap(r->hdr, r->map_len);
+    if(r->fd >= 0)
+        close(r->fd);
+}
+
+/*-------------------------------------------------------------------------
+                        CREATE / ATTACH A RING
+ pre: key with 16-byte tags; nslots a power of two; slot_size at most
+      2^32 - 1. The fd of a created ring reaches other processes by fork
+      or SCM_RIGHTS, and each one attaches it with the same key.
+ post: returns 0, or -1 on bad arguments, a segment that is not a ring,
+       or a failed memfd / mmap.
+-------------------------------------------------------------------------*/
+int aes_shmring_create(AES_SHMRING *r, const AES_OCB_CTX *key, uint32_t nslots, uint32_t slot_size)
+{
+    size_t stride = (SHMRING_SLOT_HDR + (size_t)slot_size + 63) & ~(size_t)63;
+    size_t map_len = sizeof(AES_SHMRING_HDR) + (size_t)nslots * stride;
+
+    if(nslots == 0 || (nslots & (nslots - 1)) || slot_size == 0)
+        return -1;
+    r->fd = (int)syscall(__NR_memfd_create, "aes_shmring", MFD_CLOEXEC);
+    if(r->fd < 0)
+        return -1;
+    if(ftruncate(r->fd, (off_t)map_len) != 0 || shmring_map(r, key, r->fd, map_len) != 0)
+    {
+        close(r->fd);
+        return -1;
+    }
+    r->stride = stride;
+    r->mask = nslots - 1;
+    memcpy(r->hdr->magic, SHMRING_MAGIC, 8);
+    r->hdr->nslots = nslots;
+    r->hdr->slot_size = r->slot_size = slot_size;
+    if(aes_random(r->hdr->salt, 7) != 0)
+    {
+        aes_shmring_close(r);
+        return -1;
+    }
+    for(uint64_t i = 0; i < nslots; i++)
+        shmring_slot(r, i)->seq = i;
+    return 0;
+}
+
+int aes_shmring_attach(AES_SHMRING *r, const AES_OCB_CTX *key, int fd)
+{
+    AES_SHMRING_HDR h;
+    struct stat st;
+
+    if(fstat(fd, &st) != 0 || pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h))
+        return -1;
+    if(memcmp(h.magic, SHMRING_MAGIC, 8) != 0 || h.nslots == 0 || (h.nslots & (h.nslots - 1)))
+        return -1;
+    r->stride = (SHMRING_SLOT_HDR + (size_t)h.slot_size + 63) & ~(size_t)63;
+    if((uint64_t)st.st_size != sizeof(AES_SHMRING_HDR) + (uint64_t)h.nslots * r->stride)
+        return -1;
+    r->fd = -1;
+    r->slot_size = h.slot_size;
+    r->mask = h.nslots - 1;
+    return shmring_map(r, key, fd, (size_t)st.st_size);
+}
+
+/*-------------------------------------------------------------------------
+                            Claim positions
+ post: up to n consecutive positions from *pos claimed, 0 if the ring is
+       full.
+-------------------------------------------------------------------------*/
+static size_t shmring_claim(AES_SHMRING *r, size_t n, uint64_t *pos)
+{
+    uint64_t p = __atomic_load_n(&r->hdr->head, __ATOMIC_RELAXED), seq = 0;
+    size_t k;
+
+    for(;;)
+    {
+        for(k = 0; k < n; k++)
+        {
+            seq = __atomic_load_n(&shmring_slot(r, p + k)->seq, __ATOMIC_ACQUIRE);
+            if(seq != p + k)
+                break;
+        }
+        if(k == 0)
+        {
+            //behind the consumer: full; behind another producer: retry
+            if((int64_t)(seq - p) < 0)
+                return 0;
+            p = __atomic_load_n(&r->hdr->head, __ATOMIC_RELAXED);
+            continue;
+        }
+        if(__atomic_compare_exchange_n(&r->hdr->head, &p, p + k, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+    }
+    *pos = p;
+    return k;
+}
+
+/*-------------------------------------------------------------------------
+                            PUBLISH MESSAGES
+ pre: every message at most slot size bytes.
+ post: a prefix of the messages is encrypted into the ring and visible to
+       the consumer. Returns how many, 0 when the ring is full, or -1 when
+       a message is too long (nothing sent).
+-------------------------------------------------------------------------*/
+long aes_shmring_send_batch(AES_SHMRING *r, const AES_SHMRING_MSG *msgs, size_t n)
+{
+    uint64_t pos;
+    size_t k;
+
+    if(n == 0)
+        return 0;
+    for(size_t i = 0; i < n; i++)
+        if(msgs[i].len > r->slot_size)
+            return -1;
+    k = shmring_claim(r, n, &pos);
+    for(size_t i = 0; i < k; i++)
+        shmring_seal(r, pos + i, shmring_slot(r, pos + i), msgs[i].buf, msgs[i].len);
+    return (long)k;
+}
+
+int aes_shmring_send(AES_SHMRING *r, const uint8_t *msg, size_t len)
+{
+    AES_SHMRING_MSG m = {(uint8_t*)msg, len, 0};
+
+    return aes_shmring_send_batch(r, &m, 1) == 1? 0 : -1;
+}
+
+/*-------------------------------------------------------------------------
+                        Zero-copy publish in place
+ post: reserve returns a slot's data area to build a message in, or NULL
+       when the ring is full. commit encrypts it in place and publishes
+       it. Plaintext sits in the segment between the two calls.
+-------------------------------------------------------------------------*/
+uint8_t *aes_shmring_reserve(AES_SHMRING *r, uint64_t *pos)
+{
+    return shmring_claim(r, 1, pos) == 1? shmring_slot(r, *pos)->data : NULL;
+}
+
+int aes_shmring_commit(AES_SHMRING *r, uint64_t pos, size_t len)
+{
+    AES_SHMRING_SLOT *s = shmring_slot(r, pos);
+
+    //a bad length still has to publish, or the consumer stalls on pos
+    if(len > r->slot_size)
+    {
+        memset(s->data, 0, r->slot_size);
+        shmring_seal(r, pos, s, s->data, 0);
+        return -1;
+    }
+    shmring_seal(r, pos, s, s->data, len);
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                            CONSUME MESSAGES
+ pre: one consumer per ring; each buf at least slot size bytes.
+ post: up to n messages decrypted into msgs in order and their slots
+       handed back. Returns how many, 0 when the ring is empty. A
+       message that fails its tag has status -1 and a wiped buf.
+-------------------------------------------------------------------------*/
+size_t aes_shmring_recv_batch(AES_SHMRING *r, AES_SHMRING_MSG *msgs, size_t n)
+{
+    uint64_t pos = __atomic_load_n(&r->hdr->tail, __ATOMIC_RELAXED);
+    uint8_t nonce[15], ad[4];
+    AES_SHMRING_SLOT *s;
+    uint32_t len;
+    size_t i;
+
+    for(i = 0; i < n; i++, pos++)
+    {
+        s = shmring_slot(r, pos);
+        if(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != pos + 1)
+            break;
+        //read the length once, the other side may still write to it
+        len = __atomic_load_n(&s->len, __ATOMIC_RELAXED);
+        msgs[i].len = len <= r->slot_size? len : 0;
+        msgs[i].status = -1;
+        if(len <= r->slot_size)
+        {
+            shmring_nonce(r, pos, nonce);
+            for(int j = 0; j < 4; j++)
+                ad[j] = (uint8_t)(len >> (8 * j));
+            msgs[i].status = aes_ocb_decrypt(r->key, nonce, 15, ad, 4, s->data, msgs[i].buf, len, s->tag);
+        }
+        __atomic_store_n(&s->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&r->hdr->tail, pos, __ATOMIC_RELEASE);
+    return i;
+}
+
+/*-------------------------------------------------------------------------
+ post: returns the message length, -1 when the ring is empty, or -2 on a
+       bad tag.
+-------------------------------------------------------------------------*/
+long aes_shmring_recv(AES_SHMRING *r, uint8_t *buf)
+{
+    AES_SHMRING_MSG m = {buf, 0, 0};
+
+    if(aes_shmring_recv_batch(r, &m, 1) == 0)
+        return -1;
+    return m.status == 0? (long)m.len : -2;
+}
+
+#endif /* aes_shmring_h */
@@ -0,0 +1,208 @@
+#ifndef aes_siv_h
+#define aes_siv_h
+#include <sys/uio.h>
+#include "aes_block.h"
+#include "aes_cmac.h"
+#include "aes_ctr.h"
+
+/*
+    AES-SIV deterministic authenticated encryption (RFC 5297).
+
+    The key is K1 || K2 (32, 48 or 64 bytes): K1 keys the CMAC-based S2V
+    over the associated-data components and the plaintext, K2 keys CTR
+    under the synthetic IV V. A nonce, if used, is passed as the last AD
+    component.
+
+    For short records the fixed costs dominate, so CMAC(K1, <zero>), the
+    first value of every S2V chain, is computed once at key setup and the
+    last component is fed to CMAC incrementally instead of being copied to
+    apply xorend. The batch calls also pack the CTR blocks of consecutive
+    records into the same kernel passes, so a 100-byte record does not run
+    a 7-lane pass of its own.
+*/
+
+#define SIV_MAX_AD 126 //AD components, S2V takes at most 127 strings with the plaintext
+
+typedef struct aes_siv_ctx
+{
+    AES_CMAC_KEY mac; //K1
+    AES_CTX ctr;      //K2
+    uint8_t d0[16];   //CMAC(K1, <zero>)
+}AES_SIV_CTX;
+
+typedef struct aes_siv_record
+{
+    const struct iovec *ad; //associated data components, nonce last if any
+    size_t nad;
+    const uint8_t *in;
+    uint8_t *out;           //may equal in
+    size_t len;
+    uint8_t *siv;           //16 bytes, written on seal and checked on open
+    int status;             //set by the batch calls: 0 ok, -1 too many AD or bad SIV
+}AES_SIV_RECORD;
+
+/*-------------------------------------------------------------------------
+                            SIV Key Setup
+ pre: key of 32, 48 or 64 bytes; type (0) 128, (1) 192, (2) 256 for each half.
+-------------------------------------------------------------------------*/
+void aes_siv_setkey(AES_SIV_CTX *ctx, const uint8_t *key, uint8_t type)
+{
+    uint8_t zero[AES_BLOCK];
+
+    aes_cmac_setkey(&ctx->mac, key, type);
+    aes_setkey_enc(&ctx->ctr, key + 16 + 8*type, type);
+    memset(zero, 0, AES_BLOCK);
+    aes_cmac(&ctx->mac, zero, AES_BLOCK, ctx->d0);
+}
+
+/*-------------------------------------------------------------------------
+                                S2V
+ D = CMAC(<zero>), D = dbl(D) ^ CMAC(S_i) over the AD components, then
+ V = CMAC(S_n xorend D) or CMAC(dbl(D) ^ pad(S_n)) for the plaintext S_n.
+-------------------------------------------------------------------------*/
+static void siv_s2v(const AES_SIV_CTX *ctx, const struct iovec *ad, size_t nad, const uint8_t *pt, size_t len, uint8_t *v)
+{
+    uint8_t d[AES_BLOCK], m[AES_BLOCK], t[AES_BLOCK];
+    AES_CMAC c;
+
+    memcpy(d, ctx->d0, AES_BLOCK);
+    for(size_t i = 0; i < nad; i++)
+    {
+        aes_cmac(&ctx->mac, (const uint8_t*)ad[i].iov_base, ad[i].iov_len, m);
+        cmac_dbl(d, d);
+        xor_block(d, d, m);
+    }
+
+    aes_cmac_init(&c, &ctx->mac);
+    if(len >= AES_BLOCK)
+    {
+        aes_cmac_update(&c, pt, len - AES_BLOCK);
+        xor_block(t, pt + len - AES_BLOCK, d);
+    }
+    else
+    {
+        cmac_dbl(d, d);
+        memset(t, 0, AES_BLOCK);
+        memcpy(t, pt, len);
+        t[len] = 0x80;
+        xor_block(t, t, d);
+    }
+    aes_cmac_update(&c, t, AES_BLOCK);
+    aes_cmac_final(&c, v);
+}
+
+/*-------------------------------------------------------------------------
+                CTR under Q = V with bits 63 and 31 cleared
+-------------------------------------------------------------------------*/
+static inline void siv_q(const uint8_t *v, uint8_t *q)
+{
+    memcpy(q, v, AES_BLOCK);
+    q[8] &= 0x7f;
+    q[12] &= 0x7f;
+}
+
+/*-------------------------------------------------------------------------
+                CTR over a run of records, packed across records
+ the keystream blocks of consecutive records share kernel passes.
+-------------------------------------------------------------------------*/
+static void siv_ctr_records(const AES_SIV_CTX *ctx, AES_SIV_RECORD *recs, size_t n)
+{
+    uint8_t ks[AES_LANES*AES_BLOCK], q[AES_BLOCK];
+    size_t owner[AES_LANES], off[AES_LANES];
+    size_t r = 0, pos = 0, lanes, take;
+
+    //skip records that failed their checks or are empty
+    while(r < n && (recs[r].status != 0 || recs[r].len == 0)) r++;
+    if(r < n) siv_q(recs[r].siv, q);
+
+    while(r < n)
+    {
+        lanes = 0;
+        while(lanes < AES_LANES && r < n)
+        {
+            memcpy(ks + AES_BLOCK*lanes, q, AES_BLOCK);
+            ctr128_inc(q);
+            owner[lanes] = r;
+            off[lanes] = pos;
+            lanes++;
+            pos += AES_BLOCK;
+            if(pos >= recs[r].len)
+            {
+                pos = 0;
+                r++;
+                while(r < n && (recs[r].status != 0 || recs[r].len == 0)) r++;
+                if(r < n) siv_q(recs[r].siv, q);
+            }
+        }
+        aes_encrypt_lanes(&ctx->ctr, ks, ks, lanes);
+        for(size_t l = 0; l < lanes; l++)
+        {
+            take = recs[owner[l]].len - off[l];
+            take = take < AES_BLOCK? take : AES_BLOCK;
+            for(size_t i = 0; i < take; i++)
+                recs[owner[l]].out[off[l] + i] = recs[owner[l]].in[off[l] + i] ^ ks[AES_BLOCK*l + i];
+        }
+    }
+}
+
+/*-------------------------------------------------------------------------
+                            SIV BATCH
+ post: recs[i].status set; on open a record whose SIV does not match has
+       its output wiped.
+-------------------------------------------------------------------------*/
+void aes_siv_seal_batch(const AES_SIV_CTX *ctx, AES_SIV_RECORD *recs, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        recs[i].status = recs[i].nad > SIV_MAX_AD? -1 : 0;
+        if(recs[i].status == 0)
+            siv_s2v(ctx, recs[i].ad, recs[i].nad, recs[i].in, recs[i].len, recs[i].siv);
+    }
+    siv_ctr_records(ctx, recs, n);
+}
+
+void aes_siv_open_batch(const AES_SIV_CTX *ctx, AES_SIV_RECORD *recs, size_t n)
+{
+    uint8_t v[AES_BLOCK], diff;
+
+    for(size_t i = 0; i < n; i++)
+        recs[i].status = recs[i].nad > SIV_MAX_AD? -1 : 0;
+    siv_ctr_records(ctx, recs, n);
+
+    for(size_t i = 0; i < n; i++)
+    {
+        if(recs[i].status != 0)
+            continue;
+        siv_s2v(ctx, recs[i].ad, recs[i].nad, recs[i].out, recs[i].len, v);
+        diff = 0;
+        for(uint8_t b = 0; b < AES_BLOCK; b++)
+            diff |= v[b] ^ recs[i].siv[b];
+        if(diff != 0)
+        {
+            memset(recs[i].out, 0, recs[i].len);
+            recs[i].status = -1;
+        }
+    }
+}
+
+/*-------------------------------------------------------------------------
+                            SIV SINGLE RECORD
+ post: returns 0, or -1 on too many AD components or (open) a SIV mismatch.
+-------------------------------------------------------------------------*/
+int aes_siv_seal(const AES_SIV_CTX *ctx, const struct iovec *ad, size_t nad, const uint8_t *in, uint8_t *out, size_t len, uint8_t *siv)
+{
+    AES_SIV_RECORD r = {ad, nad, in, out, len, siv, 0};
+
+    aes_siv_seal_batch(ctx, &r, 1);
+    return r.status;
+}
+
+int aes_siv_open(const AES_SIV_CTX *ctx, const struct iovec *ad, size_t nad, const uint8_t *in, uint8_t *out, size_t len, const uint8_t *siv)
+{
+    AES_SIV_RECORD r = {ad, nad, in, out, len, (uint8_t*)siv, 0};
+
+    aes_siv_open_batch(ctx, &r, 1);
+    return r.status;
+}
+
+#endif /* aes_siv_h */
@@ -0,0 +1,227 @@
+#ifndef aes_stream_h
+#define aes_stream_h
+#include "aes_block.h"
+#include "aes_cbc.h"
+#include "aes_ctr.h"
+
+/*
+    Streaming encryption context with init / update / final in the style of
+    OpenSSL's EVP_Cipher calls, over ECB, CBC and CTR.
+
+    update accepts input of any length. A partial block is kept in the
+    context, and the aligned middle of the input goes straight from the
+    caller's buffer to the bulk kernels without being copied. With PKCS#7
+    padding (the default for ECB and CBC), final pads on encryption. On
+    decryption update holds back the last whole block so final can check
+    and strip the padding. CTR needs no padding: the keystream left over
+    from a partial block is kept for the next update.
+*/
+
+typedef enum aes_mode
+{
+    AES_MODE_ECB,
+    AES_MODE_CBC,
+    AES_MODE_CTR
+}AES_MODE;
+
+typedef struct aes_stream
+{
+    AES_CTX key;
+    uint8_t iv[16];  //CBC chaining block or CTR counter
+    uint8_t buf[16]; //pending partial block (ECB, CBC) or keystream (CTR)
+    uint8_t n;       //bytes in buf, or keystream bytes used
+    AES_MODE mode;
+    bool decrypt;
+    bool padding;
+}AES_STREAM;
+
+/*-------------------------------------------------------------------------
+                            STREAM INIT
+ pre: type (0) 128, (1) 192, (2) 256; iv of 16 bytes for CBC and CTR.
+ post: returns 0, or -1 on an unknown mode or a missing iv.
+-------------------------------------------------------------------------*/
+int aes_stream_init(AES_STREAM *s, AES_MODE mode, const uint8_t *key, uint8_t type, const uint8_t *iv, bool decrypt)
+{
+    if(mode != AES_MODE_ECB && mode != AES_MODE_CBC && mode != AES_MODE_CTR)
+        return -1;
+    if(mode != AES_MODE_ECB && iv == NULL)
+        return -1;
+
+    //only ECB and CBC decryption run the inverse cipher
+    if(decrypt && mode != AES_MODE_CTR)
+        aes_setkey(&s->key, key, type);
+    else
+        aes_setkey_enc(&s->key, key, type);
+    if(iv)
+        memcpy(s->iv, iv, AES_BLOCK);
+    s->n = 0;
+    s->mode = mode;
+    s->decrypt = decrypt;
+    s->padding = mode != AES_MODE_CTR;
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                    PKCS#7 padding on (default) or off
+-------------------------------------------------------------------------*/
+void aes_stream_set_padding(AES_STREAM *s, bool padding)
+{
+    s->padding = padding && s->mode != AES_MODE_CTR;
+}
+
+/*-------------------------------------------------------------------------
+                    Whole blocks through the bulk kernels
+-------------------------------------------------------------------------*/
+static void stream_blocks(AES_STREAM *s, const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    if(s->mode == AES_MODE_CBC)
+    {
+        if(s->decrypt)
+            aes_cbc_decrypt(&s->key, s->iv, in, out, nblocks);
+        else
+            aes_cbc_encrypt(&s->key, s->iv, in, out, nblocks);
+    }
+    else if(s->decrypt)
+        aes_decrypt_blocks(&s->key, in, out, nblocks);
+    else
+        aes_encrypt_blocks(&s->key, in, out, nblocks);
+}
+
+/*-------------------------------------------------------------------------
+                        CTR update, any length
+-------------------------------------------------------------------------*/
+static void stream_ctr(AES_STREAM *s, const uint8_t *in, uint8_t *out, size_t len)
+{
+    size_t whole;
+
+    //keystream left from the last partial block
+    while(len > 0 && s->n > 0)
+    {
+        *out++ = *in++ ^ s->buf[s->n];
+        s->n = (s->n + 1) % AES_BLOCK;
+        len--;
+    }
+    whole = len - len % AES_BLOCK;
+    aes_ctr_xor(&s->key, s->iv, in, out, whole);
+    if(len % AES_BLOCK)
+    {
+        aes_ctr_keystream(&s->key, s->iv, s->buf, 1);
+        for(size_t i = 0; i < len % AES_BLOCK; i++)
+            out[whole + i] = in[whole + i] ^ s->buf[i];
+        s->n = (uint8_t)(len % AES_BLOCK);
+    }
+}
+
+/*-------------------------------------------------------------------------
+                            STREAM UPDATE
+ pre: out has room for len + 16 bytes, out may equal in (CTR) or not
+      overlap it (ECB, CBC, as a held back block is written first).
+ post: *outl bytes written to out.
+-------------------------------------------------------------------------*/
+int aes_stream_update(AES_STREAM *s, const uint8_t *in, size_t len, uint8_t *out, size_t *outl)
+{
+    size_t total = s->n + len, nblocks, take;
+
+    *outl = 0;
+    if(s->mode == AES_MODE_CTR)
+    {
+        stream_ctr(s, in, out, len);
+        *outl = len;
+        return 0;
+    }
+
+    //decryption with padding keeps 1 to 16 bytes back for final
+    if(s->decrypt && s->padding)
+        nblocks = total == 0? 0 : (total - 1) / AES_BLOCK;
+    else
+        nblocks = total / AES_BLOCK;
+
+    if(nblocks > 0 && s->n > 0)
+    {
+        take = AES_BLOCK - s->n;
+        memcpy(s->buf + s->n, in, take);
+        stream_blocks(s, s->buf, out, 1);
+        in += take;
+        len -= take;
+        out += AES_BLOCK;
+        *outl += AES_BLOCK;
+        s->n = 0;
+        nblocks--;
+    }
+    //aligned middle straight from the caller's buffer
+    if(nblocks > 0)
+    {
+        stream_blocks(s, in, out, nblocks);
+        in += nblocks*AES_BLOCK;
+        len -= nblocks*AES_BLOCK;
+        *outl += nblocks*AES_BLOCK;
+    }
+    memcpy(s->buf + s->n, in, len);
+    s->n += (uint8_t)len;
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                            STREAM FINAL
+ pre: out has room for 16 bytes.
+ post: returns 0, or -1 if the input was not a whole number of blocks
+       without padding, or the padding is not valid. The padding check does
+       not branch on the padding bytes.
+-------------------------------------------------------------------------*/
+int aes_stream_final(AES_STREAM *s, uint8_t *out, size_t *outl)
+{
+    uint8_t blk[AES_BLOCK], p, bad = 0;
+
+    *outl = 0;
+    if(s->mode == AES_MODE_CTR)
+    {
+        s->n = 0;
+        return 0;
+    }
+    if(!s->padding)
+        return s->n == 0? 0 : -1;
+
+    if(!s->decrypt)
+    {
+        p = (uint8_t)(AES_BLOCK - s->n);
+        memset(s->buf + s->n, p, p);
+        stream_blocks(s, s->buf, out, 1);
+        s->n = 0;
+        *outl = AES_BLOCK;
+        return 0;
+    }
+
+    if(s->n != AES_BLOCK)
+        return -1;
+    stream_blocks(s, s->buf, blk, 1);
+    s->n = 0;
+    p = blk[AES_BLOCK - 1];
+    bad |= (uint8_t)((p == 0) | (p > AES_BLOCK));
+    for(uint8_t i = 0; i < AES_BLOCK; i++)
+    {
+        //mask is 0xff for the last p bytes
+        uint8_t mask = (uint8_t)(0 - (uint8_t)(i >= AES_BLOCK - p));
+        bad |= mask & (blk[i] ^ p);
+    }
+    if(bad)
+    {
+        memset(blk, 0, AES_BLOCK);
+        return -1;
+    }
+    memcpy(out, blk, AES_BLOCK - p);
+    *outl = AES_BLOCK - p;
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                            STREAM WIPE
+-------------------------------------------------------------------------*/
+void aes_stream_wipe(AES_STREAM *s)
+{
+    volatile uint8_t *p = (volatile uint8_t*)s;
+
+    for(size_t i = 0; i < sizeof(AES_STREAM); i++)
+        p[i] = 0;
+}
+
+#endif /* aes_stream_h */
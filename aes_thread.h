@@ -0,0 +1,83 @@
+#ifndef aes_thread_h
+#define aes_thread_h
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+    Minimal fork-join helper for spreading independent units of work
+    (sectors, chunks, records) across cores with pthreads.
+*/
+
+typedef void (*AES_PAR_FN)(void *arg, size_t lo, size_t hi);
+
+typedef struct aes_par_job
+{
+    AES_PAR_FN fn;
+    void *arg;
+    size_t lo, hi;
+}AES_PAR_JOB;
+
+#define AES_MAX_THREADS 64
+
+/*-------------------------------------------------------------------------
+                        Number of online cores
+-------------------------------------------------------------------------*/
+unsigned aes_ncpu(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if(n < 1) return 1;
+    return n > AES_MAX_THREADS? AES_MAX_THREADS : (unsigned)n;
+}
+
+static void *aes_par_run(void *p)
+{
+    AES_PAR_JOB *job = (AES_PAR_JOB*)p;
+    job->fn(job->arg, job->lo, job->hi);
+    return NULL;
+}
+
+/*-------------------------------------------------------------------------
+                            Parallel For
+ pre: fn(arg, lo, hi) handles units [lo, hi) and is safe to run concurrently
+      on disjoint ranges. threads = 0 uses every online core.
+ post: [0, n) split into contiguous ranges, one per thread, the calling
+       thread takes the first range. Returns when every range is done.
+-------------------------------------------------------------------------*/
+void aes_parallel_for(size_t n, unsigned threads, AES_PAR_FN fn, void *arg)
+{
+    pthread_t tid[AES_MAX_THREADS];
+    AES_PAR_JOB job[AES_MAX_THREADS];
+    bool started[AES_MAX_THREADS];
+    size_t per;
+
+    if(threads == 0) threads = aes_ncpu();
+    if(threads > AES_MAX_THREADS) threads = AES_MAX_THREADS;
+    if(threads > n) threads = (unsigned)n;
+    if(threads <= 1)
+    {
+        if(n > 0) fn(arg, 0, n);
+        return;
+    }
+
+    per = n / threads;
+    for(unsigned t = 0; t < threads; t++)
+    {
+        job[t].fn = fn;
+        job[t].arg = arg;
+        job[t].lo = t * per + (t < n % threads? t : n % threads);
+        job[t].hi = job[t].lo + per + (t < n % threads? 1 : 0);
+    }
+
+    //a thread that cannot be started has its range run inline
+    for(unsigned t = 1; t < threads; t++)
+    {
+        started[t] = pthread_create(&tid[t], NULL, aes_par_run, &job[t]) == 0;
+        if(!started[t]) aes_par_run(&job[t]);
+    }
+    aes_par_run(&job[0]);
+    for(unsigned t = 1; t < threads; t++)
+        if(started[t]) pthread_join(tid[t], NULL);
+}
+
+#endif /* aes_thread_h */
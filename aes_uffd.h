@@ -0,0 +1,400 @@
+#ifndef aes_uffd_h
+#define aes_uffd_h
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+#include "aes_block.h"
+#include "aes_rekey.h"
+
+//UFFDIO_POISON (Linux 6.6) for headers that predate it
+#ifndef UFFDIO_POISON
+#define UFFD_FEATURE_POISON (1<<14)
+#define _UFFDIO_POISON (0x08)
+struct uffdio_poison
+{
+    struct uffdio_range range;
+    __u64 mode;
+    __s64 updated;
+};
+#define UFFDIO_POISON _IOWR(UFFDIO, _UFFDIO_POISON, struct uffdio_poison)
+#endif
+
+/*
+    Decrypt-on-fault memory regions: an encrypted file is mapped and each
+    page is decrypted the first time it is touched.
+
+    The region is anonymous memory registered with userfaultfd. A handler
+    thread waits on the descriptor. When a missing page faults it preads
+    the ciphertext, decrypts it into a bounce buffer and installs it with
+    UFFDIO_COPY, then wakes the faulting thread. A fault on the page
+    right after the previous one doubles the read-ahead window (up to
+    UFFD_RA_MAX pages), so a sequential scan costs one fault per window.
+    A random touch goes back to one page. Untouched pages are never read
+    or decrypted.
+
+    Pages are keyed the same way as aes_rekey.h: XTS with one data unit
+    per page (unit number = file offset / page size), or CTR with counter
+    = iv + file offset / 16. Either way a page decrypts on its own.
+
+    Writable regions install pages write-protected when the kernel has
+    userfaultfd write-protect. The first write to a page faults once more
+    and the handler marks it dirty. aes_uffd_sync re-encrypts just the
+    dirty pages, writes them back and protects them again. Without
+    write-protect every populated page counts as dirty.
+
+    A page whose ciphertext cannot be read is never handed out as
+    plaintext. Where the kernel has UFFDIO_POISON the page is poisoned, so
+    the access raises SIGBUS. Otherwise it reads as zeros, but it is not
+    present for aes_uffd_sync, which never writes it back. Either way the
+    error is kept: aes_uffd_error returns it, and aes_uffd_sync fails.
+*/
+
+#define UFFD_RA_MAX 32               //read-ahead window cap, pages
+
+typedef struct aes_uffd
+{
+    const AES_REKEY_KEY *key;
+    int fd;                          //encrypted file
+    uint64_t offset;                 //file offset of the region, page aligned
+    size_t len, map_len, page, npages;
+    uint8_t *base;                   //the mapping
+    uint8_t *buf;                    //bounce buffer, UFFD_RA_MAX pages
+    uint8_t *present, *dirty;        //one byte per page; present 2: failed read
+    bool writable, wp, poison;
+    int uffd, stop[2];
+    size_t last, ra;                 //previous fault and read-ahead window
+    uint64_t faults, pages_in;       //missing faults and pages decrypted
+    int err;                         //first I/O error seen by the handler
+    pthread_mutex_t lock;
+    pthread_t handler;
+}AES_UFFD;
+
+/*-------------------------------------------------------------------------
+            A page that could not be read: poisoned, or zeros
+-------------------------------------------------------------------------*/
+static int uffd_fail_page(AES_UFFD *r, size_t p, int err)
+{
+    struct uffdio_poison poison;
+    struct uffdio_copy copy;
+
+    if(!r->err)
+        r->err = err;
+    r->present[p] = 2;
+    if(r->poison)
+    {
+        poison.range.start = (uint64_t)(uintptr_t)(r->base + p * r->page);
+        poison.range.len = r->page;
+        poison.mode = 0;
+        poison.updated = 0;
+        if(ioctl(r->uffd, UFFDIO_POISON, &poison) == 0 || errno == EEXIST)
+            return 0;
+    }
+    //a zero page, so the faulting thread does not wait forever
+    memset(r->buf, 0, r->page);
+    copy.dst = (uint64_t)(uintptr_t)(r->base + p * r->page);
+    copy.src = (uint64_t)(uintptr_t)r->buf;
+    copy.len = r->page;
+    copy.mode = r->wp? UFFDIO_COPY_MODE_WP : 0;
+    copy.copy = 0;
+    if(ioctl(r->uffd, UFFDIO_COPY, &copy) != 0 && errno != EEXIST)
+        return -1;
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                    Populate a run of missing pages
+ post: pages [p, p+n) decrypted and installed, stopping early at a page
+       already present. A read error falls back to page p alone, which
+       is failed if it still cannot be read. Called with the lock held.
+-------------------------------------------------------------------------*/
+static int uffd_fill(AES_UFFD *r, size_t p, size_t n)
+{
+    struct uffdio_copy copy;
+    struct uffdio_range wake;
+    uint64_t at = r->offset + (uint64_t)p * r->page;
+    size_t bytes, want, got = 0;
+    ssize_t rc = 1;
+
+    for(size_t i = 1; i < n; i++)
+        if(r->present[p + i])
+            n = i;
+    bytes = n * r->page;
+    want = r->len - p * r->page < bytes? r->len - p * r->page : bytes;
+    while(got < want && rc != 0)
+    {
+        rc = pread(r->fd, r->buf + got, want - got, (off_t)(at + got));
+        if(rc < 0 && errno == EINTR)
+            continue;
+        if(rc < 0)
+            return n > 1? uffd_fill(r, p, 1) : uffd_fail_page(r, p, errno);
+        got += (size_t)rc;
+    }
+    //past the end of the file reads as zeros
+    memset(r->buf + got, 0, bytes - got);
+    rekey_side(r->key, r->page, at, r->buf, r->buf, got, true);
+
+    copy.dst = (uint64_t)(uintptr_t)(r->base + p * r->page);
+    copy.src = (uint64_t)(uintptr_t)r->buf;
+    copy.len = bytes;
+    copy.mode = UFFDIO_COPY_MODE_DONTWAKE | (r->wp? UFFDIO_COPY_MODE_WP : 0);
+    copy.copy = 0;
+    if(ioctl(r->uffd, UFFDIO_COPY, &copy) != 0 && errno != EEXIST)
+        return -1;
+    memset(r->present + p, 1, n);
+    r->pages_in += n;
+
+    //wake the faulting thread only once the bookkeeping is done
+    wake.start = copy.dst;
+    wake.len = bytes;
+    return ioctl(r->uffd, UFFDIO_WAKE, &wake);
+}
+
+/*-------------------------------------------------------------------------
+                        Fault handler thread
+-------------------------------------------------------------------------*/
+static void *uffd_handler(void *arg)
+{
+    AES_UFFD *r = (AES_UFFD*)arg;
+    struct pollfd pfd[2] = {{r->uffd, POLLIN, 0}, {r->stop[0], POLLIN, 0}};
+    struct uffdio_writeprotect wp;
+    struct uffd_msg msg;
+    size_t p, n;
+
+    for(;;)
+    {
+        if(poll(pfd, 2, -1) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        if(pfd[1].revents)
+            break;
+        if(read(r->uffd, &msg, sizeof(msg)) != sizeof(msg) || msg.event != UFFD_EVENT_PAGEFAULT)
+            continue;
+        p = (size_t)((uint8_t*)(uintptr_t)msg.arg.pagefault.address - r->base) / r->page;
+
+        pthread_mutex_lock(&r->lock);
+        if(msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP)
+        {
+            //first write since the last sync
+            r->dirty[p] = 1;
+            wp.range.start = (uint64_t)(uintptr_t)(r->base + p * r->page);
+            wp.range.len = r->page;
+            wp.mode = 0;
+            ioctl(r->uffd, UFFDIO_WRITEPROTECT, &wp);
+        }
+        else
+        {
+            r->faults++;
+            r->ra = r->faults > 1 && p == r->last + 1? r->ra * 2 : 1;
+            if(r->ra > UFFD_RA_MAX)
+                r->ra = UFFD_RA_MAX;
+            n = r->npages - p < r->ra? r->npages - p : r->ra;
+            if(uffd_fill(r, p, n) != 0 && !r->err)
+                r->err = errno;
+            //the next sequential fault lands just past the window
+            r->last = p + n - 1;
+        }
+        pthread_mutex_unlock(&r->lock);
+    }
+    return NULL;
+}
+
+//poison is asked for first; a kernel without it refuses the handshake
+static int uffd_open(bool want_wp, bool *wp, bool *poison)
+{
+    struct uffdio_api api;
+    int fd;
+
+    for(int k = 0; k < 2; k++)
+    {
+        //user-mode-only faults are allowed without privilege on newer kernels
+        fd = (int)syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+        if(fd < 0)
+            fd = (int)syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+        if(fd < 0)
+            return -1;
+        api.api = UFFD_API;
+        api.features = (want_wp? UFFD_FEATURE_PAGEFAULT_FLAG_WP : 0) | (k == 0? UFFD_FEATURE_POISON : 0);
+        if(ioctl(fd, UFFDIO_API, &api) == 0)
+        {
+            *wp = want_wp;
+            *poison = k == 0;
+            return fd;
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+/*-------------------------------------------------------------------------
+                        MAP AN ENCRYPTED FILE
+ pre: key set up with aes_rekey_key_xts or aes_rekey_key_ctr; offset a
+      multiple of the page size. XTS: len a multiple of the page size.
+ post: r->base maps len bytes of plaintext, decrypted on first touch.
+       Returns 0, or -1 when userfaultfd is unavailable or on bad
+       arguments.
+-------------------------------------------------------------------------*/
+int aes_uffd_map(AES_UFFD *r, const AES_REKEY_KEY *key, int fd, uint64_t offset, size_t len, bool writable)
+{
+    struct uffdio_register reg;
+
+    memset(r, 0, sizeof(AES_UFFD));
+    r->page = (size_t)sysconf(_SC_PAGESIZE);
+    if(len == 0 || offset % r->page || (key->mode == AES_REKEY_XTS && len % r->page))
+        return -1;
+    r->key = key;
+    r->fd = fd;
+    r->offset = offset;
+    r->len = len;
+    r->npages = (len + r->page - 1) / r->page;
+    r->map_len = r->npages * r->page;
+    r->writable = writable;
+
+    //write-protect needs its own UFFDIO_API handshake, so a fresh descriptor
+    r->uffd = writable? uffd_open(true, &r->wp, &r->poison) : -1;
+    if(r->uffd < 0 && (r->uffd = uffd_open(false, &r->wp, &r->poison)) < 0)
+        return -1;
+    r->base = mmap(NULL, r->map_len, PROT_READ | (writable? PROT_WRITE : 0), MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(r->base == MAP_FAILED)
+        goto fail_uffd;
+    reg.range.start = (uint64_t)(uintptr_t)r->base;
+    reg.range.len = r->map_len;
+    reg.mode = UFFDIO_REGISTER_MODE_MISSING | (r->wp? UFFDIO_REGISTER_MODE_WP : 0);
+    if(ioctl(r->uffd, UFFDIO_REGISTER, &reg) != 0)
+    {
+        //kernels with the feature but no anonymous write-protect
+        reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+        r->wp = false;
+        if(ioctl(r->uffd, UFFDIO_REGISTER, &reg) != 0)
+            goto fail_map;
+    }
+    r->buf = malloc(UFFD_RA_MAX * r->page);
+    r->present = calloc(r->npages, 1);
+    r->dirty = calloc(r->npages, 1);
+    if(!r->buf || !r->present || !r->dirty || pipe(r->stop) != 0)
+        goto fail_mem;
+    pthread_mutex_init(&r->lock, NULL);
+    if(pthread_create(&r->handler, NULL, uffd_handler, r) != 0)
+    {
+        pthread_mutex_destroy(&r->lock);
+        close(r->stop[0]);
+        close(r->stop[1]);
+        goto fail_mem;
+    }
+    return 0;
+
+fail_mem:
+    free(r->buf);
+    free(r->present);
+    free(r->dirty);
+fail_map:
+    munmap(r->base, r->map_len);
+fail_uffd:
+    close(r->uffd);
+    return -1;
+}
+
+/*-------------------------------------------------------------------------
+                        WRITE BACK DIRTY PAGES
+ pre: r mapped writable. Without write-protect, writers must be quiet
+      for the duration of the call.
+ post: every page written since the last sync is re-encrypted and on
+       the file (not fsynced). Pages whose read failed are never written.
+       Returns the number of pages written, or -1 on an I/O error now or
+       earlier in the handler (see aes_uffd_error).
+-------------------------------------------------------------------------*/
+long aes_uffd_sync(AES_UFFD *r)
+{
+    struct uffdio_writeprotect wp;
+    uint64_t at;
+    size_t n;
+    long pages = 0;
+    int res = 0;
+
+    if(!r->writable)
+        return 0;
+    pthread_mutex_lock(&r->lock);
+    for(size_t p = 0; p < r->npages && res == 0; p++)
+    {
+        if(r->present[p] != 1 || (r->wp && !r->dirty[p]))
+            continue;
+        //protect first: a write racing the copy faults and waits on the lock
+        if(r->wp)
+        {
+            wp.range.start = (uint64_t)(uintptr_t)(r->base + p * r->page);
+            wp.range.len = r->page;
+            wp.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+            ioctl(r->uffd, UFFDIO_WRITEPROTECT, &wp);
+        }
+        r->dirty[p] = 0;
+        at = r->offset + (uint64_t)p * r->page;
+        n = r->len - p * r->page < r->page? r->len - p * r->page : r->page;
+        memcpy(r->buf, r->base + p * r->page, n);
+        rekey_side(r->key, r->page, at, r->buf, r->buf, n, false);
+        if(pwrite(r->fd, r->buf, n, (off_t)at) != (ssize_t)n)
+            res = -1;
+        pages++;
+    }
+    if(r->err)
+        res = -1;
+    pthread_mutex_unlock(&r->lock);
+    return res? -1 : pages;
+}
+
+/*-------------------------------------------------------------------------
+                    First I/O error of the handler
+ post: 0, or the errno of the first read or fill that failed.
+-------------------------------------------------------------------------*/
+int aes_uffd_error(AES_UFFD *r)
+{
+    int err;
+
+    pthread_mutex_lock(&r->lock);
+    err = r->err;
+    pthread_mutex_unlock(&r->lock);
+    return err;
+}
+
+/*-------------------------------------------------------------------------
+                        Unmap a region
+ post: handler stopped, plaintext wiped and unmapped. Dirty pages not yet
+       synced are dropped.
+-------------------------------------------------------------------------*/
+void aes_uffd_unmap(AES_UFFD *r)
+{
+    volatile uint8_t *p;
+
+    if(write(r->stop[1], "", 1) == 1)
+        pthread_join(r->handler, NULL);
+    close(r->stop[0]);
+    close(r->stop[1]);
+
+    //closing the descriptor drops write-protect; holes now fill with zeros
+    close(r->uffd);
+    mprotect(r->base, r->map_len, PROT_READ | PROT_WRITE);
+    for(size_t i = 0; i < r->npages; i++)
+        if(r->present[i])
+        {
+            p = (volatile uint8_t*)(r->base + i * r->page);
+            for(size_t j = 0; j < r->page; j++)
+                p[j] = 0;
+        }
+    munmap(r->base, r->map_len);
+    p = r->buf;
+    for(size_t j = 0; j < UFFD_RA_MAX * r->page; j++)
+        p[j] = 0;
+    free(r->buf);
+    free(r->present);
+    free(r->dirty);
+    pthread_mutex_destroy(&r->lock);
+}
+
+#endif /* aes_uffd_h */
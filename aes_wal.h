@@ -0,0 +1,472 @@
+#ifndef aes_wal_h
+#define aes_wal_h
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "aes_block.h"
+#include "aes_ocb.h"
+#include "aes_drbg.h"
+#include "aes_thread.h"
+
+/*
+    Encrypted append-only log segment (write-ahead log) with group commit.
+
+        header  32 bytes   "AESWAL01", first sequence number (LE64),
+                           7-byte random salt, flags, 8 zero
+        record  12 bytes   length (LE32), sequence number (LE64)
+                len bytes  OCB ciphertext
+                16 bytes   tag
+
+    Record n is sealed with nonce salt || n (big-endian 64) and
+    authenticates its 12-byte header. A record that is edited, moved or
+    copied from another segment fails its tag. A reader also checks that
+    sequence numbers run without gaps. A record cut short at the end of
+    the file is a torn write from a crash; it reads as the end of the log,
+    and recovery truncates it.
+
+    A crash can also leave the last commit with holes: the file grown but
+    some of its pages never written. Every commit but the last was synced,
+    and a commit is at most WAL_BATCH_MAX bytes unless it is one larger
+    record, so recovery also cuts a record that fails within the last
+    WAL_BATCH_MAX bytes, or that is itself the last record. A failure
+    further back is corruption and is refused. The bytes cut may hold
+    ciphertext under the numbers that follow, so after a cut the segment
+    takes no more appends: the log goes on in a new segment, with a new
+    salt, from the first number cut. The segment is marked closed in its
+    header, synced before the cut, so it stays closed across crashes and
+    reopens.
+
+    Group commit: appenders copy their record into the open batch under
+    the lock and wait. The first one to find no commit in progress becomes
+    the leader. It takes the whole batch, seals every record in place in
+    one pass (across cores once the batch is large), writes it with one
+    pwrite, runs one fdatasync and wakes everyone whose record is now
+    durable. Records that arrived meanwhile fill the other batch, and one
+    of their appenders leads the next commit. So under load, one fsync
+    covers many records.
+*/
+
+#define WAL_MAGIC "AESWAL01"
+#define WAL_HDR 32
+#define WAL_REC_HDR 12
+#define WAL_TAG 16
+#define WAL_FLAGS 23                 //header byte
+#define WAL_CLOSED 1                 //flag: a tail was cut, no more appends
+#define WAL_BATCH_MAX (4*1024*1024)  //appenders wait above this much pending
+#define WAL_PAR_MIN 64               //records per batch before sealing in parallel
+#define WAL_READ_BUF (1024*1024)
+
+typedef struct wal_batch
+{
+    uint8_t *buf;                    //records laid out as on disk
+    size_t fill, cap;
+    size_t *off;                     //start of each record in buf
+    size_t n, off_cap;
+    uint64_t last;                   //sequence number of the last record
+}WAL_BATCH;
+
+typedef struct aes_wal
+{
+    const AES_OCB_CTX *key;          //16-byte tags
+    int fd;
+    unsigned threads;                //0 uses every online core
+    uint8_t hdr[WAL_HDR];
+    uint64_t end;                    //file offset of the next commit
+    uint64_t next;                   //sequence number of the next append
+    uint64_t durable;                //every record below this is on disk
+    WAL_BATCH batch[2];              //open batch, batch being committed
+    bool committing;
+    int err;                         //first write error, fails every append after
+    uint64_t commits, records;
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+}AES_WAL;
+
+typedef struct aes_wal_reader
+{
+    const AES_OCB_CTX *key;
+    int fd;
+    uint8_t hdr[WAL_HDR];
+    uint64_t off, seq;               //checkpoint: next record and its number
+    uint8_t *buf;                    //file window [boff, boff + bfill)
+    uint64_t boff;
+    size_t bfill, cap;
+}AES_WAL_READER;
+
+static void wal_nonce(const uint8_t *hdr, uint64_t seq, uint8_t *nonce)
+{
+    memcpy(nonce, hdr + 16, 7);
+    for(int i = 0; i < 8; i++)
+        nonce[7 + i] = (uint8_t)(seq >> (56 - 8 * i));
+}
+
+static int wal_pio(int fd, uint8_t *buf, size_t len, uint64_t off, bool write)
+{
+    ssize_t n;
+
+    while(len > 0)
+    {
+        n = write? pwrite(fd, buf, len, (off_t)off) : pread(fd, buf, len, (off_t)off);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        buf += n;
+        len -= (size_t)n;
+        off += (uint64_t)n;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                    Seal the records of a batch in place
+-------------------------------------------------------------------------*/
+typedef struct wal_job
+{
+    const AES_WAL *w;
+    WAL_BATCH *b;
+}WAL_JOB;
+
+static void wal_seal(void *arg, size_t lo, size_t hi)
+{
+    WAL_JOB *j = (WAL_JOB*)arg;
+    uint8_t nonce[15], *r;
+    size_t len;
+
+    for(size_t i = lo; i < hi; i++)
+    {
+        r = j->b->buf + j->b->off[i];
+        len = (size_t)r[0] | (size_t)r[1] << 8 | (size_t)r[2] << 16 | (size_t)r[3] << 24;
+        wal_nonce(j->w->hdr, load64_le(r + 4), nonce);
+        aes_ocb_encrypt(j->w->key, nonce, 15, r, WAL_REC_HDR, r + WAL_REC_HDR, r + WAL_REC_HDR, len, r + WAL_REC_HDR + len);
+    }
+}
+
+/*-------------------------------------------------------------------------
+                    Commit batches as the leader
+ pre: lock held.
+ post: lock held; record seq is durable or err is set. Later records are
+       left to the next leader.
+-------------------------------------------------------------------------*/
+static void wal_commit(AES_WAL *w, uint64_t seq)
+{
+    WAL_BATCH *b = &w->batch[1], t;
+    WAL_JOB j = {w, b};
+    int rc;
+
+    w->committing = true;
+    while(w->durable <= seq && w->batch[0].n > 0 && w->err == 0)
+    {
+        //swap so new appends fill the other batch while this one is written
+        t = w->batch[0];
+        w->batch[0] = w->batch[1];
+        w->batch[1] = t;
+        w->batch[0].fill = w->batch[0].n = 0;
+        pthread_cond_broadcast(&w->cv);
+        pthread_mutex_unlock(&w->lock);
+
+        aes_parallel_for(b->n, b->n < WAL_PAR_MIN? 1 : w->threads, wal_seal, &j);
+        rc = wal_pio(w->fd, b->buf, b->fill, w->end, true);
+        if(rc == 0)
+            rc = fdatasync(w->fd);
+
+        pthread_mutex_lock(&w->lock);
+        if(rc != 0)
+            w->err = errno? errno : EIO;
+        else
+        {
+            w->end += b->fill;
+            w->durable = b->last + 1;
+            w->commits++;
+            w->records += b->n;
+        }
+        pthread_cond_broadcast(&w->cv);
+    }
+    w->committing = false;
+    pthread_cond_broadcast(&w->cv);
+}
+
+/*-------------------------------------------------------------------------
+                            APPEND A RECORD
+ pre: len at most 2^32 - 1. Safe to call from many threads at once.
+ post: the record is sealed, written and fdatasynced; *seq (if not NULL)
+       is its sequence number. Returns 0, or -1 on memory or I/O error.
+-------------------------------------------------------------------------*/
+int aes_wal_append(AES_WAL *w, const uint8_t *rec, size_t len, uint64_t *seq)
+{
+    size_t need = WAL_REC_HDR + len + WAL_TAG, cap;
+    WAL_BATCH *b = &w->batch[0];
+    uint64_t n;
+    uint8_t *r;
+    void *grow;
+    int rc;
+
+    if(len > 0xffffffffu)
+        return -1;
+    pthread_mutex_lock(&w->lock);
+    //back-pressure: a full open batch is committed before this record
+    //joins, so only a batch of one record exceeds WAL_BATCH_MAX
+    while(w->err == 0 && b->fill > 0 && b->fill + need > WAL_BATCH_MAX)
+    {
+        if(!w->committing)
+            wal_commit(w, b->last);
+        else
+            pthread_cond_wait(&w->cv, &w->lock);
+    }
+    if(b->fill + need > b->cap)
+    {
+        cap = (b->fill + need) * 2;
+        if((grow = realloc(b->buf, cap)) == NULL)
+            goto fail;
+        b->buf = grow;
+        b->cap = cap;
+    }
+    if(b->n == b->off_cap)
+    {
+        cap = b->off_cap? b->off_cap * 2 : 64;
+        if((grow = realloc(b->off, cap * sizeof(size_t))) == NULL)
+            goto fail;
+        b->off = grow;
+        b->off_cap = cap;
+    }
+    if(w->err != 0)
+        goto fail;
+    n = w->next++;
+    r = b->buf + b->fill;
+    for(int i = 0; i < 4; i++)
+        r[i] = (uint8_t)(len >> (8 * i));
+    store64_le(r + 4, n);
+    memcpy(r + WAL_REC_HDR, rec, len);
+    b->off[b->n++] = b->fill;
+    b->fill += need;
+    b->last = n;
+
+    while(w->durable <= n && w->err == 0)
+    {
+        if(!w->committing)
+            wal_commit(w, n);
+        else
+            pthread_cond_wait(&w->cv, &w->lock);
+    }
+    rc = w->durable > n? 0 : -1;
+    pthread_mutex_unlock(&w->lock);
+    if(seq)
+        *seq = n;
+    return rc;
+fail:
+    pthread_mutex_unlock(&w->lock);
+    return -1;
+}
+
+static int wal_init(AES_WAL *w, const AES_OCB_CTX *key, int fd, unsigned threads)
+{
+    memset(w, 0, sizeof(AES_WAL));
+    if(key->taglen != WAL_TAG)
+        return -1;
+    w->key = key;
+    w->fd = fd;
+    w->threads = threads;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cv, NULL);
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                            Close a writer
+ pre: no append in progress.
+-------------------------------------------------------------------------*/
+void aes_wal_close(AES_WAL *w)
+{
+    for(int i = 0; i < 2; i++)
+    {
+        if(w->batch[i].buf)
+            memset(w->batch[i].buf, 0, w->batch[i].cap);
+        free(w->batch[i].buf);
+        free(w->batch[i].off);
+    }
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cv);
+}
+
+/*-------------------------------------------------------------------------
+                            CREATE A SEGMENT
+ pre: fd open for writing on an empty file; key with 16-byte tags.
+ post: header written and synced, first record numbered first_seq.
+       Returns 0, or -1 on bad parameters or I/O error.
+-------------------------------------------------------------------------*/
+int aes_wal_create(AES_WAL *w, const AES_OCB_CTX *key, int fd, uint64_t first_seq, unsigned threads)
+{
+    if(wal_init(w, key, fd, threads) != 0)
+        return -1;
+    memcpy(w->hdr, WAL_MAGIC, 8);
+    store64_le(w->hdr + 8, first_seq);
+    if(aes_random(w->hdr + 16, 7) != 0 || wal_pio(fd, w->hdr, WAL_HDR, 0, true) != 0 || fdatasync(fd) != 0)
+    {
+        aes_wal_close(w);
+        return -1;
+    }
+    w->end = WAL_HDR;
+    w->next = w->durable = first_seq;
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+                            READER
+ pre: off and seq from a previous reader's checkpoint (r->off, r->seq), or
+      off 0 to read from the first record.
+ post: returns 0, or -1 if fd is not a segment or off is not a record.
+-------------------------------------------------------------------------*/
+int aes_wal_reader_open(AES_WAL_READER *r, const AES_OCB_CTX *key, int fd, uint64_t off, uint64_t seq)
+{
+    memset(r, 0, sizeof(AES_WAL_READER));
+    if(key->taglen != WAL_TAG || wal_pio(fd, r->hdr, WAL_HDR, 0, false) != 0 || memcmp(r->hdr, WAL_MAGIC, 8) != 0)
+        return -1;
+    if(off != 0 && off < WAL_HDR)
+        return -1;
+    r->key = key;
+    r->fd = fd;
+    r->off = off? off : WAL_HDR;
+    r->seq = off? seq : load64_le(r->hdr + 8);
+    r->cap = WAL_READ_BUF;
+    r->buf = malloc(r->cap);
+    return r->buf? 0 : -1;
+}
+
+/*-------------------------------------------------------------------------
+                    Make [off, off + len) resident in the window
+ post: 0, 1 if the file ends first, -1 on memory or I/O error.
+-------------------------------------------------------------------------*/
+static int wal_window(AES_WAL_READER *r, uint64_t off, size_t len)
+{
+    struct stat st;
+    ssize_t n;
+    void *grow;
+
+    if(off >= r->boff && off + len <= r->boff + r->bfill)
+        return 0;
+    if(len > r->cap)
+    {
+        //a torn length field may claim up to 4 GiB; only the file can hold it
+        if(fstat(r->fd, &st) != 0)
+            return -1;
+        if(off + len > (uint64_t)st.st_size)
+            return 1;
+        if((grow = realloc(r->buf, len)) == NULL)
+            return -1;
+        r->buf = grow;
+        r->cap = len;
+    }
+    r->boff = off;
+    r->bfill = 0;
+    while(r->bfill < r->cap)
+    {
+        n = pread(r->fd, r->buf + r->bfill, r->cap - r->bfill, (off_t)(off + r->bfill));
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return -1;
+        if(n == 0)
+            break;
+        r->bfill += (size_t)n;
+    }
+    return r->bfill >= len? 0 : 1;
+}
+
+/*-------------------------------------------------------------------------
+                            READ THE NEXT RECORD
+ post: *rec points at the decrypted record (valid until the next call)
+       and the length is returned; r->off and r->seq move past it. -1 at
+       the end of the log (including a torn last record), -2 on a record
+       that fails its tag or is out of sequence, -3 on memory or I/O
+       error.
+-------------------------------------------------------------------------*/
+long aes_wal_next(AES_WAL_READER *r, uint8_t **rec)
+{
+    uint8_t nonce[15], *p;
+    size_t len;
+    int rc;
+
+    if((rc = wal_window(r, r->off, WAL_REC_HDR)) != 0)
+        return rc > 0? -1 : -3;
+    p = r->buf + (r->off - r->boff);
+    len = (size_t)p[0] | (size_t)p[1] << 8 | (size_t)p[2] << 16 | (size_t)p[3] << 24;
+    if(load64_le(p + 4) != r->seq)
+        return -2;
+    if((rc = wal_window(r, r->off, WAL_REC_HDR + len + WAL_TAG)) != 0)
+        return rc > 0? -1 : -3;
+    p = r->buf + (r->off - r->boff);
+    wal_nonce(r->hdr, r->seq, nonce);
+    if(aes_ocb_decrypt(r->key, nonce, 15, p, WAL_REC_HDR, p + WAL_REC_HDR, p + WAL_REC_HDR, len, p + WAL_REC_HDR + len) != 0)
+        return -2;
+    r->off += WAL_REC_HDR + len + WAL_TAG;
+    r->seq++;
+    *rec = p + WAL_REC_HDR;
+    return (long)len;
+}
+
+void aes_wal_reader_close(AES_WAL_READER *r)
+{
+    if(r->buf)
+        memset(r->buf, 0, r->cap);
+    free(r->buf);
+    r->buf = NULL;
+}
+
+/*-------------------------------------------------------------------------
+                        REOPEN A SEGMENT FOR APPENDING
+ post: every record verified. Returns 0 when the segment ends cleanly, and
+       appends continue the sequence. Returns 1 when a torn tail was
+       truncated away, now or on an earlier open: w is left closed, and
+       w->next is the first_seq of the segment to create for further
+       appends. Returns -1 if the
+       segment is not one, a record fails before the last commit, or on
+       I/O error.
+-------------------------------------------------------------------------*/
+int aes_wal_open(AES_WAL *w, const AES_OCB_CTX *key, int fd, unsigned threads)
+{
+    AES_WAL_READER r;
+    struct stat st;
+    uint8_t *rec, h[WAL_REC_HDR];
+    uint64_t tail, len;
+    bool closed;
+    long n;
+
+    if(aes_wal_reader_open(&r, key, fd, 0, 0) != 0)
+        return -1;
+    while((n = aes_wal_next(&r, &rec)) >= 0)
+        ;
+    aes_wal_reader_close(&r);
+    if(n == -3 || fstat(fd, &st) != 0)
+        return -1;
+    tail = (uint64_t)st.st_size - r.off;
+    closed = r.hdr[WAL_FLAGS] & WAL_CLOSED;
+    if(n == -2 && tail > WAL_BATCH_MAX)
+    {
+        //past the last batch's reach only a lone record can be torn
+        if(wal_pio(fd, h, WAL_REC_HDR, r.off, false) != 0 || load64_le(h + 4) != r.seq)
+            return -1;
+        len = (uint64_t)h[0] | (uint64_t)h[1] << 8 | (uint64_t)h[2] << 16 | (uint64_t)h[3] << 24;
+        if(WAL_REC_HDR + len + WAL_TAG != tail)
+            return -1;
+    }
+    if(wal_init(w, key, fd, threads) != 0)
+        return -1;
+    memcpy(w->hdr, r.hdr, WAL_HDR);
+    w->end = r.off;
+    w->next = w->durable = r.seq;
+    if(tail == 0 && !closed)
+        return 0;
+    aes_wal_close(w);
+    //closed is durable before anything is cut, so no reopen appends again
+    if(!closed)
+    {
+        w->hdr[WAL_FLAGS] |= WAL_CLOSED;
+        if(wal_pio(fd, w->hdr + WAL_FLAGS, 1, WAL_FLAGS, true) != 0 || fdatasync(fd) != 0)
+            return -1;
+    }
+    if(tail > 0 && (ftruncate(fd, (off_t)r.off) != 0 || fdatasync(fd) != 0))
+        return -1;
+    return 1;
+}
+
+#endif /* aes_wal_h */
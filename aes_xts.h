@@ -0,0 +1,208 @@
+#ifndef aes_xts_h
+#define aes_xts_h
+#include "aes_block.h"
+#include "aes_thread.h"
+
+/*
+    XTS-AES-128 and XTS-AES-256 (IEEE 1619-2007) for sector encryption.
+
+    The key is Key1 || Key2: Key1 schedules the data, Key2 the tweak. A
+    sector (data unit) is addressed by its 64-bit sector number, encrypted
+    once under Key2 to give the first tweak T; the tweak of each following
+    block is T*alpha in GF(2^128). The tweaks of AES_LANES blocks are
+    doubled as 64-bit halves in one go, then the whole pass goes through the
+    batched kernel. Sector lengths that are not a multiple of 16 bytes use
+    ciphertext stealing.
+*/
+
+typedef struct aes_xts_ctx
+{
+    AES_CTX data;  //Key1
+    AES_CTX tweak; //Key2
+}AES_XTS_CTX;
+
+/*-------------------------------------------------------------------------
+                            XTS Key Setup
+ pre: key of 32 (type 0) or 64 (type 2) bytes, Key1 || Key2.
+-------------------------------------------------------------------------*/
+void aes_xts_setkey(AES_XTS_CTX *ctx, const uint8_t *key, uint8_t type)
+{
+    uint8_t klen = 16 + 8*type;
+
+    aes_setkey(&ctx->data, key, type);
+    aes_setkey(&ctx->tweak, key + klen, type);
+}
+
+/*-------------------------------------------------------------------------
+                Multiply the tweak by alpha (x) in GF(2^128)
+ tweak is little-endian, lo/hi are its 64-bit halves.
+ -------------------------------------------------------------------------*/
+static inline void xts_double(uint64_t *lo, uint64_t *hi)
+{
+    uint64_t carry = *hi >> 63;
+
+    *hi = (*hi << 1) | (*lo >> 63);
+    *lo = (*lo << 1) ^ (0x87 & (0 - carry));
+}
+
+/*-------------------------------------------------------------------------
+                            XTS Core
+ Runs the full blocks of one sector, AES_LANES per pass. Tweaks for the
+ pass are laid out in tw, the tweak after the last block is left in lo/hi.
+-------------------------------------------------------------------------*/
+static void xts_blocks(const AES_CTX *key1, uint64_t *lo, uint64_t *hi, const uint8_t *in, uint8_t *out, size_t nblocks, bool decrypt)
+{
+    uint8_t tw[AES_LANES*AES_BLOCK], buf[AES_LANES*AES_BLOCK];
+    size_t lanes;
+
+    while(nblocks > 0)
+    {
+        lanes = nblocks < AES_LANES? nblocks : AES_LANES;
+        for(size_t l = 0; l < lanes; l++)
+        {
+            store64_le(tw + AES_BLOCK*l, *lo);
+            store64_le(tw + AES_BLOCK*l + 8, *hi);
+            xts_double(lo, hi);
+        }
+        for(size_t i = 0; i < lanes*AES_BLOCK; i++)
+            buf[i] = in[i] ^ tw[i];
+
+        if(decrypt)
+            aes_decrypt_lanes(key1, buf, buf, lanes);
+        else
+            aes_encrypt_lanes(key1, buf, buf, lanes);
+
+        for(size_t i = 0; i < lanes*AES_BLOCK; i++)
+            out[i] = buf[i] ^ tw[i];
+
+        in += lanes*AES_BLOCK;
+        out += lanes*AES_BLOCK;
+        nblocks -= lanes;
+    }
+}
+
+/*-------------------------------------------------------------------------
+            One block under the tweak lo/hi (used by stealing)
+-------------------------------------------------------------------------*/
+static void xts_one(const AES_CTX *key1, uint64_t lo, uint64_t hi, const uint8_t *in, uint8_t *out, bool decrypt)
+{
+    uint8_t tw[AES_BLOCK], buf[AES_BLOCK];
+
+    store64_le(tw, lo);
+    store64_le(tw + 8, hi);
+    xor_block(buf, in, tw);
+    if(decrypt)
+        aes_decrypt_block(key1, buf, buf);
+    else
+        aes_encrypt_block(key1, buf, buf);
+    xor_block(out, buf, tw);
+}
+
+/*-------------------------------------------------------------------------
+                        XTS Sector Encryption / Decryption
+ pre: len >= 16 bytes of the sector numbered sector, out may equal in.
+ post: returns 0, or -1 if the sector is shorter than one block.
+-------------------------------------------------------------------------*/
+static int xts_sector(const AES_XTS_CTX *ctx, uint64_t sector, const uint8_t *in, uint8_t *out, size_t len, bool decrypt)
+{
+    uint8_t t0[AES_BLOCK], cc[AES_BLOCK], pp[AES_BLOCK];
+    uint64_t lo, hi, lo_m, hi_m;
+    size_t full, tail;
+
+    if(len < AES_BLOCK) return -1;
+
+    //T = E_Key2(i), i as a 128-bit little-endian value
+    memset(t0, 0, AES_BLOCK);
+    store64_le(t0, sector);
+    aes_encrypt_block(&ctx->tweak, t0, t0);
+    lo = load64_le(t0);
+    hi = load64_le(t0 + 8);
+
+    full = len / AES_BLOCK;
+    tail = len % AES_BLOCK;
+    if(tail == 0)
+    {
+        xts_blocks(&ctx->data, &lo, &hi, in, out, full, decrypt);
+        return 0;
+    }
+
+    //ciphertext stealing on the last full block and the partial one
+    xts_blocks(&ctx->data, &lo, &hi, in, out, full - 1, decrypt);
+    in += (full - 1)*AES_BLOCK;
+    out += (full - 1)*AES_BLOCK;
+    lo_m = lo;
+    hi_m = hi;
+    xts_double(&lo_m, &hi_m);
+
+    //the second to last block runs under T_m on decryption, T_m-1 on encryption
+    if(decrypt)
+        xts_one(&ctx->data, lo_m, hi_m, in, cc, true);
+    else
+        xts_one(&ctx->data, lo, hi, in, cc, false);
+
+    memcpy(pp, in + AES_BLOCK, tail);
+    memcpy(pp + tail, cc + tail, AES_BLOCK - tail);
+    memcpy(out + AES_BLOCK, cc, tail);
+
+    if(decrypt)
+        xts_one(&ctx->data, lo, hi, pp, out, true);
+    else
+        xts_one(&ctx->data, lo_m, hi_m, pp, out, false);
+    return 0;
+}
+
+int aes_xts_encrypt(const AES_XTS_CTX *ctx, uint64_t sector, const uint8_t *in, uint8_t *out, size_t len)
+{
+    return xts_sector(ctx, sector, in, out, len, false);
+}
+
+int aes_xts_decrypt(const AES_XTS_CTX *ctx, uint64_t sector, const uint8_t *in, uint8_t *out, size_t len)
+{
+    return xts_sector(ctx, sector, in, out, len, true);
+}
+
+/*-------------------------------------------------------------------------
+                        MULTI-SECTOR BATCH
+ pre: nsectors consecutive sectors of sector_size bytes starting at sector
+      number first. threads = 0 uses every online core.
+ post: sectors spread across threads in contiguous runs. Returns 0, or -1
+       if sector_size is shorter than one block.
+-------------------------------------------------------------------------*/
+typedef struct xts_batch
+{
+    const AES_XTS_CTX *ctx;
+    uint64_t first;
+    const uint8_t *in;
+    uint8_t *out;
+    size_t sector_size;
+    bool decrypt;
+}XTS_BATCH;
+
+static void xts_batch_range(void *arg, size_t lo, size_t hi)
+{
+    XTS_BATCH *b = (XTS_BATCH*)arg;
+
+    for(size_t s = lo; s < hi; s++)
+        xts_sector(b->ctx, b->first + s, b->in + s*b->sector_size, b->out + s*b->sector_size, b->sector_size, b->decrypt);
+}
+
+static int xts_sectors(const AES_XTS_CTX *ctx, uint64_t first, const uint8_t *in, uint8_t *out, size_t sector_size, size_t nsectors, unsigned threads, bool decrypt)
+{
+    XTS_BATCH b = {ctx, first, in, out, sector_size, decrypt};
+
+    if(sector_size < AES_BLOCK) return -1;
+    aes_parallel_for(nsectors, threads, xts_batch_range, &b);
+    return 0;
+}
+
+int aes_xts_encrypt_sectors(const AES_XTS_CTX *ctx, uint64_t first, const uint8_t *in, uint8_t *out, size_t sector_size, size_t nsectors, unsigned threads)
+{
+    return xts_sectors(ctx, first, in, out, sector_size, nsectors, threads, false);
+}
+
+int aes_xts_decrypt_sectors(const AES_XTS_CTX *ctx, uint64_t first, const uint8_t *in, uint8_t *out, size_t sector_size, size_t nsectors, unsigned threads)
+{
+    return xts_sectors(ctx, first, in, out, sector_size, nsectors, threads, true);
+}
+
+#endif /* aes_xts_h */
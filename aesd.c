@@ -0,0 +1,148 @@
+/*
+    aesd: local encryption daemon. Holds the keys and serves CTR and
+    AES-GCM-SIV requests from local clients over a Unix socket (protocol
+    and client calls in aes_daemon.h).
+
+    cc -O2 -pthread -o aesd aesd.c
+
+    aesd -s socket -k keyfile [-t threads] [-v]
+
+    The key file has one key per line:
+        id ctr|siv hexkey
+    with a decimal id, and a key of 16, 24 or 32 bytes for ctr, 16 or 32
+    for siv. Blank lines and lines starting with # are skipped. The keys
+    are locked in memory, kept out of core dumps and wiped on exit.
+    SIGINT or SIGTERM stops the daemon and removes the socket.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <getopt.h>
+#include "aes_daemon.h"
+#include "aes_keyfile.h"
+
+#define AESD_KEYS_MAX 1024
+
+static AES_DAEMON *aesd_running;
+
+static void aesd_signal(int sig)
+{
+    (void)sig;
+    if(aesd_running)
+        aes_daemon_stop(aesd_running);
+}
+
+static long load_keys(const char *file, AESD_KEY *keys)
+{
+    char line[256], mode[8], hex[80];
+    uint8_t key[32];
+    unsigned long id;
+    size_t klen, n = 0, lineno = 0;
+    FILE *f;
+
+    f = fopen(file, "r");
+    if(f == NULL)
+        return -1;
+    while(fgets(line, sizeof(line), f))
+    {
+        lineno++;
+        if(line[0] == '#' || line[0] == '\n')
+            continue;
+        if(n == AESD_KEYS_MAX || sscanf(line, "%lu %7s %79s", &id, mode, hex) != 3 || aes_key_from_hex(hex, key, &klen) != 0)
+            goto bad;
+        keys[n].id = (uint32_t)id;
+        keys[n].siv = strcmp(mode, "siv") == 0;
+        keys[n].type = (uint8_t)(klen / 8 - 2);
+        if((!keys[n].siv && strcmp(mode, "ctr") != 0) || (keys[n].siv && klen == 24))
+            goto bad;
+        for(size_t i = 0; i < n; i++)
+            if(keys[i].id == keys[n].id)
+                goto bad;
+        aes_setkey_enc(&keys[n].ctx, key, keys[n].type);
+        n++;
+    }
+    fclose(f);
+    memset(key, 0, sizeof(key));
+    memset(line, 0, sizeof(line));
+    memset(hex, 0, sizeof(hex));
+    return (long)n;
+bad:
+    fprintf(stderr, "aesd: %s:%zu: expected \"id ctr|siv hexkey\"\n", file, lineno);
+    fclose(f);
+    memset(key, 0, sizeof(key));
+    memset(line, 0, sizeof(line));
+    memset(hex, 0, sizeof(hex));
+    return -1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: aesd -s socket -k keyfile [-t threads] [-v]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = NULL, *keyfile = NULL;
+    static AES_DAEMON d;
+    struct sigaction sa = {0};
+    size_t keys_len = AESD_KEYS_MAX * sizeof(AESD_KEY);
+    AESD_KEY *keys;
+    unsigned threads = 0;
+    bool verbose = false;
+    long nkeys;
+    int c, rc;
+
+    while((c = getopt(argc, argv, "s:k:t:v")) != -1)
+    {
+        switch(c)
+        {
+            case 's': path = optarg; break;
+            case 'k': keyfile = optarg; break;
+            case 't': threads = (unsigned)strtoul(optarg, NULL, 0); break;
+            case 'v': verbose = true; break;
+            default: usage();
+        }
+    }
+    if(path == NULL || keyfile == NULL || optind != argc)
+        usage();
+
+    //keys never reach swap or a core file
+    keys = mmap(NULL, keys_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(keys == MAP_FAILED)
+        return 1;
+    if(mlock(keys, keys_len) != 0 && verbose)
+        fprintf(stderr, "aesd: cannot lock keys in memory\n");
+    madvise(keys, keys_len, MADV_DONTDUMP);
+    if((nkeys = load_keys(keyfile, keys)) <= 0)
+    {
+        if(nkeys == 0)
+            fprintf(stderr, "aesd: no keys in %s\n", keyfile);
+        return 2;
+    }
+
+    if(aes_daemon_listen(&d, path, keys, (size_t)nkeys, threads) != 0)
+    {
+        fprintf(stderr, "aesd: cannot listen on %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    aesd_running = &d;
+    sa.sa_handler = aesd_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    if(verbose)
+        fprintf(stderr, "aesd: %ld keys, listening on %s\n", nkeys, path);
+
+    rc = aes_daemon_serve(&d);
+    if(verbose)
+        fprintf(stderr, "aesd: %llu requests in %llu kernel passes\n",
+                (unsigned long long)d.requests, (unsigned long long)d.batches);
+    aes_daemon_close(&d);
+    unlink(path);
+    for(long i = 0; i < nkeys; i++)
+        aes_ctx_wipe(&keys[i].ctx);
+    munmap(keys, keys_len);
+    return rc == 0? 0 : 1;
+}
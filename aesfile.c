@@ -0,0 +1,437 @@
+/*
+    aesfile: encrypt and decrypt files and directory trees.
+
+    cc -O2 -pthread -o aesfile aesfile.c
+
+    aesfile -e|-d (-k hexkey | -f hexkeyfile | -F rawkeyfile) [-t threads] [-c chunk] [-s] [-v] in out
+
+    The key is 16, 24 or 32 bytes, in hex on the command line or in a hex
+    key file, or as raw bytes in a raw key file. A directory is mirrored
+    into out: encryption adds ".aes" to every file name and decryption
+    removes it. out may not be the input file itself.
+
+    File format: a 32-byte header (magic "AESFILE2", little endian chunk
+    size at byte 8, 11-byte random nonce at byte 12), then the plaintext
+    cut into chunks, each stored as its OCB ciphertext and 16-byte tag.
+    Chunk i uses nonce || i (32 bits, big endian) and authenticates the
+    header and a final-chunk flag, so chunks cannot be swapped, dropped or
+    cut off without the tag check failing. The 88-bit random nonce keeps
+    collisions out of reach for any number of files under one key.
+
+    The input is mapped, the output is preallocated with fallocate and
+    mapped, all on one expanded key. A file with at least one chunk per
+    thread has its chunks shared out across cores; smaller files of a tree
+    are handed out whole, one per core at a time. -s syncs each output
+    before moving on.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "aes_ocb.h"
+#include "aes_drbg.h"
+#include "aes_thread.h"
+#include "aes_keyfile.h"
+
+#define FILE_MAGIC "AESFILE2"
+#define FILE_HDR 32
+#define FILE_NONCE 11
+#define FILE_TAG 16
+#define FILE_SUFFIX ".aes"
+#define FILE_MAX_CHUNKS 0xffffffffULL //chunk index is the last 4 nonce bytes
+
+typedef struct file_job
+{
+    const AES_OCB_CTX *ocb;
+    const uint8_t *hdr;
+    const uint8_t *in;
+    uint8_t *out;
+    uint64_t len, nchunks;  //plaintext bytes, chunks (at least one)
+    size_t chunk;
+    bool decrypt;
+    int failed;
+}FILE_JOB;
+
+//a regular file found by the tree walk
+typedef struct file_item
+{
+    char *in, *out;
+    uint64_t size;
+}FILE_ITEM;
+
+//options and totals, shared with the tree walk callback and the workers
+static struct
+{
+    AES_OCB_CTX ocb;
+    unsigned threads;
+    size_t chunk;
+    bool decrypt, sync, verbose;
+    const char *src, *dst;
+    FILE_ITEM *items;
+    size_t nitems, cap, next;
+    uint64_t bytes, files, errors;
+}opt;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*-------------------------------------------------------------------------
+                    Chunks [lo, hi) of one file
+-------------------------------------------------------------------------*/
+static void file_chunks(void *arg, size_t lo, size_t hi)
+{
+    FILE_JOB *j = (FILE_JOB*)arg;
+    uint8_t nonce[15], ad[FILE_HDR + 1];
+    uint64_t off, n;
+    const uint8_t *src;
+    uint8_t *dst;
+    int rc;
+
+    memcpy(nonce, j->hdr + 12, FILE_NONCE);
+    memcpy(ad, j->hdr, FILE_HDR);
+    for(size_t i = lo; i < hi; i++)
+    {
+        for(int b = 0; b < 4; b++)
+            nonce[FILE_NONCE + b] = (uint8_t)((uint64_t)i >> (24 - 8*b));
+        ad[FILE_HDR] = i + 1 == j->nchunks;
+        off = (uint64_t)i * j->chunk;
+        n = j->len - off < j->chunk? j->len - off : j->chunk;
+        if(j->decrypt)
+        {
+            src = j->in + FILE_HDR + (uint64_t)i * (j->chunk + FILE_TAG);
+            rc = aes_ocb_decrypt(j->ocb, nonce, 15, ad, sizeof(ad), src, j->out + off, n, src + n);
+        }
+        else
+        {
+            dst = j->out + FILE_HDR + (uint64_t)i * (j->chunk + FILE_TAG);
+            rc = aes_ocb_encrypt(j->ocb, nonce, 15, ad, sizeof(ad), j->in + off, dst, n, dst + n);
+        }
+        if(rc != 0)
+            __atomic_store_n(&j->failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*-------------------------------------------------------------------------
+            Plaintext length of an encrypted file of size bytes
+ post: -1 if size is not a valid encrypted length for the chunk size.
+-------------------------------------------------------------------------*/
+static int64_t file_plain_len(uint64_t size, size_t chunk)
+{
+    uint64_t body, full, rem;
+
+    if(size < FILE_HDR + FILE_TAG)
+        return -1;
+    body = size - FILE_HDR;
+    full = body / (chunk + FILE_TAG);
+    rem = body % (chunk + FILE_TAG);
+    if(rem == 0)
+        return (int64_t)(full * chunk);
+    if(rem < FILE_TAG)
+        return -1;
+    return (int64_t)(full * chunk + rem - FILE_TAG);
+}
+
+static int out_alloc(int fd, uint64_t size)
+{
+    if(size == 0)
+        return 0;
+    if(fallocate(fd, 0, 0, (off_t)size) == 0)
+        return 0;
+    return ftruncate(fd, (off_t)size);
+}
+
+/*-------------------------------------------------------------------------
+                        ENCRYPT / DECRYPT ONE FILE
+ pre: threads for the chunks of this file, 0 for every online core.
+ post: returns 0, or -1 after removing out on an I/O error, a bad header
+       or a chunk that fails authentication. out is left alone if it is
+       the input itself.
+-------------------------------------------------------------------------*/
+static int crypt_file(const char *in_path, const char *out_path, unsigned threads)
+{
+    FILE_JOB j = {0};
+    uint8_t hdr[FILE_HDR];
+    uint8_t *in = MAP_FAILED, *out = MAP_FAILED;
+    uint64_t in_size = 0, out_size = 0;
+    int64_t plain;
+    int in_fd, out_fd = -1, rc = -1;
+    struct stat st, ost;
+    double t0 = now();
+
+    in_fd = open(in_path, O_RDONLY);
+    if(in_fd < 0 || fstat(in_fd, &st) != 0)
+        goto done;
+    in_size = (uint64_t)st.st_size;
+    //O_TRUNC on the input would cut the mapping from under the workers
+    if(stat(out_path, &ost) == 0 && ost.st_dev == st.st_dev && ost.st_ino == st.st_ino)
+    {
+        errno = EEXIST;
+        goto done;
+    }
+    if(in_size > 0)
+    {
+        in = mmap(NULL, in_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+        if(in == MAP_FAILED)
+            goto done;
+        madvise(in, in_size, MADV_SEQUENTIAL);
+    }
+
+    if(opt.decrypt)
+    {
+        if(in_size < FILE_HDR || memcmp(in, FILE_MAGIC, 8) != 0)
+            goto done;
+        memcpy(hdr, in, FILE_HDR);
+        j.chunk = (size_t)hdr[8] | (size_t)hdr[9] << 8 | (size_t)hdr[10] << 16 | (size_t)hdr[11] << 24;
+        if(j.chunk == 0 || j.chunk % AES_BLOCK || (plain = file_plain_len(in_size, j.chunk)) < 0)
+            goto done;
+        j.len = (uint64_t)plain;
+        out_size = j.len;
+    }
+    else
+    {
+        memset(hdr, 0, FILE_HDR);
+        memcpy(hdr, FILE_MAGIC, 8);
+        for(int b = 0; b < 4; b++)
+            hdr[8 + b] = (uint8_t)(opt.chunk >> 8*b);
+        if(aes_random(hdr + 12, FILE_NONCE) != 0)
+            goto done;
+        j.chunk = opt.chunk;
+        j.len = in_size;
+    }
+    j.nchunks = j.len == 0? 1 : (j.len + j.chunk - 1) / j.chunk;
+    if(j.nchunks > FILE_MAX_CHUNKS)
+        goto done;
+    if(!opt.decrypt)
+        out_size = FILE_HDR + j.len + j.nchunks * FILE_TAG;
+
+    out_fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC, st.st_mode & 0777);
+    if(out_fd < 0 || out_alloc(out_fd, out_size) != 0)
+        goto done;
+    if(out_size > 0)
+    {
+        out = mmap(NULL, out_size, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+        if(out == MAP_FAILED)
+            goto done;
+    }
+    if(!opt.decrypt)
+        memcpy(out, hdr, FILE_HDR);
+
+    j.ocb = &opt.ocb;
+    j.hdr = hdr;
+    j.in = in;
+    j.out = out;
+    j.decrypt = opt.decrypt;
+    aes_parallel_for(j.nchunks, threads, file_chunks, &j);
+    if(j.failed)
+        goto done;
+    if(opt.sync && out_size > 0 && msync(out, out_size, MS_SYNC) != 0)
+        goto done;
+    rc = 0;
+
+done:
+    if(in != MAP_FAILED) munmap(in, in_size);
+    if(out != MAP_FAILED) munmap(out, out_size);
+    if(in_fd >= 0) close(in_fd);
+    if(out_fd >= 0) close(out_fd);
+    if(rc != 0)
+    {
+        fprintf(stderr, "aesfile: %s: %s\n", in_path, j.failed? "authentication failed" :
+                errno == EEXIST && out_fd < 0? "output is the input file" : "cannot process");
+        if(out_fd >= 0)
+            unlink(out_path);
+        __atomic_fetch_add(&opt.errors, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    __atomic_fetch_add(&opt.bytes, j.len, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&opt.files, 1, __ATOMIC_RELAXED);
+    if(opt.verbose)
+        fprintf(stderr, "%s: %llu bytes, %.1f MB/s\n", out_path, (unsigned long long)j.len,
+                (double)j.len / 1e6 / (now() - t0 + 1e-9));
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+            Output path for in: dst + relative path, suffix added or cut
+-------------------------------------------------------------------------*/
+static int out_path(const char *in_path, char *path)
+{
+    size_t n;
+
+    n = (size_t)snprintf(path, PATH_MAX, "%s%s", opt.dst, in_path + strlen(opt.src));
+    if(n >= PATH_MAX - strlen(FILE_SUFFIX))
+        return -1;
+    if(!opt.decrypt)
+        strcat(path, FILE_SUFFIX);
+    else if(n > strlen(FILE_SUFFIX) && strcmp(path + n - strlen(FILE_SUFFIX), FILE_SUFFIX) == 0)
+        path[n - strlen(FILE_SUFFIX)] = 0;
+    return 0;
+}
+
+static int walk(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    char dst[PATH_MAX];
+
+    (void)ftw;
+    if(flag == FTW_D)
+    {
+        snprintf(dst, PATH_MAX, "%s%s", opt.dst, path + strlen(opt.src));
+        if(mkdir(dst, st->st_mode & 0777) != 0 && errno != EEXIST)
+        {
+            perror(dst);
+            opt.errors++;
+        }
+    }
+    else if(flag == FTW_F && S_ISREG(st->st_mode))
+    {
+        if(opt.nitems == opt.cap)
+        {
+            opt.cap = opt.cap? 2*opt.cap : 256;
+            opt.items = realloc(opt.items, opt.cap * sizeof(FILE_ITEM));
+            if(opt.items == NULL)
+                return -1;
+        }
+        if(out_path(path, dst) != 0)
+        {
+            opt.errors++;
+            return 0;
+        }
+        opt.items[opt.nitems].in = strdup(path);
+        opt.items[opt.nitems].out = strdup(dst);
+        opt.items[opt.nitems].size = (uint64_t)st->st_size;
+        if(opt.items[opt.nitems].in == NULL || opt.items[opt.nitems].out == NULL)
+            return -1;
+        opt.nitems++;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+        Worker: small files whole, the next one taken from the list
+-------------------------------------------------------------------------*/
+static bool file_small(const FILE_ITEM *it, unsigned threads)
+{
+    return it->size / opt.chunk < threads;
+}
+
+static void file_workers(void *arg, size_t lo, size_t hi)
+{
+    unsigned threads = *(unsigned*)arg;
+    size_t i;
+
+    (void)lo;
+    (void)hi;
+    while((i = __atomic_fetch_add(&opt.next, 1, __ATOMIC_RELAXED)) < opt.nitems)
+        if(file_small(&opt.items[i], threads))
+            crypt_file(opt.items[i].in, opt.items[i].out, 1);
+}
+
+/*-------------------------------------------------------------------------
+                            A directory tree
+ post: directories created during the walk; large files one at a time
+       with their chunks across cores, then the rest spread file by file.
+-------------------------------------------------------------------------*/
+static void crypt_tree(void)
+{
+    unsigned threads = opt.threads? opt.threads : aes_ncpu();
+
+    if(nftw(opt.src, walk, 32, FTW_PHYS) != 0)
+    {
+        perror(opt.src);
+        opt.errors++;
+    }
+    for(size_t i = 0; i < opt.nitems; i++)
+        if(!file_small(&opt.items[i], threads))
+            crypt_file(opt.items[i].in, opt.items[i].out, threads);
+    aes_parallel_for(threads, threads, file_workers, &threads);
+    for(size_t i = 0; i < opt.nitems; i++)
+    {
+        free(opt.items[i].in);
+        free(opt.items[i].out);
+    }
+    free(opt.items);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: aesfile -e|-d (-k hexkey | -f hexkeyfile | -F rawkeyfile) [-t threads] [-c chunk] [-s] [-v] in out\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *hex = NULL, *keyfile = NULL;
+    uint8_t key[32];
+    size_t klen;
+    struct stat st;
+    double t0, secs;
+    bool raw = false;
+    int c, mode = 0, rc;
+
+    opt.chunk = 1 << 20;
+    while((c = getopt(argc, argv, "edk:f:F:t:c:sv")) != -1)
+    {
+        switch(c)
+        {
+            case 'e': mode |= 1; break;
+            case 'd': mode |= 2; opt.decrypt = true; break;
+            case 'k': hex = optarg; break;
+            case 'f': keyfile = optarg; raw = false; break;
+            case 'F': keyfile = optarg; raw = true; break;
+            case 't': opt.threads = (unsigned)strtoul(optarg, NULL, 0); break;
+            case 'c': opt.chunk = strtoull(optarg, NULL, 0); break;
+            case 's': opt.sync = true; break;
+            case 'v': opt.verbose = true; break;
+            default: usage();
+        }
+    }
+    if((mode != 1 && mode != 2) || optind + 2 != argc)
+        usage();
+    if(opt.chunk < AES_BLOCK || opt.chunk % AES_BLOCK || opt.chunk > 0xffffffffu)
+    {
+        fprintf(stderr, "aesfile: chunk must be a multiple of 16 below 4 GiB\n");
+        return 2;
+    }
+    if(hex && keyfile)
+        usage();
+    rc = keyfile? aes_key_from_file(keyfile, raw, key, &klen) : hex? aes_key_from_hex(hex, key, &klen) : -1;
+    if(rc != 0)
+    {
+        fprintf(stderr, "aesfile: key must be 16, 24 or 32 bytes (%s)\n", raw? "raw" : "hex");
+        return 2;
+    }
+    aes_ocb_setkey(&opt.ocb, key, (uint8_t)(klen / 8 - 2), FILE_TAG);
+    memset(key, 0, sizeof(key));
+
+    opt.src = argv[optind];
+    opt.dst = argv[optind + 1];
+    if(stat(opt.src, &st) != 0)
+    {
+        perror(opt.src);
+        return 1;
+    }
+    t0 = now();
+    if(S_ISDIR(st.st_mode))
+        crypt_tree();
+    else
+        crypt_file(opt.src, opt.dst, opt.threads);
+    secs = now() - t0;
+
+    fprintf(stderr, "aesfile: %llu files, %llu bytes in %.2f s, %.1f MB/s%s\n",
+            (unsigned long long)opt.files, (unsigned long long)opt.bytes, secs,
+            (double)opt.bytes / 1e6 / (secs + 1e-9), opt.errors? ", with errors" : "");
+    aes_ctx_wipe(&opt.ocb.aes);
+    return opt.errors? 1 : 0;
+}
@@ -0,0 +1,422 @@
+/*
+    aesfilter: encrypt or decrypt stdin to stdout, for pipelines such as
+    pg_dump | aesfilter -e -f key | upload.
+
+    cc -O2 -pthread -o aesfilter aesfilter.c
+
+    aesfilter -e|-d (-k hexkey | -f hexkeyfile | -F rawkeyfile) [-t threads] [-c chunk] [-v]
+
+    Stream format: a 32-byte header (magic "AESFLT02", little endian chunk
+    size at byte 8, 11-byte random nonce at byte 12), then frames of
+        length (4 bytes, big endian; top bit marks the final frame)
+        OCB ciphertext of length bytes, 16-byte tag
+    Frame i uses nonce || i (32 bits, big endian) and authenticates the
+    header and the length word, so the stream decrypts front to back
+    without knowing its size, and a reordered, cut or extended stream
+    fails. The final frame may be empty. The 88-bit random nonce keeps
+    collisions out of reach for any number of streams under one key; a
+    stream ends with an error before its frame index would wrap.
+
+    stdin is read into a ring of chunk buffers by the main thread. Workers
+    seal or open the chunks while the next ones are read, and a writer
+    thread sends them to stdout in their original order. Decryption stops
+    at the first frame that fails, before any of its bytes are written.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+#include "aes_ocb.h"
+#include "aes_drbg.h"
+#include "aes_thread.h"
+#include "aes_keyfile.h"
+
+#define FLT_MAGIC "AESFLT02"
+#define FLT_HDR 32
+#define FLT_NONCE 11
+#define FLT_TAG 16
+#define FLT_FINAL 0x80000000u
+#define FLT_MAX_FRAMES 0xffffffffULL //frame index is the last 4 nonce bytes
+
+typedef enum flt_state
+{
+    FLT_FREE,                 //ready to be read into
+    FLT_FULL,                 //read, waiting for a worker
+    FLT_DONE                  //sealed or opened, waiting for the writer
+}FLT_STATE;
+
+typedef struct flt_slot
+{
+    uint8_t *buf;
+    uint8_t tag[FLT_TAG];
+    size_t len;
+    uint64_t seq;
+    bool final;
+    int failed;
+    FLT_STATE state;
+}FLT_SLOT;
+
+static struct
+{
+    AES_OCB_CTX ocb;
+    bool decrypt, verbose;
+    size_t chunk;
+    uint8_t hdr[FLT_HDR];
+    FLT_SLOT *slot;
+    unsigned nslots;
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    uint64_t read_seq, crypt_seq; //chunks read, chunks handed to workers
+    bool read_done;
+    int err;                  //set once, stops every stage
+    uint64_t bytes;
+}flt = {.mu = PTHREAD_MUTEX_INITIALIZER, .cv = PTHREAD_COND_INITIALIZER};
+
+static void flt_fail(int err)
+{
+    pthread_mutex_lock(&flt.mu);
+    if(flt.err == 0)
+        flt.err = err;
+    pthread_cond_broadcast(&flt.cv);
+    pthread_mutex_unlock(&flt.mu);
+}
+
+/*-------------------------------------------------------------------------
+                        Whole reads and writes
+ post: read_full returns the bytes read, short only at end of input, or
+       -1; write_full returns 0 or -1.
+-------------------------------------------------------------------------*/
+static ssize_t read_full(int fd, uint8_t *buf, size_t len)
+{
+    size_t got = 0;
+    ssize_t n;
+
+    while(got < len)
+    {
+        n = read(fd, buf + got, len - got);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+            return -1;
+        if(n == 0)
+            break;
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+static int write_full(int fd, const uint8_t *buf, size_t len)
+{
+    ssize_t n;
+
+    while(len > 0)
+    {
+        n = write(fd, buf, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void frame_nonce_ad(uint64_t seq, uint32_t word, uint8_t *nonce, uint8_t *ad)
+{
+    memcpy(nonce, flt.hdr + 12, FLT_NONCE);
+    for(int b = 0; b < 4; b++)
+        nonce[FLT_NONCE + b] = (uint8_t)(seq >> (24 - 8*b));
+    memcpy(ad, flt.hdr, FLT_HDR);
+    for(int b = 0; b < 4; b++)
+        ad[FLT_HDR + b] = (uint8_t)(word >> (24 - 8*b));
+}
+
+/*-------------------------------------------------------------------------
+                    Worker: seal or open chunks in read order
+-------------------------------------------------------------------------*/
+static void *flt_worker(void *arg)
+{
+    uint8_t nonce[15], ad[FLT_HDR + 4];
+    uint32_t word;
+    FLT_SLOT *s;
+    int rc;
+
+    (void)arg;
+    for(;;)
+    {
+        pthread_mutex_lock(&flt.mu);
+        while(flt.crypt_seq == flt.read_seq && !flt.read_done && flt.err == 0)
+            pthread_cond_wait(&flt.cv, &flt.mu);
+        if(flt.crypt_seq == flt.read_seq || flt.err != 0)
+        {
+            pthread_mutex_unlock(&flt.mu);
+            return NULL;
+        }
+        s = &flt.slot[flt.crypt_seq % flt.nslots];
+        flt.crypt_seq++;
+        pthread_mutex_unlock(&flt.mu);
+
+        word = (uint32_t)s->len | (s->final? FLT_FINAL : 0);
+        frame_nonce_ad(s->seq, word, nonce, ad);
+        if(flt.decrypt)
+            rc = aes_ocb_decrypt(&flt.ocb, nonce, 15, ad, sizeof(ad), s->buf, s->buf, s->len, s->tag);
+        else
+            rc = aes_ocb_encrypt(&flt.ocb, nonce, 15, ad, sizeof(ad), s->buf, s->buf, s->len, s->tag);
+
+        pthread_mutex_lock(&flt.mu);
+        s->failed = rc;
+        s->state = FLT_DONE;
+        pthread_cond_broadcast(&flt.cv);
+        pthread_mutex_unlock(&flt.mu);
+    }
+}
+
+/*-------------------------------------------------------------------------
+                    Writer: frames to stdout in order
+-------------------------------------------------------------------------*/
+static void *flt_writer(void *arg)
+{
+    uint8_t word[4];
+    uint32_t w;
+    FLT_SLOT *s;
+    bool final;
+    int rc;
+
+    (void)arg;
+    for(uint64_t seq = 0; ; seq++)
+    {
+        s = &flt.slot[seq % flt.nslots];
+        pthread_mutex_lock(&flt.mu);
+        while(flt.err == 0 && !(seq < flt.read_seq && s->state == FLT_DONE) && !(flt.read_done && seq == flt.read_seq))
+            pthread_cond_wait(&flt.cv, &flt.mu);
+        if(flt.err != 0 || seq == flt.read_seq)
+        {
+            pthread_mutex_unlock(&flt.mu);
+            return NULL;
+        }
+        pthread_mutex_unlock(&flt.mu);
+
+        if(s->failed)
+        {
+            flt_fail(EBADMSG);
+            return NULL;
+        }
+        if(flt.decrypt)
+            rc = write_full(1, s->buf, s->len);
+        else
+        {
+            w = (uint32_t)s->len | (s->final? FLT_FINAL : 0);
+            for(int b = 0; b < 4; b++)
+                word[b] = (uint8_t)(w >> (24 - 8*b));
+            rc = write_full(1, word, 4);
+            if(rc == 0) rc = write_full(1, s->buf, s->len);
+            if(rc == 0) rc = write_full(1, s->tag, FLT_TAG);
+        }
+        if(rc != 0)
+        {
+            flt_fail(errno);
+            return NULL;
+        }
+        flt.bytes += s->len;
+        final = s->final; //the reader refills the slot once it is free
+
+        pthread_mutex_lock(&flt.mu);
+        s->state = FLT_FREE;
+        pthread_cond_broadcast(&flt.cv);
+        pthread_mutex_unlock(&flt.mu);
+        if(final)
+            return NULL;
+    }
+}
+
+/*-------------------------------------------------------------------------
+            Reader: next chunk (encrypt) or frame (decrypt) into s
+ post: returns 0, or an errno value (EBADMSG for a malformed stream).
+-------------------------------------------------------------------------*/
+static int flt_read(FLT_SLOT *s)
+{
+    uint8_t word[4];
+    uint32_t w;
+    ssize_t n;
+
+    if(!flt.decrypt)
+    {
+        n = read_full(0, s->buf, flt.chunk);
+        if(n < 0)
+            return errno;
+        s->len = (size_t)n;
+        s->final = s->len < flt.chunk;
+        return 0;
+    }
+    n = read_full(0, word, 4);
+    if(n != 4)
+        return n < 0? errno : EBADMSG; //cut before the final frame
+    w = (uint32_t)word[0] << 24 | (uint32_t)word[1] << 16 | (uint32_t)word[2] << 8 | word[3];
+    s->len = w & ~FLT_FINAL;
+    s->final = (w & FLT_FINAL) != 0;
+    if(s->len > flt.chunk)
+        return EBADMSG;
+    n = read_full(0, s->buf, s->len);
+    if(n != (ssize_t)s->len || read_full(0, s->tag, FLT_TAG) != FLT_TAG)
+        return n < 0? errno : EBADMSG;
+    //nothing may follow the final frame
+    if(s->final && read_full(0, word, 1) != 0)
+        return EBADMSG;
+    return 0;
+}
+
+static int flt_header(void)
+{
+    if(flt.decrypt)
+    {
+        if(read_full(0, flt.hdr, FLT_HDR) != FLT_HDR || memcmp(flt.hdr, FLT_MAGIC, 8) != 0)
+            return -1;
+        flt.chunk = (size_t)flt.hdr[8] | (size_t)flt.hdr[9] << 8 | (size_t)flt.hdr[10] << 16 | (size_t)flt.hdr[11] << 24;
+        return flt.chunk == 0 || flt.chunk >= FLT_FINAL? -1 : 0;
+    }
+    memset(flt.hdr, 0, FLT_HDR);
+    memcpy(flt.hdr, FLT_MAGIC, 8);
+    for(int b = 0; b < 4; b++)
+        flt.hdr[8 + b] = (uint8_t)(flt.chunk >> 8*b);
+    if(aes_random(flt.hdr + 12, FLT_NONCE) != 0)
+        return -1;
+    return write_full(1, flt.hdr, FLT_HDR);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: aesfilter -e|-d (-k hexkey | -f hexkeyfile | -F rawkeyfile) [-t threads] [-c chunk] [-v]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    const char *hex = NULL, *keyfile = NULL;
+    pthread_t tid[AES_MAX_THREADS], wtid;
+    unsigned threads = 0, started = 0;
+    struct timespec t0, t1;
+    uint8_t key[32];
+    size_t klen;
+    FLT_SLOT *s;
+    int c, mode = 0, rc = 0;
+    bool raw = false;
+    double secs;
+
+    flt.chunk = 4 << 20;
+    while((c = getopt(argc, argv, "edk:f:F:t:c:v")) != -1)
+    {
+        switch(c)
+        {
+            case 'e': mode |= 1; break;
+            case 'd': mode |= 2; flt.decrypt = true; break;
+            case 'k': hex = optarg; break;
+            case 'f': keyfile = optarg; raw = false; break;
+            case 'F': keyfile = optarg; raw = true; break;
+            case 't': threads = (unsigned)strtoul(optarg, NULL, 0); break;
+            case 'c': flt.chunk = strtoull(optarg, NULL, 0); break;
+            case 'v': flt.verbose = true; break;
+            default: usage();
+        }
+    }
+    if((mode != 1 && mode != 2) || optind != argc)
+        usage();
+    if(flt.chunk == 0 || flt.chunk >= FLT_FINAL)
+    {
+        fprintf(stderr, "aesfilter: chunk must be 1 byte to 2 GiB\n");
+        return 2;
+    }
+    if(hex && keyfile)
+        usage();
+    rc = keyfile? aes_key_from_file(keyfile, raw, key, &klen) : hex? aes_key_from_hex(hex, key, &klen) : -1;
+    if(rc != 0)
+    {
+        fprintf(stderr, "aesfilter: key must be 16, 24 or 32 bytes (%s)\n", raw? "raw" : "hex");
+        return 2;
+    }
+    aes_ocb_setkey(&flt.ocb, key, (uint8_t)(klen / 8 - 2), FLT_TAG);
+    memset(key, 0, sizeof(key));
+    signal(SIGPIPE, SIG_IGN);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    if(flt_header() != 0)
+    {
+        fprintf(stderr, "aesfilter: %s\n", flt.decrypt? "not an aesfilter stream" : "cannot write header");
+        return 1;
+    }
+
+    //two buffers per worker: one being sealed while the next is read
+    if(threads == 0) threads = aes_ncpu();
+    if(threads > AES_MAX_THREADS) threads = AES_MAX_THREADS;
+    flt.nslots = 2*threads + 2;
+    flt.slot = calloc(flt.nslots, sizeof(FLT_SLOT));
+    for(unsigned i = 0; flt.slot && i < flt.nslots; i++)
+        if((flt.slot[i].buf = malloc(flt.chunk)) == NULL)
+            flt.err = ENOMEM;
+    if(flt.slot == NULL || flt.err != 0)
+    {
+        fprintf(stderr, "aesfilter: out of memory\n");
+        return 1;
+    }
+    for(; started < threads; started++)
+        if(pthread_create(&tid[started], NULL, flt_worker, NULL) != 0)
+            break;
+    if(started == 0 || pthread_create(&wtid, NULL, flt_writer, NULL) != 0)
+    {
+        fprintf(stderr, "aesfilter: cannot start threads\n");
+        return 1;
+    }
+
+    for(uint64_t seq = 0; ; seq++)
+    {
+        s = &flt.slot[seq % flt.nslots];
+        pthread_mutex_lock(&flt.mu);
+        while(s->state != FLT_FREE && flt.err == 0)
+            pthread_cond_wait(&flt.cv, &flt.mu);
+        pthread_mutex_unlock(&flt.mu);
+        if(flt.err != 0)
+            break;
+        s->seq = seq;
+        rc = seq > FLT_MAX_FRAMES? EFBIG : flt_read(s);
+        if(rc != 0)
+        {
+            flt_fail(rc);
+            break;
+        }
+        pthread_mutex_lock(&flt.mu);
+        s->state = FLT_FULL;
+        flt.read_seq++;
+        flt.read_done = s->final;
+        pthread_cond_broadcast(&flt.cv);
+        pthread_mutex_unlock(&flt.mu);
+        if(s->final)
+            break;
+    }
+
+    pthread_join(wtid, NULL);
+    flt_fail(ECANCELED); //release workers waiting for input
+    for(unsigned i = 0; i < started; i++)
+        pthread_join(tid[i], NULL);
+    if(flt.err == ECANCELED)
+        flt.err = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    if(flt.err != 0)
+        fprintf(stderr, "aesfilter: %s\n", flt.err == EBADMSG? "stream corrupt, cut short or wrong key" : strerror(flt.err));
+    else if(flt.verbose)
+        fprintf(stderr, "aesfilter: %llu bytes in %.2f s, %.1f MB/s\n", (unsigned long long)flt.bytes, secs,
+                (double)flt.bytes / 1e6 / (secs + 1e-9));
+
+    for(unsigned i = 0; i < flt.nslots; i++)
+    {
+        memset(flt.slot[i].buf, 0, flt.chunk);
+        free(flt.slot[i].buf);
+    }
+    free(flt.slot);
+    aes_ctx_wipe(&flt.ocb.aes);
+    return flt.err? 1 : 0;
+}
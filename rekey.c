@@ -0,0 +1,195 @@
+/*
+    rekey: re-encrypt a file or device from an old key to a new key in one
+    pass (aes_rekey.h).
+
+    cc -O2 -pthread -o rekey rekey.c
+
+    rekey -m xts -k OLDKEY -M xts -K NEWKEY [-i IV] [-I IV] [-s sector]
+          [-t threads] [-b MB/s] [-o offset] [-e end] [-S statefile] in [out]
+
+    Keys and IVs are hex. With a state file the offset reached is saved
+    after every chunk, and a rerun with the same state file carries on from
+    there. Without out the input is rotated in place, which needs a state
+    file: the old ciphertext of the chunk being overwritten is journaled to
+    statefile.journal, so a rerun after a crash puts it back first.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include "aes_rekey.h"
+#include "aes_keyfile.h"
+
+typedef struct rekey_opts
+{
+    const char *mode, *key, *iv;
+}REKEY_OPTS;
+
+//strict: every character a hex digit, so a mistyped key never loads
+static int hex_decode(const char *hex, uint8_t *out, size_t max, size_t *len)
+{
+    size_t n = strlen(hex);
+    int hi, lo;
+
+    if(n % 2 || n / 2 > max)
+        return -1;
+    for(size_t i = 0; i < n / 2; i++)
+    {
+        hi = aes_hex_nibble(hex[2*i]);
+        lo = aes_hex_nibble(hex[2*i + 1]);
+        if(hi < 0 || lo < 0)
+            return -1;
+        out[i] = (uint8_t)(hi << 4 | lo);
+    }
+    *len = n / 2;
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+            Key from -m/-k/-i: XTS 32 or 64 bytes, CTR 16, 24 or 32
+-------------------------------------------------------------------------*/
+static int load_key(const REKEY_OPTS *o, AES_REKEY_KEY *k)
+{
+    uint8_t key[64], iv[16];
+    size_t klen, ivlen;
+    int rc = 0;
+
+    if(o->mode == NULL || o->key == NULL || hex_decode(o->key, key, sizeof(key), &klen) != 0)
+        return -1;
+    if(strcmp(o->mode, "xts") == 0 && (klen == 32 || klen == 64))
+        aes_rekey_key_xts(k, key, klen == 32? 0 : 2);
+    else if(strcmp(o->mode, "ctr") == 0 && (klen == 16 || klen == 24 || klen == 32)
+            && o->iv && hex_decode(o->iv, iv, sizeof(iv), &ivlen) == 0 && ivlen == 16)
+        aes_rekey_key_ctr(k, key, (uint8_t)(klen / 8 - 2), iv);
+    else
+        rc = -1;
+    memset(key, 0, sizeof(key));
+    return rc;
+}
+
+static void save_state(void *arg, uint64_t done)
+{
+    int fd = *(int*)arg;
+    char line[32];
+    int n = snprintf(line, sizeof(line), "%020llu\n", (unsigned long long)done);
+
+    if(pwrite(fd, line, (size_t)n, 0) != n || fdatasync(fd) != 0)
+        perror("rekey: state file");
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: rekey -m xts|ctr -k key [-i iv] -M xts|ctr -K key [-I iv]\n"
+                    "             [-s sector] [-t threads] [-b MB/s] [-o offset] [-e end]\n"
+                    "             [-S statefile] in [out]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    REKEY_OPTS from = {0}, to = {0};
+    AES_REKEY_KEY *old_key, *new_key;
+    AES_REKEY r = {0};
+    const char *state = NULL;
+    char journal[4096];
+    bool resumed = false;
+    uint64_t offset = 0, end = UINT64_MAX, done;
+    int c, in_fd, out_fd, state_fd = -1, rc;
+    char line[32];
+    struct stat st;
+    double t0;
+
+    r.sector_size = 4096;
+    while((c = getopt(argc, argv, "m:k:i:M:K:I:s:t:b:o:e:S:")) != -1)
+    {
+        switch(c)
+        {
+            case 'm': from.mode = optarg; break;
+            case 'k': from.key = optarg; break;
+            case 'i': from.iv = optarg; break;
+            case 'M': to.mode = optarg; break;
+            case 'K': to.key = optarg; break;
+            case 'I': to.iv = optarg; break;
+            case 's': r.sector_size = strtoull(optarg, NULL, 0); break;
+            case 't': r.threads = (unsigned)strtoul(optarg, NULL, 0); break;
+            case 'b': r.bw_limit = strtoull(optarg, NULL, 0) * 1000000ULL; break;
+            case 'o': offset = strtoull(optarg, NULL, 0); break;
+            case 'e': end = strtoull(optarg, NULL, 0); break;
+            case 'S': state = optarg; break;
+            default: usage();
+        }
+    }
+    if(optind + 1 != argc && optind + 2 != argc)
+        usage();
+    if(optind + 1 == argc && state == NULL)
+    {
+        fprintf(stderr, "rekey: rotation in place needs a state file (-S)\n");
+        return 2;
+    }
+
+    //schedules are large and outlive the parse, keep them off the stack
+    old_key = malloc(sizeof(AES_REKEY_KEY));
+    new_key = malloc(sizeof(AES_REKEY_KEY));
+    if(old_key == NULL || new_key == NULL || load_key(&from, old_key) != 0 || load_key(&to, new_key) != 0)
+    {
+        fprintf(stderr, "rekey: bad key, iv or mode\n");
+        return 2;
+    }
+    r.from = old_key;
+    r.to = new_key;
+
+    in_fd = open(argv[optind], optind + 1 == argc? O_RDWR : O_RDONLY);
+    out_fd = optind + 1 == argc? in_fd : open(argv[optind + 1], O_WRONLY | O_CREAT, 0600);
+    if(in_fd < 0 || out_fd < 0)
+    {
+        perror("rekey");
+        return 1;
+    }
+    if(end == UINT64_MAX && fstat(in_fd, &st) == 0 && S_ISREG(st.st_mode))
+        end = (uint64_t)st.st_size;
+
+    if(state)
+    {
+        state_fd = open(state, O_RDWR | O_CREAT, 0600);
+        if(state_fd < 0)
+        {
+            perror("rekey: state file");
+            return 1;
+        }
+        memset(line, 0, sizeof(line));
+        if(pread(state_fd, line, sizeof(line) - 1, 0) > 0)
+        {
+            offset = strtoull(line, NULL, 10);
+            resumed = true;
+        }
+        r.progress = save_state;
+        r.arg = &state_fd;
+    }
+    if(out_fd == in_fd && state)
+    {
+        //a journal left from an earlier rotation must not be replayed on a new one
+        snprintf(journal, sizeof(journal), "%s.journal", state);
+        r.journal_fd = open(journal, O_RDWR | O_CREAT | (resumed? 0 : O_TRUNC), 0600);
+        if(r.journal_fd < 0)
+        {
+            perror("rekey: journal");
+            return 1;
+        }
+        r.journaled = true;
+    }
+
+    t0 = rekey_now();
+    rc = aes_rekey_file(&r, in_fd, out_fd, offset, end, &done);
+    fprintf(stderr, "rekey: %llu bytes from %llu, %.1f MB/s%s\n",
+            (unsigned long long)(done - offset), (unsigned long long)offset,
+            (double)(done - offset) / 1e6 / (rekey_now() - t0 + 1e-9),
+            rc == 0? "" : ", stopped on error");
+
+    aes_rekey_key_wipe(old_key);
+    aes_rekey_key_wipe(new_key);
+    free(old_key);
+    free(new_key);
+    return rc == 0? 0 : 1;
+}